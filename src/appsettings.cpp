@@ -0,0 +1,164 @@
+#include <QSettings>
+#include "appsettings.h"
+
+AppSettings::AppSettings(QSettings *settings, QObject *parent) :
+    QObject(parent), m_settings(settings), m_posterVisible(true), m_doubleClickDownload(false),
+    m_deleteFromDisk(false), m_fontSize(10), m_prebuffer(false), m_proxyPort(8080),
+    m_numScreenshots(0), m_loaded(false)
+{
+    load();
+}
+
+QSettings* AppSettings::settings() const
+{
+    return m_settings;
+}
+
+void AppSettings::load()
+{
+    bool posterVisible = m_posterVisible;
+    int fontSize = m_fontSize;
+    bool prebuffer = m_prebuffer;
+
+    m_settings->beginGroup("mainWindow");
+    m_posterVisible = m_settings->value("posterVisible", true).toBool();
+    m_doubleClickDownload = m_settings->value("doubleClick").toString() == "download";
+    m_deleteFromDisk = m_settings->value("deleteFromDisk", false).toBool();
+    m_fontSize = m_settings->value("fontSize", 10).toInt();
+    m_settings->endGroup();
+
+    m_settings->beginGroup("mediaPlayer");
+    m_streamPlayerCommand = m_settings->value("stream").toString();
+    m_filePlayerCommand = m_settings->value("file").toString();
+    m_flashPlayerCommand = m_settings->value("flash").toString();
+    m_deinterlaceOptions = m_settings->value(
+            "deinterlaceOptions", "--video-filter=deinterlace --deinterlace-mode=linear").toString();
+    m_prebuffer = m_settings->value("prebuffer", false).toBool();
+    m_settings->endGroup();
+
+    m_settings->beginGroup("client");
+    m_settings->beginGroup("proxy");
+    m_proxyHost = m_settings->value("host").toString();
+    m_proxyPort = qBound(0, m_settings->value("port", 8080).toInt(), 65535);
+    m_settings->endGroup();
+    m_settings->endGroup();
+
+    m_settings->beginGroup("downloads");
+    m_downloadDirectory = m_settings->value("directory").toString();
+    m_filenameFormat = m_settings->value("filenameFormat").toString();
+    m_settings->endGroup();
+
+    m_settings->beginGroup("screenshotWindow");
+    m_screenshotWindowGeometry = m_settings->value("geometry").toByteArray();
+    m_numScreenshots = m_settings->value("numScreenshots", 0).toInt();
+    m_settings->endGroup();
+
+    /* Ensimmäinen luku ei ole muutos. */
+    if (!m_loaded) {
+        m_loaded = true;
+        return;
+    }
+
+    if (fontSize != m_fontSize) {
+        emit fontSizeChanged(m_fontSize);
+    }
+
+    if (posterVisible != m_posterVisible) {
+        emit posterVisibleChanged(m_posterVisible);
+    }
+
+    if (prebuffer != m_prebuffer) {
+        emit prebufferChanged(m_prebuffer);
+    }
+}
+
+bool AppSettings::isPosterVisible() const
+{
+    return m_posterVisible;
+}
+
+bool AppSettings::isDoubleClickDownload() const
+{
+    return m_doubleClickDownload;
+}
+
+bool AppSettings::isDeleteFromDisk() const
+{
+    return m_deleteFromDisk;
+}
+
+int AppSettings::fontSize() const
+{
+    return m_fontSize;
+}
+
+QString AppSettings::streamPlayerCommand() const
+{
+    return m_streamPlayerCommand;
+}
+
+QString AppSettings::filePlayerCommand() const
+{
+    return m_filePlayerCommand;
+}
+
+QString AppSettings::flashPlayerCommand() const
+{
+    return m_flashPlayerCommand;
+}
+
+QString AppSettings::deinterlaceOptions() const
+{
+    return m_deinterlaceOptions;
+}
+
+bool AppSettings::isPrebufferEnabled() const
+{
+    return m_prebuffer;
+}
+
+QString AppSettings::proxyHost() const
+{
+    return m_proxyHost;
+}
+
+int AppSettings::proxyPort() const
+{
+    return m_proxyPort;
+}
+
+QString AppSettings::downloadDirectory() const
+{
+    return m_downloadDirectory;
+}
+
+QString AppSettings::filenameFormat() const
+{
+    return m_filenameFormat;
+}
+
+QByteArray AppSettings::screenshotWindowGeometry() const
+{
+    return m_screenshotWindowGeometry;
+}
+
+int AppSettings::numScreenshots() const
+{
+    return m_numScreenshots;
+}
+
+void AppSettings::setScreenshotWindowGeometry(const QByteArray &geometry)
+{
+    m_screenshotWindowGeometry = geometry;
+    m_settings->beginGroup("screenshotWindow");
+    m_settings->setValue("geometry", geometry);
+    m_settings->endGroup();
+}
+
+void AppSettings::setNumScreenshots(int numScreenshots)
+{
+    m_numScreenshots = numScreenshots;
+    m_settings->beginGroup("screenshotWindow");
+    m_settings->setValue("numScreenshots", numScreenshots);
+    m_settings->endGroup();
+}
@@ -0,0 +1,62 @@
+#ifndef APPSETTINGS_H
+#define APPSETTINGS_H
+
+#include <QByteArray>
+#include <QObject>
+#include <QString>
+
+class QSettings;
+
+/* Asetukset luettuina muistiin. Käyttöliittymän toiminnot lukevat arvot täältä
+   hakematta niitä QSettingsistä, ja load() lukee arvot uudelleen asetusten muututtua. */
+class AppSettings : public QObject
+{
+    Q_OBJECT
+public:
+    AppSettings(QSettings *settings, QObject *parent = 0);
+    QSettings* settings() const;
+    void load();
+    bool isPosterVisible() const;
+    bool isDoubleClickDownload() const;
+    bool isDeleteFromDisk() const;
+    int fontSize() const;
+    QString streamPlayerCommand() const;
+    QString filePlayerCommand() const;
+    QString flashPlayerCommand() const;
+    QString deinterlaceOptions() const;
+    bool isPrebufferEnabled() const;
+    QString proxyHost() const;
+    int proxyPort() const;
+    QString downloadDirectory() const;
+    QString filenameFormat() const;
+    QByteArray screenshotWindowGeometry() const;
+    int numScreenshots() const;
+    void setScreenshotWindowGeometry(const QByteArray &geometry);
+    void setNumScreenshots(int numScreenshots);
+
+signals:
+    void fontSizeChanged(int size);
+    void posterVisibleChanged(bool visible);
+    void prebufferChanged(bool enabled);
+
+private:
+    QSettings *m_settings;
+    bool m_posterVisible;
+    bool m_doubleClickDownload;
+    bool m_deleteFromDisk;
+    int m_fontSize;
+    QString m_streamPlayerCommand;
+    QString m_filePlayerCommand;
+    QString m_flashPlayerCommand;
+    QString m_deinterlaceOptions;
+    bool m_prebuffer;
+    QString m_proxyHost;
+    int m_proxyPort;
+    QString m_downloadDirectory;
+    QString m_filenameFormat;
+    QByteArray m_screenshotWindowGeometry;
+    int m_numScreenshots;
+    bool m_loaded;
+};
+
+#endif // APPSETTINGS_H
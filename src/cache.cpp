@@ -1,13 +1,37 @@
 #include <QDebug>
+#include <QLockFile>
+#include <QSaveFile>
 #include <QXmlStreamWriter>
+#include <algorithm>
 #include "cache.h"
+#include "posterpack.h"
+
+/* Enimmäisaika, jonka toisen ohjelman lukkoa odotetaan jaetussa hakemistossa. */
+static const int LOCK_TIMEOUT = 5000;
+
+/* Aikaväli-indeksissä pidetään tätä useamman päivän päässä tästä päivästä olevat
+   päivät vain levyllä. */
+static const int INDEX_DAYS = 7;
+
+static bool programmeStartLessThan(const Programme &a, const Programme &b)
+{
+    return a.startTime < b.startTime;
+}
 
 Cache::Cache()
 {
 }
 
+Cache::~Cache()
+{
+    qDeleteAll(m_posterPacks);
+}
+
 void Cache::setDirectory(const QDir &dir)
 {
+    qDeleteAll(m_posterPacks);
+    m_posterPacks.clear();
+    m_index.clear();
     m_dir = dir;
 }
 
@@ -59,21 +83,21 @@ QList<Channel> Cache::loadChannels(bool &ok)
         reader.skipCurrentElement();
     }
 
-    ok = true;
+    ok = !reader.hasError();
     return channels;
 }
 
 bool Cache::saveChannels(const QList<Channel> &channels)
 {
     QString filename = buildChannelsXmlFilename();
-    QDir dir(QFileInfo(filename).absolutePath());
+    QLockFile lock(filename + ".lock");
 
-    if (!dir.exists()) {
-        dir.mkpath(dir.path());
+    if (!lockFile(lock, filename)) {
+        return false;
     }
 
     qDebug() << "WRITE" << filename;
-    QFile file(filename);
+    QSaveFile file(filename);
 
     if (!file.open(QIODevice::WriteOnly)) {
         m_lastError = file.errorString();
@@ -96,13 +120,70 @@ bool Cache::saveChannels(const QList<Channel> &channels)
 
     writer.writeEndElement();
     writer.writeEndDocument();
-    file.close();
+    return commitFile(file);
+}
+
+ProgrammeSnapshot Cache::loadProgrammes(int channelId, const QDate &date, bool &ok, int &age)
+{
+    ProgrammeSnapshot programmes = readProgrammes(channelId, date, ok, age);
+
+    if (ok && isInIndexWindow(date)) {
+        m_index.setProgrammes(channelId, date, programmes);
+    }
+
+    return programmes;
+}
+
+bool Cache::saveProgrammes(int channelId, const QDate &date, const QDateTime &updateDateTime,
+                           const QDateTime &expireDateTime, const ProgrammeSnapshot &programmes)
+{
+    QString filename = buildProgrammesXmlFilename(channelId, date);
+    QLockFile lock(filename + ".lock");
+
+    if (!lockFile(lock, filename)) {
+        return false;
+    }
+
+    /* Toinen ohjelma ehti tallentaa tuoreemmat tiedot, joten ne otetaan käyttöön. */
+    if (isNewerOnDisk(filename, updateDateTime)) {
+        qDebug() << "KEEP" << filename;
+        bool ok;
+        int age;
+        ProgrammeSnapshot newer = readProgrammes(channelId, date, ok, age);
+
+        if (isInIndexWindow(date)) {
+            m_index.setProgrammes(channelId, date, ok ? newer : programmes);
+        }
+
+        return true;
+    }
+
+    qDebug() << "WRITE" << filename;
+    QSaveFile file(filename);
+
+    if (!file.open(QIODevice::WriteOnly)) {
+        m_lastError = file.errorString();
+        return false;
+    }
+
+    writeProgrammeFeed(&file, updateDateTime, expireDateTime, programmes);
+
+    if (!commitFile(file)) {
+        return false;
+    }
+
+    if (isInIndexWindow(date)) {
+        m_index.setProgrammes(channelId, date, withoutDescriptions(programmes));
+    }
+
     return true;
 }
 
-QList<Programme> Cache::loadProgrammes(int channelId, const QDate &date, bool &ok, int &age)
+/* Ei muuta välimuistin tilaa, joten tätä voi kutsua myös taustasäikeistä. */
+ProgrammeSnapshot Cache::readProgrammes(int channelId, const QDate &date, bool &ok, int &age,
+                                        bool allowExpired) const
 {
-    QList<Programme> programmes;
+    ProgrammeSnapshot programmes;
     QString filename = buildProgrammesXmlFilename(channelId, date);
     QFile file(filename);
     age = INT_MAX;
@@ -113,37 +194,118 @@ QList<Programme> Cache::loadProgrammes(int channelId, const QDate &date, bool &o
     }
 
     qDebug() << "READ" << filename;
-    programmes = readProgrammeFeed(&file, channelId, ok, age);
+    programmes = readProgrammeFeed(&file, channelId, ok, age, allowExpired, true);
     file.close();
     return programmes;
 }
 
-bool Cache::saveProgrammes(int channelId, const QDate &date, const QDateTime &updateDateTime,
-                           const QDateTime &expireDateTime, const QList<Programme> programmes)
+/* Päivän ohjelmalistoista kuvaukset jätetään levylle, joten ne luetaan vasta, kun
+   ohjelma näytetään. Puolenyön jälkeen alkava ohjelma voi olla edellisen päivän
+   listassa. */
+QString Cache::loadDescription(const Programme &programme) const
 {
-    QString filename = buildProgrammesXmlFilename(channelId, date);
-    QDir dir(QFileInfo(filename).absolutePath());
+    QString description;
 
-    if (!dir.exists()) {
-        dir.mkpath(dir.path());
+    if (!programme.descriptionInCache) {
+        return programme.description;
     }
 
-    qDebug() << "WRITE" << filename;
-    QFile file(filename);
+    QDate date = programme.startDateTime().date();
 
-    if (!file.open(QIODevice::WriteOnly)) {
-        m_lastError = file.errorString();
-        return false;
+    if (!readDescription(programme.channelId, date, programme.id, description)) {
+        readDescription(programme.channelId, date.addDays(-1), programme.id, description);
     }
 
-    writeProgrammeFeed(&file, updateDateTime, expireDateTime, programmes);
-    file.close();
-    return true;
+    return description;
+}
+
+/* Tallennetusta listasta tehty kopio, jonka kuvaukset luetaan välimuistista. */
+ProgrammeSnapshot Cache::withoutDescriptions(const ProgrammeSnapshot &programmes)
+{
+    QList<Programme> result = programmes.toList();
+    int count = result.size();
+
+    for (int i = 0; i < count; i++) {
+        Programme &programme = result[i];
+
+        if (programme.id >= 0 && programme.channelId >= 0 && !programme.description.isEmpty()) {
+            programme.description = QString();
+            programme.descriptionInCache = true;
+        }
+    }
+
+    return result;
+}
+
+/* Kanavat, joilta välimuistissa voi olla päivän ohjelmat. Ei muuta välimuistin tilaa. */
+QList<int> Cache::readChannelIds(const QDate &date) const
+{
+    QList<int> channelIds;
+    QDir monthDir(m_dir.filePath(date.toString("yyyy-MM")));
+    QStringList channelDirs = monthDir.entryList(QDir::Dirs | QDir::NoDotAndDotDot);
+    int count = channelDirs.size();
+
+    for (int i = 0; i < count; i++) {
+        bool ok;
+        int channelId = channelDirs.at(i).toInt(&ok);
+
+        if (ok) {
+            channelIds.append(channelId);
+        }
+    }
+
+    return channelIds;
 }
 
-QList<Programme> Cache::loadPlaylist(bool &ok, int &age)
+/* Vastaa vain indeksoiduista päivistä. Puuttuvat päivät luetaan taustasäikeessä
+   ProgrammeIndexLoaderilla. */
+QList<Programme> Cache::programmesBetween(const QDateTime &from, const QDateTime &to) const
 {
     QList<Programme> programmes;
+    qint64 fromTime = from.toMSecsSinceEpoch();
+    qint64 toTime = to.toMSecsSinceEpoch();
+
+    /* Edellisen päivän sivulla voi olla puolenyön jälkeen alkavia ohjelmia. */
+    for (QDate date = from.date().addDays(-1); date <= to.date(); date = date.addDays(1)) {
+        m_index.programmesBetween(date, fromTime, toTime, programmes);
+    }
+
+    std::stable_sort(programmes.begin(), programmes.end(), programmeStartLessThan);
+    return programmes;
+}
+
+void Cache::nowAndNext(const QDateTime &dateTime, QHash<int, Programme> &now, QHash<int, Programme> &next) const
+{
+    qint64 time = dateTime.toMSecsSinceEpoch();
+
+    for (int i = -1; i <= 1; i++) {
+        m_index.nowAndNext(dateTime.date().addDays(i), time, now, next);
+    }
+}
+
+bool Cache::needsIndexing(const QDate &date)
+{
+    return isInIndexWindow(date) && !m_index.containsDay(date);
+}
+
+void Cache::setIndexedProgrammes(int channelId, const QDate &date, const ProgrammeSnapshot &programmes)
+{
+    /* Taustasäikeen lukiessa tallennettu kanava on tuoreempi kuin luettu tiedosto. */
+    if (isInIndexWindow(date) && !m_index.containsChannel(channelId, date)) {
+        m_index.setProgrammes(channelId, date, programmes);
+    }
+}
+
+void Cache::setDayIndexed(const QDate &date)
+{
+    if (isInIndexWindow(date)) {
+        m_index.setDayLoaded(date);
+    }
+}
+
+ProgrammeSnapshot Cache::loadPlaylist(bool &ok, int &age)
+{
+    ProgrammeSnapshot programmes;
     QString filename = buildPlaylistXmlFilename();
     QFile file(filename);
     age = INT_MAX;
@@ -159,17 +321,22 @@ QList<Programme> Cache::loadPlaylist(bool &ok, int &age)
     return programmes;
 }
 
-bool Cache::savePlaylist(const QDateTime &updateDateTime, QList<Programme>programmes)
+bool Cache::savePlaylist(const QDateTime &updateDateTime, const ProgrammeSnapshot &programmes)
 {
     QString filename = buildPlaylistXmlFilename();
-    QDir dir(QFileInfo(filename).absolutePath());
+    QLockFile lock(filename + ".lock");
 
-    if (!dir.exists()) {
-        dir.mkpath(dir.path());
+    if (!lockFile(lock, filename)) {
+        return false;
+    }
+
+    if (isNewerOnDisk(filename, updateDateTime)) {
+        qDebug() << "KEEP" << filename;
+        return true;
     }
 
     qDebug() << "WRITE" << filename;
-    QFile file(filename);
+    QSaveFile file(filename);
 
     if (!file.open(QIODevice::WriteOnly)) {
         m_lastError = file.errorString();
@@ -177,20 +344,25 @@ bool Cache::savePlaylist(const QDateTime &updateDateTime, QList<Programme>progra
     }
 
     writeProgrammeFeed(&file, updateDateTime, QDateTime(), programmes);
-    file.close();
-    return true;
+    return commitFile(file);
 }
 
 bool Cache::removePlaylist()
 {
     QString filename = buildPlaylistXmlFilename();
+    QLockFile lock(filename + ".lock");
+
+    if (!lockFile(lock, filename)) {
+        return false;
+    }
+
     qDebug() << "REMOVE" << filename;
     return QFile(filename).remove();
 }
 
-QList<Programme> Cache::loadSeasonPasses(bool &ok, int &age)
+ProgrammeSnapshot Cache::loadSeasonPasses(bool &ok, int &age)
 {
-    QList<Programme> programmes;
+    ProgrammeSnapshot programmes;
     QString filename = buildSeasonPassesXmlFilename();
     QFile file(filename);
     age = INT_MAX;
@@ -206,17 +378,22 @@ QList<Programme> Cache::loadSeasonPasses(bool &ok, int &age)
     return programmes;
 }
 
-bool Cache::saveSeasonPasses(const QDateTime &updateDateTime, QList<Programme>programmes)
+bool Cache::saveSeasonPasses(const QDateTime &updateDateTime, const ProgrammeSnapshot &programmes)
 {
     QString filename = buildSeasonPassesXmlFilename();
-    QDir dir(QFileInfo(filename).absolutePath());
+    QLockFile lock(filename + ".lock");
 
-    if (!dir.exists()) {
-        dir.mkpath(dir.path());
+    if (!lockFile(lock, filename)) {
+        return false;
+    }
+
+    if (isNewerOnDisk(filename, updateDateTime)) {
+        qDebug() << "KEEP" << filename;
+        return true;
     }
 
     qDebug() << "WRITE" << filename;
-    QFile file(filename);
+    QSaveFile file(filename);
 
     if (!file.open(QIODevice::WriteOnly)) {
         m_lastError = file.errorString();
@@ -224,47 +401,59 @@ bool Cache::saveSeasonPasses(const QDateTime &updateDateTime, QList<Programme>pr
     }
 
     writeProgrammeFeed(&file, updateDateTime, QDateTime(), programmes);
-    file.close();
-    return true;
+    return commitFile(file);
 }
 
 bool Cache::removeSeasonPasses()
 {
     QString filename = buildSeasonPassesXmlFilename();
+    QLockFile lock(filename + ".lock");
+
+    if (!lockFile(lock, filename)) {
+        return false;
+    }
+
     qDebug() << "REMOVE" << filename;
     return QFile(filename).remove();
 }
 
-QImage Cache::loadPoster(const Programme &programme)
+QByteArray Cache::loadPosterData(const Programme &programme)
+{
+    return posterPack(programme)->data(programme.id);
+}
+
+bool Cache::savePoster(const Programme &programme, const QByteArray &data)
 {
-    QString filename = buildPosterFilename(programme);
+    PosterPack *pack = posterPack(programme);
 
-    if (!QFileInfo(filename).exists()) {
-        return QImage();
+    if (!pack->append(programme.id, data)) {
+        m_lastError = pack->lastError();
+        return false;
     }
 
-    qDebug() << "READ" << filename;
-    return QImage(filename);
+    return true;
 }
 
-bool Cache::savePoster(const Programme &programme, const QByteArray &data)
+void Cache::compactPosters()
 {
-    QString filename = buildPosterFilename(programme);
-    QDir dir(QFileInfo(filename).absolutePath());
+    /* Tiivistetään paketit, joissa yli neljännes on korvattuja kuvia. */
+    QHash<QString, PosterPack*>::const_iterator iter = m_posterPacks.constBegin();
 
-    if (!dir.exists()) {
-        dir.mkpath(dir.path());
-    }
+    while (iter != m_posterPacks.constEnd()) {
+        PosterPack *pack = iter.value();
 
-    qDebug() << "WRITE" << filename;
-    QFile file(filename);
+        if (pack->wastedBytes() > 0 && pack->wastedBytes() * 4 > pack->dataSize()) {
+            pack->compact();
+        }
 
-    if (!file.open(QIODevice::WriteOnly)) {
-        return false;
+        ++iter;
     }
+}
 
-    file.write(data);
-    return true;
+void Cache::closePosterPack(const QString &month)
+{
+    /* Poistetun paketin kartoitus ja indeksi eivät enää vastaa levyä. */
+    delete m_posterPacks.take(month);
 }
 
 QString Cache::buildChannelsXmlFilename() const
@@ -290,15 +479,80 @@ QString Cache::buildSeasonPassesXmlFilename() const
     return m_dir.filePath("season-passes.xml");
 }
 
-QString Cache::buildPosterFilename(const Programme &programme) const
+bool Cache::isInIndexWindow(const QDate &date)
 {
-    QString path = QString("%1/%2/i%3.jpg").arg(
-            programme.startDateTime.toString("yyyy-MM")).arg(programme.channelId).arg(programme.id);
+    QDate today = QDate::currentDate();
 
-    return m_dir.filePath(path);
+    if (today != m_indexToday) {
+        m_indexToday = today;
+        m_index.removeDaysOutside(today.addDays(-INDEX_DAYS), today.addDays(INDEX_DAYS));
+    }
+
+    return qAbs(today.daysTo(date)) <= INDEX_DAYS;
+}
+
+PosterPack* Cache::posterPack(const Programme &programme)
+{
+    QString month = programme.startDateTime().toString("yyyy-MM");
+    PosterPack *pack = m_posterPacks.value(month);
+
+    if (pack == 0) {
+        pack = new PosterPack(m_dir.filePath(QString("%1/posters.dat").arg(month)),
+                              m_dir.filePath(QString("%1/posters.idx").arg(month)));
+        m_posterPacks.insert(month, pack);
+    }
+
+    return pack;
+}
+
+bool Cache::lockFile(QLockFile &lock, const QString &filename)
+{
+    QDir dir(QFileInfo(filename).absolutePath());
+
+    if (!dir.exists()) {
+        dir.mkpath(dir.path());
+    }
+
+    if (!lock.tryLock(LOCK_TIMEOUT)) {
+        m_lastError = QString("Cache file %1 is locked by another process").arg(filename);
+        return false;
+    }
+
+    return true;
+}
+
+bool Cache::isNewerOnDisk(const QString &filename, const QDateTime &updateDateTime) const
+{
+    QFile file(filename);
+
+    if (!file.open(QIODevice::ReadOnly)) {
+        return false;
+    }
+
+    QXmlStreamReader reader(&file);
+
+    if (!reader.readNextStartElement()) {
+        return false;
+    }
+
+    QDateTime diskDateTime = QDateTime::fromString(
+            reader.attributes().value("updateDateTime").toString(), "yyyy-MM-dd'T'hh:mm:ss");
+
+    return diskDateTime.isValid() && diskDateTime > updateDateTime;
+}
+
+bool Cache::commitFile(QSaveFile &file)
+{
+    if (!file.commit()) {
+        m_lastError = file.errorString();
+        return false;
+    }
+
+    return true;
 }
 
-QList<Programme> Cache::readProgrammeFeed(QIODevice *device, int channelId, bool &ok, int &age)
+ProgrammeSnapshot Cache::readProgrammeFeed(QIODevice *device, int channelId, bool &ok, int &age,
+                                          bool allowExpired, bool lazyDescriptions) const
 {
     QList<Programme> programmes;
     QXmlStreamReader reader(device);
@@ -314,7 +568,7 @@ QList<Programme> Cache::readProgrammeFeed(QIODevice *device, int channelId, bool
     if (!expireDateTimeString.isEmpty()) {
         QDateTime expireDateTime = QDateTime::fromString(expireDateTimeString, "yyyy-MM-dd'T'hh:mm:ss");
 
-        if (expireDateTime < QDateTime::currentDateTime()) {
+        if (!allowExpired && expireDateTime < QDateTime::currentDateTime()) {
             ok = false;
             return programmes;
         }
@@ -341,8 +595,8 @@ QList<Programme> Cache::readProgrammeFeed(QIODevice *device, int channelId, bool
             programme.id = id;
         }
 
-        programme.startDateTime = QDateTime::fromString(attrs.value("dateTime").toString(),
-                                                        "yyyy-MM-dd'T'hh:mm:ss");
+        programme.setStartDateTime(QDateTime::fromString(attrs.value("dateTime").toString(),
+                                                         "yyyy-MM-dd'T'hh:mm:ss"));
         programme.flags = attrs.value("flags").toString().toInt();
         QString channelString = attrs.value("channel").toString();
 
@@ -372,7 +626,11 @@ QList<Programme> Cache::readProgrammeFeed(QIODevice *device, int channelId, bool
 
         while (reader.readNextStartElement()) {
             if (reader.name() == "title") {
-                programme.title = reader.readElementText();
+                programme.title = Programme::internTitle(reader.readElementText());
+            }
+            else if (reader.name() == "description" && lazyDescriptions && programme.id >= 0) {
+                programme.descriptionInCache = true;
+                reader.skipCurrentElement();
             }
             else if (reader.name() == "description") {
                 programme.description = reader.readElementText();
@@ -382,12 +640,48 @@ QList<Programme> Cache::readProgrammeFeed(QIODevice *device, int channelId, bool
         programmes.append(programme);
     }
 
-    ok = true;
+    /* Katkennut tiedosto on huti eikä osittainen lista. */
+    ok = !reader.hasError();
     return programmes;
 }
 
+bool Cache::readDescription(int channelId, const QDate &date, int programmeId, QString &description) const
+{
+    QFile file(buildProgrammesXmlFilename(channelId, date));
+
+    if (!file.open(QIODevice::ReadOnly)) {
+        return false;
+    }
+
+    QXmlStreamReader reader(&file);
+
+    if (!reader.readNextStartElement() || reader.name() != "programmes") {
+        return false;
+    }
+
+    while (reader.readNextStartElement()) {
+        if (reader.name() != "programme" || reader.attributes().value("id").toString().toInt() != programmeId) {
+            reader.skipCurrentElement();
+            continue;
+        }
+
+        while (reader.readNextStartElement()) {
+            if (reader.name() == "description") {
+                description = reader.readElementText();
+                return true;
+            }
+
+            reader.skipCurrentElement();
+        }
+
+        return true;
+    }
+
+    return false;
+}
+
 void Cache::writeProgrammeFeed(QIODevice *device, const QDateTime &updateDateTime,
-                               const QDateTime &expireDateTime, QList<Programme>programmes)
+                               const QDateTime &expireDateTime, const ProgrammeSnapshot &programmes)
 {
     QXmlStreamWriter writer(device);
     writer.writeStartDocument();
@@ -401,14 +695,14 @@ void Cache::writeProgrammeFeed(QIODevice *device, const QDateTime &updateDateTim
     int count = programmes.size();
 
     for (int i = 0; i < count; i++) {
-        Programme programme = programmes.at(i);
+        const Programme &programme = programmes.at(i);
         writer.writeStartElement("programme");
 
         if (programme.id >= 0) {
             writer.writeAttribute("id", QString::number(programme.id));
         }
 
-        writer.writeAttribute("dateTime", programme.startDateTime.toString("yyyy-MM-dd'T'hh:mm:ss"));
+        writer.writeAttribute("dateTime", programme.startDateTime().toString("yyyy-MM-dd'T'hh:mm:ss"));
 
         if (programme.flags > 0) {
             writer.writeAttribute("flags", QString::number(programme.flags));
@@ -427,7 +721,8 @@ void Cache::writeProgrammeFeed(QIODevice *device, const QDateTime &updateDateTim
         }
 
         writer.writeTextElement("title", programme.title);
-        writer.writeTextElement("description", programme.description);
+        /* Päivän listasta soittolistaan lisätyn ohjelman kuvaus on vielä levyllä. */
+        writer.writeTextElement("description", loadDescription(programme));
         writer.writeEndElement();
     }
 
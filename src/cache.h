@@ -2,43 +2,71 @@
 #define CACHE_H
 
 #include <QDir>
+#include <QHash>
 #include <QImage>
 #include <QList>
 #include "channel.h"
-#include "programme.h"
+#include "programmeindex.h"
+#include "programmesnapshot.h"
+
+class PosterPack;
+class QLockFile;
+class QSaveFile;
 
 class Cache
 {
 public:
     Cache();
+    ~Cache();
     void setDirectory(const QDir &dir);
     QDir directory() const;
     QString lastError() const;
     QList<Channel> loadChannels(bool &ok);
     bool saveChannels(const QList<Channel> &channels);
-    QList<Programme> loadProgrammes(int channelId, const QDate &date, bool &ok, int &age);
+    ProgrammeSnapshot loadProgrammes(int channelId, const QDate &date, bool &ok, int &age);
+    ProgrammeSnapshot readProgrammes(int channelId, const QDate &date, bool &ok, int &age,
+                                     bool allowExpired = false) const;
+    QList<int> readChannelIds(const QDate &date) const;
+    QString loadDescription(const Programme &programme) const;
+    static ProgrammeSnapshot withoutDescriptions(const ProgrammeSnapshot &programmes);
     bool saveProgrammes(int channelId, const QDate &date, const QDateTime &updateDateTime,
-                        const QDateTime &expireDateTime, const QList<Programme> programmes);
-    QList<Programme> loadPlaylist(bool &ok, int &age);
-    bool savePlaylist(const QDateTime &updateDateTime, const QList<Programme> programmes);
+                        const QDateTime &expireDateTime, const ProgrammeSnapshot &programmes);
+    QList<Programme> programmesBetween(const QDateTime &from, const QDateTime &to) const;
+    void nowAndNext(const QDateTime &dateTime, QHash<int, Programme> &now, QHash<int, Programme> &next) const;
+    bool needsIndexing(const QDate &date);
+    void setIndexedProgrammes(int channelId, const QDate &date, const ProgrammeSnapshot &programmes);
+    void setDayIndexed(const QDate &date);
+    ProgrammeSnapshot loadPlaylist(bool &ok, int &age);
+    bool savePlaylist(const QDateTime &updateDateTime, const ProgrammeSnapshot &programmes);
     bool removePlaylist();
-    QList<Programme> loadSeasonPasses(bool &ok, int &age);
-    bool saveSeasonPasses(const QDateTime &updateDateTime, const QList<Programme> programmes);
+    ProgrammeSnapshot loadSeasonPasses(bool &ok, int &age);
+    bool saveSeasonPasses(const QDateTime &updateDateTime, const ProgrammeSnapshot &programmes);
     bool removeSeasonPasses();
-    QImage loadPoster(const Programme &programme);
+    QByteArray loadPosterData(const Programme &programme);
     bool savePoster(const Programme &programme, const QByteArray &data);
+    void compactPosters();
+    void closePosterPack(const QString &month);
 
 private:
     QString buildChannelsXmlFilename() const;
     QString buildProgrammesXmlFilename(int channelId, const QDate &date) const;
     QString buildPlaylistXmlFilename() const;
     QString buildSeasonPassesXmlFilename() const;
-    QString buildPosterFilename(const Programme &programme) const;
-    QList<Programme> readProgrammeFeed(QIODevice *device, int channelId, bool &ok, int &age);
+    PosterPack* posterPack(const Programme &programme);
+    bool lockFile(QLockFile &lock, const QString &filename);
+    bool isNewerOnDisk(const QString &filename, const QDateTime &updateDateTime) const;
+    bool commitFile(QSaveFile &file);
+    ProgrammeSnapshot readProgrammeFeed(QIODevice *device, int channelId, bool &ok, int &age,
+                                        bool allowExpired = false, bool lazyDescriptions = false) const;
+    bool readDescription(int channelId, const QDate &date, int programmeId, QString &description) const;
+    bool isInIndexWindow(const QDate &date);
     void writeProgrammeFeed(QIODevice *device, const QDateTime &updateDateTime,
-                            const QDateTime &expireDateTime, const QList<Programme> programmes);
+                            const QDateTime &expireDateTime, const ProgrammeSnapshot &programmes);
     QDir m_dir;
     QString m_lastError;
+    QHash<QString, PosterPack*> m_posterPacks;
+    ProgrammeIndex m_index;
+    QDate m_indexToday;
 };
 
 #endif // CACHE_H
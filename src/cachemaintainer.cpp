@@ -0,0 +1,273 @@
+#include <QDebug>
+#include <QDirIterator>
+#include <QFile>
+#include <QFileInfo>
+#include <QLockFile>
+#include <QTimer>
+#include <QtAlgorithms>
+#include "cachemaintainer.h"
+
+/* Käsitellään kerralla vain muutama tiedosto, jotta käyttöliittymä ei jumiudu. */
+static const int FILES_PER_STEP = 200;
+
+/* Enimmäisaika, jonka toisen ohjelman lukkoa odotetaan ennen tiedoston poistamista. */
+static const int LOCK_TIMEOUT = 5000;
+
+static bool lastAccessLessThan(const CacheFile &a, const CacheFile &b)
+{
+    return a.lastAccess < b.lastAccess;
+}
+
+CacheMaintainer::CacheMaintainer(QObject *parent) :
+    QObject(parent), m_stepTimer(new QTimer(this)), m_scheduleTimer(new QTimer(this)),
+    m_iterator(0), m_maxSize(500 * 1024 * 1024), m_totalSize(0), m_bytesReclaimed(0),
+    m_filesRemoved(0), m_maxAge(90), m_state(0)
+{
+    m_stepTimer->setInterval(0);
+    m_scheduleTimer->setSingleShot(true);
+    m_scheduleTimer->setInterval(6 * 60 * 60 * 1000);
+    connect(m_stepTimer, SIGNAL(timeout()), SLOT(sweepStep()));
+    connect(m_scheduleTimer, SIGNAL(timeout()), SLOT(start()));
+}
+
+CacheMaintainer::~CacheMaintainer()
+{
+    delete m_iterator;
+}
+
+void CacheMaintainer::setDirectory(const QDir &dir)
+{
+    m_dir = dir;
+}
+
+QDir CacheMaintainer::directory() const
+{
+    return m_dir;
+}
+
+void CacheMaintainer::setMaxSize(qint64 bytes)
+{
+    m_maxSize = bytes;
+}
+
+qint64 CacheMaintainer::maxSize() const
+{
+    return m_maxSize;
+}
+
+void CacheMaintainer::setMaxAge(int days)
+{
+    m_maxAge = days;
+}
+
+int CacheMaintainer::maxAge() const
+{
+    return m_maxAge;
+}
+
+void CacheMaintainer::setInterval(int msecs)
+{
+    m_scheduleTimer->setInterval(msecs);
+}
+
+int CacheMaintainer::interval() const
+{
+    return m_scheduleTimer->interval();
+}
+
+bool CacheMaintainer::isRunning() const
+{
+    return m_state != 0;
+}
+
+void CacheMaintainer::start()
+{
+    if (isRunning()) {
+        return;
+    }
+
+    /* Hakemisto voi syntyä myöhemmin, joten yritetään uudelleen seuraavalla kerralla. */
+    if (!m_dir.exists()) {
+        m_scheduleTimer->start();
+        return;
+    }
+
+    qDebug() << "CACHE SWEEP" << m_dir.path();
+    m_scheduleTimer->stop();
+    m_files.clear();
+    m_evicted.clear();
+    m_totalSize = 0;
+    m_bytesReclaimed = 0;
+    m_filesRemoved = 0;
+    delete m_iterator;
+    m_iterator = new QDirIterator(m_dir.path(), QDir::Files, QDirIterator::Subdirectories);
+    m_state = 1;
+    m_stepTimer->start();
+}
+
+void CacheMaintainer::stop()
+{
+    m_stepTimer->stop();
+    m_scheduleTimer->stop();
+    delete m_iterator;
+    m_iterator = 0;
+    m_files.clear();
+    m_evicted.clear();
+    m_state = 0;
+}
+
+void CacheMaintainer::sweepStep()
+{
+    if (m_state == 1) {
+        scanStep();
+    }
+    else if (m_state == 2) {
+        evictStep();
+    }
+}
+
+void CacheMaintainer::scanStep()
+{
+    QString rootPath = QFileInfo(m_dir.path()).absoluteFilePath();
+
+    for (int i = 0; i < FILES_PER_STEP; i++) {
+        if (!m_iterator->hasNext()) {
+            delete m_iterator;
+            m_iterator = 0;
+            selectEvictedFiles();
+            m_state = 2;
+            return;
+        }
+
+        m_iterator->next();
+        QFileInfo fileInfo = m_iterator->fileInfo();
+
+        /* Kanavalista, katselulista ja suosikkisarjat pidetään aina. */
+        if (fileInfo.absolutePath() == rootPath) {
+            continue;
+        }
+
+        /* Toisen ohjelman lukkoa ei poisteta kesken kirjoituksen. */
+        if (fileInfo.suffix() == "lock") {
+            continue;
+        }
+
+        /* Kuvapaketin indeksi käsitellään yhdessä datatiedoston kanssa. */
+        if (fileInfo.fileName() == "posters.idx") {
+            continue;
+        }
+
+        CacheFile file;
+        file.path = fileInfo.absoluteFilePath();
+        file.size = fileInfo.size();
+        file.lastAccess = fileInfo.lastRead();
+
+        if (!file.lastAccess.isValid() || file.lastAccess < fileInfo.lastModified()) {
+            file.lastAccess = fileInfo.lastModified();
+        }
+
+        /* Kartoitettu luku ei päivitä käyttöaikaa, joten paketin käyttö näkyy vain
+           lisäysten muokkausajoista. */
+        if (fileInfo.fileName() == "posters.dat") {
+            QFileInfo indexInfo(fileInfo.absolutePath() + "/posters.idx");
+
+            if (indexInfo.exists()) {
+                file.size += indexInfo.size();
+
+                if (file.lastAccess < indexInfo.lastModified()) {
+                    file.lastAccess = indexInfo.lastModified();
+                }
+            }
+        }
+
+        m_totalSize += file.size;
+        m_files.append(file);
+    }
+}
+
+void CacheMaintainer::selectEvictedFiles()
+{
+    /* Poistetaan ensin vanhentuneet ja sen jälkeen pisimpään käyttämättä olleet
+       tiedostot, kunnes välimuisti mahtuu kiintiöönsä. */
+    qSort(m_files.begin(), m_files.end(), lastAccessLessThan);
+    QDateTime expireDateTime = QDateTime::currentDateTime().addDays(-m_maxAge);
+    qint64 size = m_totalSize;
+    int count = m_files.size();
+
+    for (int i = 0; i < count; i++) {
+        const CacheFile &file = m_files.at(i);
+        bool expired = m_maxAge > 0 && file.lastAccess < expireDateTime;
+        bool overQuota = m_maxSize > 0 && size > m_maxSize;
+
+        if (!expired && !overQuota) {
+            break;
+        }
+
+        m_evicted.append(file);
+        size -= file.size;
+    }
+
+    qDebug() << "CACHE" << m_files.size() << "files" << m_totalSize << "bytes,"
+             << m_evicted.size() << "to be removed";
+    m_files.clear();
+}
+
+void CacheMaintainer::evictStep()
+{
+    for (int i = 0; i < FILES_PER_STEP && !m_evicted.isEmpty(); i++) {
+        CacheFile file = m_evicted.takeFirst();
+        QFileInfo fileInfo(file.path);
+        bool posterPack = fileInfo.fileName() == "posters.dat";
+
+        /* Poistetaan samojen lukkojen alla, joilla kirjoittajat muuttavat tiedostoja.
+           Lukittu tiedosto jätetään seuraavalle kierrokselle. */
+        QLockFile lock(posterPack ? fileInfo.absolutePath() + "/posters.lock" : file.path + ".lock");
+
+        if (!lock.tryLock(LOCK_TIMEOUT)) {
+            qDebug() << "LOCKED" << file.path;
+            continue;
+        }
+
+        if (!QFile::remove(file.path)) {
+            continue;
+        }
+
+        m_bytesReclaimed += file.size;
+        m_filesRemoved++;
+
+        if (posterPack) {
+            QFile::remove(fileInfo.absolutePath() + "/posters.idx");
+            emit posterPackRemoved(fileInfo.dir().dirName());
+        }
+    }
+
+    if (!m_evicted.isEmpty()) {
+        return;
+    }
+
+    m_stepTimer->stop();
+    removeEmptyDirectories();
+    m_state = 0;
+    qDebug() << "CACHE REMOVED" << m_filesRemoved << "files," << m_bytesReclaimed << "bytes reclaimed";
+    m_scheduleTimer->start();
+    emit finished(m_bytesReclaimed, m_filesRemoved);
+}
+
+void CacheMaintainer::removeEmptyDirectories()
+{
+    /* Kuukausi- ja kanavahakemistot, rmdir epäonnistuu, jos hakemisto ei ole tyhjä. */
+    QStringList months = m_dir.entryList(QDir::Dirs | QDir::NoDotAndDotDot);
+    int monthCount = months.size();
+
+    for (int i = 0; i < monthCount; i++) {
+        QDir monthDir(m_dir.filePath(months.at(i)));
+        QStringList channels = monthDir.entryList(QDir::Dirs | QDir::NoDotAndDotDot);
+        int channelCount = channels.size();
+
+        for (int j = 0; j < channelCount; j++) {
+            monthDir.rmdir(channels.at(j));
+        }
+
+        m_dir.rmdir(months.at(i));
+    }
+}
@@ -0,0 +1,65 @@
+#ifndef CACHEMAINTAINER_H
+#define CACHEMAINTAINER_H
+
+#include <QDateTime>
+#include <QDir>
+#include <QList>
+#include <QObject>
+
+class QDirIterator;
+class QTimer;
+
+struct CacheFile
+{
+    QString path;
+    qint64 size;
+    QDateTime lastAccess;
+};
+
+class CacheMaintainer : public QObject
+{
+    Q_OBJECT
+public:
+    CacheMaintainer(QObject *parent = 0);
+    ~CacheMaintainer();
+    void setDirectory(const QDir &dir);
+    QDir directory() const;
+    void setMaxSize(qint64 bytes);
+    qint64 maxSize() const;
+    void setMaxAge(int days);
+    int maxAge() const;
+    void setInterval(int msecs);
+    int interval() const;
+    bool isRunning() const;
+
+public slots:
+    void start();
+    void stop();
+
+signals:
+    void finished(qint64 bytesReclaimed, int filesRemoved);
+    void posterPackRemoved(const QString &month);
+
+private slots:
+    void sweepStep();
+
+private:
+    void scanStep();
+    void evictStep();
+    void selectEvictedFiles();
+    void removeEmptyDirectories();
+    QDir m_dir;
+    QTimer *m_stepTimer;
+    QTimer *m_scheduleTimer;
+    QDirIterator *m_iterator;
+    QList<CacheFile> m_files;
+    QList<CacheFile> m_evicted;
+    qint64 m_maxSize;
+    qint64 m_totalSize;
+    qint64 m_bytesReclaimed;
+    int m_filesRemoved;
+    int m_maxAge;
+    int m_state;
+};
+
+#endif // CACHEMAINTAINER_H
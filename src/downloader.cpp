@@ -2,26 +2,61 @@
 #include <QDir>
 #include <QFileInfo>
 #include <QNetworkReply>
+#include <QTimer>
 #include <QUrl>
+#ifdef Q_OS_WIN
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
 #include "downloader.h"
+#include "tsvalidator.h"
 #include "tvkaistaclient.h"
 
+/* Katkennut siirto jatketaan automaattisesti kirjoitetun datan lopusta. Viive alkaa
+   viidestä sekunnista ja kaksinkertaistuu viiteen minuuttiin asti, ja siihen lisätään
+   ±25 % satunnaisuutta. Laskuri nollautuu, kun dataa saadaan taas. */
+static const int MAX_RETRIES = 8;
+static const int RETRY_DELAY = 5000;
+static const int MAX_RETRY_DELAY = 5 * 60 * 1000;
+
+/* Videon osoite on voimassa rajallisen ajan, joten vanha osoite selvitetään uudelleen. */
+static const qint64 STREAM_URL_TTL = 10 * 60 * 1000;
+static const int RESOLVE_TIMEOUT = 20000;
+
 Downloader::Downloader(TvkaistaClient *client, QObject *parent) :
-    QObject(parent), m_client(client), m_reply(0), m_byteOffset(0),
-    m_bytesReceived(0), m_bytesTotal(-1), m_finished(false)
+    QObject(parent), m_client(client), m_reply(0), m_retryTimer(new QTimer(this)),
+    m_programmeId(-1), m_format(-1), m_retries(0), m_urlExpired(false), m_resolving(false),
+    m_expectedSize(-1), m_validator(0), m_byteOffset(0),
+    m_bytesReceived(0), m_bytesTotal(-1), m_bytesWritten(0), m_finished(false)
 {
     m_buf = new char[4096];
+    m_retryTimer->setSingleShot(true);
+    connect(m_retryTimer, SIGNAL(timeout()), SLOT(retryTimeout()));
+    connect(m_client, SIGNAL(streamUrlResolved(int,int,QUrl)), SLOT(streamUrlResolved(int,int,QUrl)));
 }
 
 Downloader::~Downloader()
 {
     delete m_buf;
+    delete m_validator;
 }
 
 void Downloader::start(const QUrl &url)
 {
     abort();
-    QNetworkRequest request(url);
+    m_url = url;
+    m_urlAge.start();
+    m_urlExpired = false;
+    m_retries = 0;
+    sendRequest();
+}
+
+void Downloader::sendRequest()
+{
+    m_bytesWritten = m_byteOffset;
+    m_expectedSize = -1;
+    QNetworkRequest request(m_url);
 
     if (m_byteOffset > 0) {
         qDebug() << "Range" << m_byteOffset;
@@ -37,6 +72,9 @@ void Downloader::start(const QUrl &url)
 
 void Downloader::abort()
 {
+    m_retryTimer->stop();
+    m_resolving = false;
+
     if (m_reply == 0) {
         return;
     }
@@ -61,6 +99,27 @@ qint64 Downloader::bytesTotal() const
     return m_bytesTotal;
 }
 
+qint64 Downloader::bytesWritten() const
+{
+    return m_bytesWritten;
+}
+
+/* Vie tiedoston sisällön levylle asti. Voi kestää pitkään, joten tätä kutsutaan
+   taustasäikeestä. */
+bool Downloader::syncFile(QFile &file)
+{
+#ifdef Q_OS_WIN
+    return _commit(file.handle()) == 0;
+#else
+    return ::fsync(file.handle()) == 0;
+#endif
+}
+
+int Downloader::streamErrors() const
+{
+    return m_validator != 0 ? m_validator->errorCount() : 0;
+}
+
 bool Downloader::hasError() const
 {
     return !m_error.isEmpty();
@@ -91,27 +150,59 @@ bool Downloader::isFilenameFromReply() const
     return m_filenameFromReply;
 }
 
-void Downloader::setByteOffset(int byteOffset)
+void Downloader::setByteOffset(qint64 byteOffset)
 {
     m_byteOffset = byteOffset;
 }
 
-int Downloader::byteOffset() const
+qint64 Downloader::byteOffset() const
 {
     return m_byteOffset;
 }
 
+void Downloader::setStream(int programmeId, int format)
+{
+    m_programmeId = programmeId;
+    m_format = format;
+}
+
+int Downloader::retryCount() const
+{
+    return m_retries;
+}
+
+bool Downloader::isRetrying() const
+{
+    return m_retryTimer->isActive();
+}
+
 void Downloader::replyReadyRead()
 {
     if (!m_file.isOpen()) {
         /* "Content-Disposition: inline; filename=Tv-uutiset_2010.12.30_YLE-TV1_8661167.ts" */
         QString dispositionHeader = m_reply->rawHeader("Content-Disposition");
 
-        if (m_filenameFromReply && dispositionHeader.startsWith("inline; filename=")) {
+        int status = m_reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+        bool rangeIgnored = m_byteOffset > 0 && status == 200;
+
+        if (m_filenameFromReply && m_byteOffset == 0 && dispositionHeader.startsWith("inline; filename=")) {
             m_filename = QFileInfo(QFileInfo(m_filename).dir(), dispositionHeader.mid(17)).filePath();
         }
 
-        if (m_byteOffset == 0) {
+        /* Palvelin ei huomioinut Range-otsaketta, joten tiedosto kirjoitetaan alusta. */
+        if (rangeIgnored) {
+            qDebug() << "Range ignored, rewriting" << m_filename;
+            m_byteOffset = 0;
+            m_bytesWritten = 0;
+            m_file.setFileName(m_filename);
+
+            if (!m_file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+                m_error = m_file.errorString();
+                abort();
+                return;
+            }
+        }
+        else if (m_byteOffset == 0) {
             appendSuffixToFilenameAndCreateDir();
             qDebug() << "WRITE" << m_filename;
             m_file.setFileName(m_filename);
@@ -131,25 +222,93 @@ void Downloader::replyReadyRead()
                 abort();
                 return;
             }
+
+            /* Levyllä voi olla keskeytyneen kirjoituksen jäljiltä tavuja, joita ei ole
+               kirjattu kirjoitetuiksi. */
+            if (m_file.size() > m_byteOffset && !m_file.resize(m_byteOffset)) {
+                m_error = m_file.errorString();
+                abort();
+                return;
+            }
+        }
+
+        /* "Content-Range: bytes 1000-1999/2000" */
+        QByteArray rangeHeader = m_reply->rawHeader("Content-Range");
+        int slash = rangeHeader.lastIndexOf('/');
+        bool ok = false;
+
+        if (slash >= 0 && !rangeIgnored) {
+            m_expectedSize = rangeHeader.mid(slash + 1).toLongLong(&ok);
+        }
+
+        if (!ok) {
+            QVariant length = m_reply->header(QNetworkRequest::ContentLengthHeader);
+            m_expectedSize = length.isValid() ? m_byteOffset + length.toLongLong() : -1;
+        }
+
+        /* MPEG-TS-tallenteet tarkistetaan kirjoitettaessa. */
+        if (QFileInfo(m_filename).suffix().toLower() == "ts") {
+            delete m_validator;
+            m_validator = new TsValidator(m_byteOffset);
+
+            if (!m_validator->open(TsValidator::indexFilename(m_filename), m_byteOffset > 0)) {
+                qWarning() << m_validator->lastError();
+            }
         }
     }
 
     int len = m_reply->read(m_buf, 4096);
+    qint64 written = 0;
 
     while (len > 0) {
-        if (!m_file.write(m_buf, len) < 0) {
+        if (m_file.write(m_buf, len) < 0) {
             m_error = m_file.errorString();
             abort();
             break;
         }
 
+        if (m_validator != 0) {
+            m_validator->feed(m_buf, len);
+        }
+
+        written += len;
         len = m_reply->read(m_buf, 4096);
     }
+
+    /* Paikallinen palvelin lukee tiedostoa samaan aikaan, joten tavut kirjoitetaan levylle heti. */
+    if (written > 0 && m_file.flush()) {
+        m_bytesWritten += written;
+        m_retries = 0;
+        emit dataWritten();
+    }
 }
 
 void Downloader::replyFinished()
 {
-    m_file.close();
+    closeFile();
+
+    /* Valmiin tiedoston koon on vastattava palvelimen ilmoittamaa kokoa. */
+    if (m_error.isEmpty() && m_expectedSize >= 0) {
+        qint64 size = QFileInfo(m_filename).size();
+
+        if (size < m_expectedSize) {
+            qWarning() << "Incomplete file" << m_filename << size << "/" << m_expectedSize;
+            m_bytesWritten = size;
+
+            if (scheduleRetry(false)) {
+                return;
+            }
+
+            m_error = "IncompleteFile";
+            emit networkError();
+        }
+        else if (size > m_expectedSize) {
+            qWarning() << "Size mismatch" << m_filename << size << "/" << m_expectedSize;
+            m_error = "SizeMismatch";
+            emit networkError();
+        }
+    }
+
     m_finished = true;
 
     if (m_error.isEmpty()) {
@@ -169,11 +328,114 @@ void Downloader::replyNetworkError(QNetworkReply::NetworkError error)
         return;
     }
 
+    /* Vanhentunut osoite hylätään, joten se selvitetään ennen uutta yritystä. */
+    bool urlExpired = error == QNetworkReply::AuthenticationRequiredError ||
+                      error == QNetworkReply::ContentAccessDenied ||
+                      error == QNetworkReply::ContentOperationNotPermittedError ||
+                      error == QNetworkReply::ContentNotFoundError;
+
+    if (scheduleRetry(urlExpired)) {
+        return;
+    }
+
     m_error = networkErrorString(error);
     abort();
     emit networkError();
 }
 
+void Downloader::retryTimeout()
+{
+    if (m_resolving) {
+        m_resolving = false;
+        qWarning() << "Could not resolve stream URL for" << m_programmeId;
+
+        if (!scheduleRetry(true)) {
+            m_error = "StreamUrlExpired";
+            m_finished = true;
+            emit networkError();
+        }
+
+        return;
+    }
+
+    if (!m_urlExpired && m_urlAge.elapsed() < STREAM_URL_TTL) {
+        restart(m_url);
+        return;
+    }
+
+    QUrl url = m_client->cachedStreamUrl(m_programmeId, m_format);
+
+    if (url.isValid() && url != m_url) {
+        restart(url);
+        return;
+    }
+
+    qDebug() << "Resolving stream URL for" << m_programmeId;
+    m_client->invalidateStreamUrl(m_programmeId, m_format);
+    m_resolving = true;
+    m_client->resolveStreamUrl(m_programmeId, m_format);
+    m_retryTimer->start(RESOLVE_TIMEOUT);
+}
+
+void Downloader::streamUrlResolved(int programmeId, int format, const QUrl &url)
+{
+    if (!m_resolving || programmeId != m_programmeId || format != m_format) {
+        return;
+    }
+
+    m_resolving = false;
+    m_retryTimer->stop();
+    restart(url);
+}
+
+void Downloader::restart(const QUrl &url)
+{
+    if (url != m_url) {
+        m_url = url;
+        m_urlAge.start();
+        m_urlExpired = false;
+    }
+
+    /* Jatketaan viimeisestä levylle kirjoitetusta tavusta. */
+    m_byteOffset = m_bytesWritten;
+    qDebug() << "Retry" << m_retries << m_filename << "from" << m_byteOffset;
+    sendRequest();
+}
+
+bool Downloader::scheduleRetry(bool urlExpired)
+{
+    if (!m_error.isEmpty() || m_retries >= MAX_RETRIES || (urlExpired && m_programmeId < 0)) {
+        return false;
+    }
+
+    if (m_reply != 0) {
+        QNetworkReply *reply = m_reply;
+        m_reply = 0;
+        reply->disconnect(this);
+        reply->abort();
+        reply->deleteLater();
+    }
+
+    closeFile();
+    m_urlExpired = m_urlExpired || urlExpired;
+    int delay = qMin(MAX_RETRY_DELAY, RETRY_DELAY << m_retries);
+    delay = int(delay * (0.75 + 0.5 * qrand() / RAND_MAX));
+    m_retries++;
+    qDebug() << "Retry" << m_retries << "of" << m_filename << "in" << delay << "ms";
+    m_retryTimer->start(delay);
+    emit retrying();
+    return true;
+}
+
+void Downloader::closeFile()
+{
+    m_file.close();
+
+    if (m_validator != 0) {
+        m_validator->close();
+    }
+}
+
 QString Downloader::networkErrorString(QNetworkReply::NetworkError error)
 {
     switch (error) {
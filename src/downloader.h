@@ -1,11 +1,14 @@
 #ifndef DOWNLOADER_H
 #define DOWNLOADER_H
 
+#include <QElapsedTimer>
 #include <QFile>
 #include <QObject>
 #include <QNetworkReply>
 #include <QUrl>
 
+class QTimer;
+class TsValidator;
 class TvkaistaClient;
 
 class Downloader : public QObject
@@ -19,38 +22,63 @@ public:
     QString lastError() const;
     qint64 bytesReceived() const;
     qint64 bytesTotal() const;
+    qint64 bytesWritten() const;
+    int streamErrors() const;
     bool hasError() const;
     bool isFinished() const;
     void setFilename(const QString &filename);
     QString filename() const;
     void setFilenameFromReply(bool filenameFromReply);
     bool isFilenameFromReply() const;
-    void setByteOffset(int byteOffset);
-    int byteOffset() const;
+    void setByteOffset(qint64 byteOffset);
+    qint64 byteOffset() const;
+    void setStream(int programmeId, int format);
+    static bool syncFile(QFile &file);
+    int retryCount() const;
+    bool isRetrying() const;
 
 signals:
     void finished();
     void networkError();
+    void dataWritten();
+    void retrying();
 
 private slots:
     void replyReadyRead();
     void replyFinished();
     void replyDownloadProgress(qint64 bytesReceived, qint64 bytesTotal);
     void replyNetworkError(QNetworkReply::NetworkError error);
+    void retryTimeout();
+    void streamUrlResolved(int programmeId, int format, const QUrl &url);
 
 private:
     QString networkErrorString(QNetworkReply::NetworkError error);
     void appendSuffixToFilenameAndCreateDir();
+    void sendRequest();
+    void restart(const QUrl &url);
+    bool scheduleRetry(bool urlExpired);
+    void closeFile();
     TvkaistaClient *m_client;
     QNetworkReply *m_reply;
+    QTimer *m_retryTimer;
+    QElapsedTimer m_urlAge;
+    QUrl m_url;
+    int m_programmeId;
+    int m_format;
+    int m_retries;
+    bool m_urlExpired;
+    bool m_resolving;
+    qint64 m_expectedSize;
     char *m_buf;
     QFile m_file;
+    TsValidator *m_validator;
     QString m_error;
     QString m_filename;
     bool m_filenameFromReply;
     qint64 m_byteOffset;
     qint64 m_bytesReceived;
     qint64 m_bytesTotal;
+    qint64 m_bytesWritten;
     bool m_finished;
 };
 
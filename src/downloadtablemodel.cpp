@@ -1,21 +1,97 @@
 #include <QDebug>
+#include <QFile>
 #include <QFileInfo>
 #include <QLocale>
+#include <QRunnable>
+#include <QSaveFile>
 #include <QSettings>
 #include <QTimer>
 #include <QXmlStreamReader>
 #include <QXmlStreamWriter>
+#include "appsettings.h"
 #include "mainwindow.h"
 #include "downloader.h"
+#include "filemonitor.h"
 #include "tvkaistaclient.h"
 #include "downloadtablemodel.h"
 
-DownloadTableModel::DownloadTableModel(QSettings *settings, QObject *parent) :
+/* Edistymisen päivitysväli, kun lataus etenee, kun mikään lataus ei ole edennyt
+   muutamaan kierrokseen ja kun latauslista ei ole näkyvissä. */
+static const int ACTIVE_INTERVAL = 1000;
+static const int IDLE_INTERVAL = 3000;
+static const int HIDDEN_INTERVAL = 10000;
+
+/* Latauslistan tallennusväli latausten ollessa käynnissä. Välissä kirjoitetut
+   tavumäärät kirjataan lokiin. */
+static const int CHECKPOINT_INTERVAL = 30000;
+
+/* Tavumäärien kirjausväli. Tiedosto synkronoidaan levylle ennen kirjausta. */
+static const int LOG_INTERVAL = 5000;
+
+/* Synkronoi videotiedoston levylle ja kirjaa tavumäärän sen jälkeen lokiin.
+   fsync voi kestää suuren tiedoston kanssa satoja millisekunteja, joten se tehdään
+   taustasäikeessä. */
+class DownloadSyncTask : public QRunnable
+{
+public:
+    DownloadSyncTask(DownloadTableModel *model, int programmeId, const QString &filename, qint64 bytes,
+                     const QString &logFilename) :
+        m_model(model), m_programmeId(programmeId), m_filename(filename), m_bytes(bytes),
+        m_logFilename(logFilename)
+    {
+    }
+
+    void run()
+    {
+        QFile file(m_filename);
+        bool ok = file.open(QIODevice::WriteOnly | QIODevice::Append) && Downloader::syncFile(file);
+        file.close();
+
+        if (!ok) {
+            qWarning() << "Could not sync" << m_filename << file.errorString();
+        }
+        else if (!m_logFilename.isEmpty()) {
+            QFile logFile(m_logFilename);
+            QByteArray line = QByteArray::number(m_programmeId);
+            line.append('\t');
+            line.append(QByteArray::number(m_bytes));
+            line.append('\t');
+            line.append(m_filename.toUtf8());
+            line.append('\n');
+
+            if (!logFile.open(QIODevice::WriteOnly | QIODevice::Append) || logFile.write(line) != line.size() ||
+                    !logFile.flush() || !Downloader::syncFile(logFile)) {
+                qWarning() << "Could not write" << m_logFilename << logFile.errorString();
+            }
+        }
+
+        QMetaObject::invokeMethod(m_model, "downloadSynced", Qt::QueuedConnection,
+                                  Q_ARG(int, m_programmeId), Q_ARG(QString, m_filename),
+                                  Q_ARG(qint64, m_bytes), Q_ARG(bool, ok));
+    }
+
+private:
+    DownloadTableModel *m_model;
+    int m_programmeId;
+    QString m_filename;
+    qint64 m_bytes;
+    QString m_logFilename;
+};
+
+DownloadTableModel::DownloadTableModel(AppSettings *settings, QObject *parent) :
     QAbstractTableModel(parent), m_settings(settings), m_timer(new QTimer(this)),
-    m_fileSystemWatcher(new QFileSystemWatcher(this))
+    m_checkpointTimer(new QTimer(this)), m_progressVisible(true), m_idleTicks(0),
+    m_fileMonitor(new FileMonitor(this)), m_rowIndexValid(false), m_loaded(false)
 {
+    m_syncPool.setMaxThreadCount(1);
     connect(m_timer, SIGNAL(timeout()), SLOT(updateDownloadProgress()));
-    connect(m_fileSystemWatcher, SIGNAL(fileChanged(QString)), SLOT(fileChanged(QString)));
+    connect(m_checkpointTimer, SIGNAL(timeout()), SLOT(saveCheckpoint()));
+    connect(m_fileMonitor, SIGNAL(fileRemoved(QString)), SLOT(fileRemoved(QString)));
+}
+
+DownloadTableModel::~DownloadTableModel()
+{
+    m_syncPool.waitForDone();
 }
 
 int DownloadTableModel::rowCount(const QModelIndex &parent) const
@@ -38,7 +114,7 @@ QVariant DownloadTableModel::data(const QModelIndex &index, int role) const
         return QVariant();
     }
 
-    FileDownload download = m_downloads.value(row);
+    const FileDownload &download = m_downloads.at(row);
 
     switch (role) {
     case Qt::DisplayRole:
@@ -51,6 +127,11 @@ QVariant DownloadTableModel::data(const QModelIndex &index, int role) const
         return descriptionString(download);
 
     case Qt::UserRole + 3:
+        /* Edistymisteksti muodostetaan vasta, kun rivi piirretään. */
+        if (download.status == 0 && download.bytesReceived > 0) {
+            return progressString(download);
+        }
+
         return download.description;
 
     case Qt::UserRole + 4:
@@ -60,7 +141,7 @@ QVariant DownloadTableModel::data(const QModelIndex &index, int role) const
         return download.format;
 
     case Qt::UserRole + 6:
-        return download.progress;
+        return download.bytesTotal > 0 ? download.bytesReceived / (double)download.bytesTotal : 0.0;
     }
 
     return QVariant();
@@ -78,6 +159,38 @@ QString DownloadTableModel::descriptionString(const FileDownload &download) cons
     return s;
 }
 
+QString DownloadTableModel::progressString(const FileDownload &download) const
+{
+    QString s;
+
+    if (download.bytesTotal <= 0) {
+        s = formatBytes(download.bytesReceived);
+    }
+    else {
+        s = trUtf8("%1 / %2 (%3 %)").arg(formatBytes(download.bytesReceived), formatBytes(download.bytesTotal)).arg(
+                qRound(download.bytesReceived * 100.0 / download.bytesTotal));
+    }
+
+    if (download.streamErrors > 0) {
+        s.append(trUtf8(", %1 virhettä").arg(download.streamErrors));
+    }
+
+    if (download.downloader != 0 && download.downloader->isRetrying()) {
+        s.append(trUtf8(", yhteys katkesi, yritys %1").arg(download.downloader->retryCount()));
+    }
+
+    return s;
+}
+
+QString DownloadTableModel::finishedString(int streamErrors)
+{
+    if (streamErrors > 0) {
+        return trUtf8("Valmis, %1 virhettä").arg(streamErrors);
+    }
+
+    return trUtf8("Valmis");
+}
+
 QVariant DownloadTableModel::headerData(int section, Qt::Orientation orientation, int role) const
 {
     Q_UNUSED(section);
@@ -104,16 +217,14 @@ TvkaistaClient* DownloadTableModel::client() const
 
 int DownloadTableModel::download(const Programme &programme, int format, const QString &channelName, const QUrl &url)
 {
-    int index = tryResumeDownload(programme.id, url);
+    int index = tryResumeDownload(programme.id, format, url);
 
     if (index >= 0) {
         return index;
     }
 
-    m_settings->beginGroup("downloads");
-    QString dirPath = m_settings->value("directory").toString();
-    QString filenameFormat = m_settings->value("filenameFormat").toString();
-    m_settings->endGroup();
+    QString dirPath = m_settings->downloadDirectory();
+    QString filenameFormat = m_settings->filenameFormat();
     bool filenameFromReply = false;
 
     if (dirPath.isEmpty()) {
@@ -138,38 +249,44 @@ int DownloadTableModel::download(const Programme &programme, int format, const Q
     filenameFormat.replace("%a", toAscii(programme.title));
     filenameFormat.replace("%C", removeInvalidCharacters(channelName));
     filenameFormat.replace("%c", toAscii(channelName));
-    filenameFormat.replace("%d", programme.startDateTime.toString("dd"));
-    filenameFormat.replace("%m", programme.startDateTime.toString("MM"));
-    filenameFormat.replace("%Y", programme.startDateTime.toString("yyyy"));
-    filenameFormat.replace("%H", programme.startDateTime.toString("hh"));
-    filenameFormat.replace("%M", programme.startDateTime.toString("mm"));
-    filenameFormat.replace("%S", programme.startDateTime.toString("ss"));
+    filenameFormat.replace("%d", programme.startDateTime().toString("dd"));
+    filenameFormat.replace("%m", programme.startDateTime().toString("MM"));
+    filenameFormat.replace("%Y", programme.startDateTime().toString("yyyy"));
+    filenameFormat.replace("%H", programme.startDateTime().toString("hh"));
+    filenameFormat.replace("%M", programme.startDateTime().toString("mm"));
+    filenameFormat.replace("%S", programme.startDateTime().toString("ss"));
     filenameFormat.replace("%e", extension);
 
     Downloader *downloader = new Downloader(m_client, this);
     downloader->setFilename(QFileInfo(QString("%1/%2").arg(dirPath, filenameFormat)).absoluteFilePath());
     downloader->setFilenameFromReply(filenameFromReply);
+    downloader->setStream(programme.id, format);
     downloader->start(url);
     connect(downloader, SIGNAL(finished()), SLOT(downloaderFinished()));
     connect(downloader, SIGNAL(networkError()), SLOT(networkError()));
+    connect(downloader, SIGNAL(retrying()), SLOT(downloaderRetrying()));
 
     FileDownload download;
     index = m_downloads.size();
     beginInsertRows(QModelIndex(), index, index);
     download.title = programme.title;
-    download.dateTime = programme.startDateTime;
+    download.dateTime = programme.startDateTime();
     download.programmeId = programme.id;
     download.status = 0;
     download.description = trUtf8("Ladataan");
     download.format = MainWindow::videoFormats().value(format);
     download.channelName = channelName;
+    download.bytesReceived = 0;
+    download.bytesTotal = 0;
+    download.bytesCommitted = 0;
+    download.streamErrors = 0;
     download.downloader = downloader;
     m_downloads.append(download);
     endInsertRows();
+    startProgressTimer();
 
-    if (!m_timer->isActive()) {
-        m_timer->start(1000);
-    }
+    /* Lokiin kirjataan vain tavumäärät, joten uusi lataus tallennetaan listaan heti. */
+    save();
 
     return index;
 }
@@ -183,6 +300,7 @@ void DownloadTableModel::abortDownload(int row)
     }
 
     download.filename = download.downloader->filename();
+    syncDownload(download, download.downloader->bytesWritten());
     download.downloader->abort();
     download.downloader->deleteLater();
     download.downloader = 0;
@@ -222,6 +340,11 @@ void DownloadTableModel::removeDownload(int index)
     beginRemoveRows(QModelIndex(), index, index);
     FileDownload download = m_downloads.takeAt(index);
     endRemoveRows();
+    m_rowIndexValid = false;
+
+    if (download.status == 1) {
+        m_fileMonitor->removeFile(download.filename);
+    }
 
     if (download.downloader != 0) {
         download.downloader->abort();
@@ -262,11 +385,66 @@ int DownloadTableModel::programmeId(int index) const
     return m_downloads.at(index).programmeId;
 }
 
-bool DownloadTableModel::load()
+int DownloadTableModel::findDownload(int programmeId) const
+{
+    int count = m_downloads.size();
+
+    for (int i = 0; i < count; i++) {
+        if (m_downloads.at(i).programmeId == programmeId) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+Downloader* DownloadTableModel::downloader(int index) const
+{
+    return m_downloads.at(index).downloader;
+}
+
+QString DownloadTableModel::filename() const
+{
+    return QString("%1/downloads.xml").arg(QFileInfo(m_settings->settings()->fileName()).path());
+}
+
+bool DownloadTableModel::read(const QString &filename, QList<FileDownload> &downloads)
+{
+    /* Loki luetaan, vaikka listaa ei olisi: sen kirjauksista syntyy ainakin jatkettavat
+       lataukset. */
+    bool listOk = readList(filename, downloads);
+    bool logOk = replayLog(logFilename(filename), downloads);
+
+    if (!listOk && !logOk) {
+        return false;
+    }
+
+    int count = downloads.size();
+
+    /* Kesken jääneet lataukset voi jatkaa viimeisestä varmistetusta kohdasta. Levyllä
+       olevaa pidempää kohtaa ei hyväksytä. */
+    for (int i = 0; i < count; i++) {
+        FileDownload &download = downloads[i];
+
+        if (download.status != 0) {
+            continue;
+        }
+
+        qint64 size = download.filename.isEmpty() ? 0 : QFileInfo(download.filename).size();
+
+        if (download.bytesCommitted < 0 || download.bytesCommitted > size) {
+            download.bytesCommitted = size;
+        }
+
+        download.status = 2;
+        download.description = trUtf8("Keskeytetty");
+    }
+
+    return true;
+}
+
+bool DownloadTableModel::readList(const QString &filename, QList<FileDownload> &downloads)
 {
-    m_downloads.clear();
-    QString dirPath = QFileInfo(m_settings->fileName()).path();
-    QString filename = QString("%1/downloads.xml").arg(dirPath);
     QFile file(filename);
 
     if (!file.open(QIODevice::ReadOnly)) {
@@ -288,6 +466,13 @@ bool DownloadTableModel::load()
         QXmlStreamAttributes attrs = reader.attributes();
         FileDownload download;
         download.downloader = 0;
+        download.bytesReceived = 0;
+        download.bytesTotal = 0;
+        download.streamErrors = attrs.value("streamErrors").toString().toInt();
+
+        bool committedOk;
+        qint64 committed = attrs.value("bytesWritten").toString().toLongLong(&committedOk);
+        download.bytesCommitted = committedOk ? committed : -1;
         download.status = attrs.value("status").toString().toInt();
         download.dateTime = QDateTime::fromString(attrs.value("dateTime").toString(), "yyyy-MM-dd'T'hh:mm:ss");
         download.channelName = attrs.value("channel").toString();
@@ -306,13 +491,9 @@ bool DownloadTableModel::load()
             }
         }
 
-        if (download.status == 1 && !download.filename.isEmpty()) {
-            if (QFile(download.filename).exists()) {
-                m_fileSystemWatcher->addPath(download.filename);
-            }
-            else {
-                download.status = 4;
-            }
+        if (download.status == 1 && !download.filename.isEmpty() &&
+                !QFile(download.filename).exists()) {
+            download.status = 4;
         }
 
         if (download.status == 4) {
@@ -325,25 +506,132 @@ bool DownloadTableModel::load()
             download.description = trUtf8("Keskeytetty");
         }
         else if (download.status == 1) {
-            download.description = trUtf8("Valmis");
+            download.description = finishedString(download.streamErrors);
         }
 
-        int index = m_downloads.size();
-        beginInsertRows(QModelIndex(), index, index);
-        m_downloads.append(download);
-        endInsertRows();
+        downloads.append(download);
     }
 
     file.close();
     return true;
 }
 
-bool DownloadTableModel::save()
+QString DownloadTableModel::logFilename(const QString &filename)
+{
+    QFileInfo info(filename);
+    return QString("%1/%2.wal").arg(info.path(), info.completeBaseName());
+}
+
+bool DownloadTableModel::replayLog(const QString &filename, QList<FileDownload> &downloads)
 {
-    QString dirPath = QFileInfo(m_settings->fileName()).path();
-    QString filename = QString("%1/downloads.xml").arg(dirPath);
     QFile file(filename);
 
+    if (!file.open(QIODevice::ReadOnly)) {
+        return false;
+    }
+
+    QList<QByteArray> lines = file.readAll().split('\n');
+    file.close();
+
+    /* Viimeinen rivi on joko tyhjä tai kesken jäänyt kirjaus. */
+    lines.removeLast();
+    int lineCount = lines.size();
+    bool replayed = false;
+
+    for (int i = 0; i < lineCount; i++) {
+        QList<QByteArray> fields = lines.at(i).split('\t');
+
+        if (fields.size() != 3) {
+            continue;
+        }
+
+        bool idOk;
+        bool bytesOk;
+        int programmeId = fields.at(0).toInt(&idOk);
+        qint64 bytes = fields.at(1).toLongLong(&bytesOk);
+
+        if (!idOk || !bytesOk) {
+            continue;
+        }
+
+        QString downloadFilename = QString::fromUtf8(fields.at(2));
+        int count = downloads.size();
+        int j = 0;
+
+        while (j < count && downloads.at(j).programmeId != programmeId) {
+            j++;
+        }
+
+        /* Listasta puuttuva lataus palautetaan pelkän lokin tiedoilla. */
+        if (j == count) {
+            FileDownload download;
+            download.title = QFileInfo(downloadFilename).completeBaseName();
+            download.programmeId = programmeId;
+            download.status = 0;
+            download.bytesReceived = 0;
+            download.bytesTotal = 0;
+            download.streamErrors = 0;
+            download.downloader = 0;
+            downloads.append(download);
+        }
+
+        FileDownload &download = downloads[j];
+
+        if (download.status == 0) {
+            download.bytesCommitted = bytes;
+            download.filename = downloadFilename;
+            replayed = true;
+        }
+    }
+
+    return replayed;
+}
+
+void DownloadTableModel::setDownloads(const QList<FileDownload> &downloads)
+{
+    QStringList paths;
+    int count = downloads.size();
+
+    for (int i = 0; i < count; i++) {
+        if (downloads.at(i).status == 1 && !downloads.at(i).filename.isEmpty()) {
+            paths.append(downloads.at(i).filename);
+        }
+    }
+
+    /* Latauksen aikana aloitetut lataukset jäävät listan loppuun. */
+    beginResetModel();
+    m_downloads = downloads + m_downloads;
+    endResetModel();
+    m_rowIndexValid = false;
+    m_loaded = true;
+
+    if (!paths.isEmpty()) {
+        m_fileMonitor->addFiles(paths);
+    }
+}
+
+bool DownloadTableModel::load()
+{
+    QList<FileDownload> downloads;
+
+    if (!read(filename(), downloads)) {
+        return false;
+    }
+
+    m_downloads.clear();
+    setDownloads(downloads);
+    return true;
+}
+
+bool DownloadTableModel::save()
+{
+    /* Listaa ei tallenneta ennen kuin se on luettu, muuten vanhat lataukset katoaisivat. */
+    if (!m_loaded) {
+        return false;
+    }
+
+    QSaveFile file(filename());
+
     if (!file.open(QIODevice::WriteOnly)) {
         return false;
     }
@@ -356,12 +644,27 @@ bool DownloadTableModel::save()
 
     for (int i = 0; i < count; i++) {
         FileDownload download = m_downloads.at(i);
+
+        /* Listaan kirjataan vain levylle synkronoitu tavumäärä. */
+        if (download.downloader != 0) {
+            download.filename = download.downloader->filename();
+        }
+
         writer.writeStartElement("programme");
         writer.writeAttribute("status", QString::number(download.status));
         writer.writeAttribute("dateTime", download.dateTime.toString("yyyy-MM-dd'T'hh:mm:ss"));
         writer.writeAttribute("channel", download.channelName);
         writer.writeAttribute("format", download.format);
         writer.writeAttribute("programmeId", QString::number(download.programmeId));
+
+        if (download.streamErrors > 0) {
+            writer.writeAttribute("streamErrors", QString::number(download.streamErrors));
+        }
+
+        if (download.bytesCommitted >= 0 && download.status != 1 && download.status != 4) {
+            writer.writeAttribute("bytesWritten", QString::number(download.bytesCommitted));
+        }
+
         writer.writeTextElement("title", download.title);
         writer.writeTextElement("filename", download.filename);
         writer.writeEndElement(); // programme
@@ -369,49 +672,111 @@ bool DownloadTableModel::save()
 
     writer.writeEndElement(); // downloads
     writer.writeEndDocument();
-    file.close();
+
+    if (!file.commit()) {
+        return false;
+    }
+
+    /* Lista sisältää nyt lokin tiedot. */
+    truncateLog();
     return true;
 }
 
 void DownloadTableModel::updateDownloadProgress()
 {
     int count = m_downloads.size();
+    int firstRow = -1;
+    int lastRow = -1;
+    bool logDue = !m_logElapsed.isValid() || m_logElapsed.elapsed() >= LOG_INTERVAL;
+
+    if (logDue) {
+        m_logElapsed.start();
+    }
 
     for (int i = 0; i < count; i++) {
-        FileDownload download = m_downloads.at(i);
+        FileDownload &download = m_downloads[i];
 
         if (download.downloader == 0) {
             continue;
         }
 
-        Downloader *downloader = download.downloader;
-        qint64 received = downloader->bytesReceived();
-        qint64 total = downloader->bytesTotal();
+        qint64 received = download.downloader->bytesReceived();
+        qint64 total = download.downloader->bytesTotal();
+        int errors = download.downloader->streamErrors();
+        /* Kirjattu kohta on aina levylle synkronoitu, joten sähkökatkon jälkeen sen
+           takana ei ole nollia. */
+        if (logDue && download.downloader->bytesWritten() != download.bytesCommitted) {
+            syncDownload(download, download.downloader->bytesWritten());
+        }
 
-        if (received <= 0) {
+        if (received == download.bytesReceived && total == download.bytesTotal &&
+                errors == download.streamErrors) {
             continue;
         }
 
-        if (total <= 0) {
-            download.description = formatBytes(received);
-            download.progress = 0.0;
-        }
-        else {
-            download.progress = received / (double)total;
-            download.description = trUtf8("%1 / %2 (%3 %)").arg(formatBytes(received), formatBytes(total)).arg(
-                                                                 qRound(download.progress * 100));
+        download.bytesReceived = received;
+        download.bytesTotal = total;
+        download.streamErrors = errors;
+
+        if (firstRow < 0) {
+            firstRow = i;
         }
 
-        m_downloads.replace(i, download);
-        QModelIndex modelIndex = index(i, 0, QModelIndex());
-        emit dataChanged(modelIndex, modelIndex);
+        lastRow = i;
+    }
+
+    if (firstRow < 0) {
+        m_idleTicks++;
+    }
+    else {
+        m_idleTicks = 0;
+    }
+
+    int interval = progressInterval();
+
+    if (m_timer->interval() != interval) {
+        m_timer->setInterval(interval);
+    }
+
+    if (firstRow >= 0 && m_progressVisible) {
+        emit dataChanged(index(firstRow, 0, QModelIndex()), index(lastRow, 0, QModelIndex()));
     }
 }
 
+void DownloadTableModel::setProgressVisible(bool visible)
+{
+    if (m_progressVisible == visible) {
+        return;
+    }
+
+    m_progressVisible = visible;
+
+    if (!m_timer->isActive()) {
+        return;
+    }
+
+    /* Piilossa kerätyt muutokset näytetään heti, kun lista tulee näkyviin. */
+    if (visible) {
+        m_idleTicks = 0;
+
+        if (!m_downloads.isEmpty()) {
+            emit dataChanged(index(0, 0, QModelIndex()), index(m_downloads.size() - 1, 0, QModelIndex()));
+        }
+    }
+
+    m_timer->setInterval(progressInterval());
+}
+
+bool DownloadTableModel::isProgressVisible() const
+{
+    return m_progressVisible;
+}
+
 void DownloadTableModel::downloaderFinished()
 {
     int count = m_downloads.size();
     int running = 0;
+    bool changed = false;
 
     for (int i = 0; i < count; i++) {
         FileDownload download = m_downloads.at(i);
@@ -419,15 +784,19 @@ void DownloadTableModel::downloaderFinished()
         if (download.downloader != 0) {
             if (download.downloader->isFinished()) {
                 download.filename = download.downloader->filename();
+                download.streamErrors = download.downloader->streamErrors();
+                download.bytesCommitted = download.downloader->bytesWritten();
                 download.downloader->deleteLater();
                 download.downloader = 0;
                 download.status = 1;
-                download.description = trUtf8("Valmis");
+                download.description = finishedString(download.streamErrors);
                 m_downloads.replace(i, download);
-                m_fileSystemWatcher->addPath(download.filename);
+                m_fileMonitor->addFile(download.filename);
+                m_rowIndexValid = false;
                 QModelIndex modelIndex = index(i, 0, QModelIndex());
                 emit dataChanged(modelIndex, modelIndex);
                 emit downloadStatusChanged(i);
+                changed = true;
             }
             else {
                 running++;
@@ -437,6 +806,24 @@ void DownloadTableModel::downloaderFinished()
 
     if (running == 0) {
         m_timer->stop();
+        m_checkpointTimer->stop();
+    }
+
+    if (changed) {
+        save();
+    }
+}
+
+void DownloadTableModel::downloaderRetrying()
+{
+    int count = m_downloads.size();
+
+    for (int i = 0; i < count; i++) {
+        if (m_downloads.at(i).downloader == sender()) {
+            QModelIndex modelIndex = index(i, 0, QModelIndex());
+            emit dataChanged(modelIndex, modelIndex);
+            break;
+        }
     }
 }
 
@@ -449,6 +836,8 @@ void DownloadTableModel::networkError()
 
         if (download.downloader != 0 && download.downloader->hasError()) {
             download.description = download.downloader->lastError();
+            download.filename = download.downloader->filename();
+            syncDownload(download, download.downloader->bytesWritten());
             download.downloader->deleteLater();
             download.downloader = 0;
             download.status = 3;
@@ -460,25 +849,60 @@ void DownloadTableModel::networkError()
     }
 }
 
-void DownloadTableModel::fileChanged(const QString &path)
+void DownloadTableModel::fileRemoved(const QString &path)
 {
-    int count = m_downloads.size();
+    int row = rowForFilename(path);
 
-    for (int i = 0; i < count; i++) {
-        FileDownload download = m_downloads.at(i);
+    if (row < 0 || m_downloads.at(row).status != 1) {
+        return;
+    }
 
-        if (download.status == 1 && download.filename == path &&
-                !QFile(download.filename).exists()) {
-            download.status = 4;
-            m_downloads.replace(i, download);
-            QModelIndex modelIndex = index(i, 0, QModelIndex());
-            emit dataChanged(modelIndex, modelIndex);
-            emit downloadStatusChanged(i);
-        }
+    m_downloads[row].status = 4;
+    m_downloads[row].description = trUtf8("Poistettu");
+    QModelIndex modelIndex = index(row, 0, QModelIndex());
+    emit dataChanged(modelIndex, modelIndex);
+    emit downloadStatusChanged(row);
+}
+
+void DownloadTableModel::downloadSynced(int programmeId, const QString &filename, qint64 bytes, bool ok)
+{
+    m_syncing.remove(programmeId);
+    int row = findDownload(programmeId);
+
+    if (!ok || row < 0) {
+        return;
+    }
+
+    FileDownload &download = m_downloads[row];
+    QString currentFilename = download.downloader != 0 ? download.downloader->filename() : download.filename;
+
+    if (currentFilename != filename) {
+        return;
+    }
+
+    /* Palvelin on voinut ohittaa Range-otsakkeen, jolloin tiedosto kirjoitetaan alusta. */
+    if (download.downloader != 0 && bytes > download.downloader->bytesWritten()) {
+        return;
+    }
+
+    download.bytesCommitted = bytes;
+
+    /* Pysäytetyn latauksen lopullinen tavumäärä tallennetaan heti. */
+    if (download.downloader == 0 && download.status != 1) {
+        save();
     }
 }
 
-int DownloadTableModel::tryResumeDownload(int programmeId, const QUrl &url)
+void DownloadTableModel::saveCheckpoint()
+{
+    save();
+
+    if (!hasUnfinishedDownloads()) {
+        m_checkpointTimer->stop();
+    }
+}
+
+int DownloadTableModel::tryResumeDownload(int programmeId, int format, const QUrl &url)
 {
     int count = m_downloads.size();
 
@@ -486,24 +910,35 @@ int DownloadTableModel::tryResumeDownload(int programmeId, const QUrl &url)
         FileDownload download = m_downloads.at(i);
 
         if (download.programmeId == programmeId) {
-            m_fileSystemWatcher->removePath(download.filename);
+            m_fileMonitor->removeFile(download.filename);
             Downloader *downloader = new Downloader(m_client, this);
             downloader->setFilename(download.filename);
             downloader->setFilenameFromReply(false);
-            downloader->setByteOffset(QFileInfo(download.filename).size());
+            qint64 size = QFileInfo(download.filename).size();
+
+            /* Kirjaamaton loppuosa voi olla roskaa, joten se ladataan uudelleen. */
+            if (download.bytesCommitted >= 0 && download.bytesCommitted < size) {
+                size = download.bytesCommitted;
+            }
+
+            downloader->setByteOffset(size);
+            downloader->setStream(programmeId, format);
             downloader->start(url);
             connect(downloader, SIGNAL(finished()), SLOT(downloaderFinished()));
             connect(downloader, SIGNAL(networkError()), SLOT(networkError()));
+            connect(downloader, SIGNAL(retrying()), SLOT(downloaderRetrying()));
             download.downloader = downloader;
             download.status = 0;
             download.description = trUtf8("Ladataan");
+            download.bytesReceived = 0;
+            download.bytesTotal = 0;
+            download.bytesCommitted = size;
+            download.streamErrors = 0;
             m_downloads.replace(i, download);
             QModelIndex modelIndex = index(i, 0, QModelIndex());
             emit dataChanged(modelIndex, modelIndex);
-
-            if (!m_timer->isActive()) {
-                m_timer->start(1000);
-            }
+            startProgressTimer();
+            save();
 
             return i;
         }
@@ -512,6 +947,32 @@ int DownloadTableModel::tryResumeDownload(int programmeId, const QUrl &url)
     return -1;
 }
 
+void DownloadTableModel::syncDownload(const FileDownload &download, qint64 bytes)
+{
+    if (download.downloader == 0 || download.downloader->filename().isEmpty()) {
+        return;
+    }
+
+    /* Edellinen synkronointi on vielä kesken, joten tämä jää seuraavaan kierrokseen. */
+    if (m_syncing.contains(download.programmeId)) {
+        return;
+    }
+
+    /* Ennen listan lukemista lokia ei kirjoiteta, koska siinä voi olla edellisen
+       käynnistyskerran kirjauksia. */
+    QString logFile = m_loaded ? logFilename(filename()) : QString();
+    m_syncing.insert(download.programmeId);
+    m_syncPool.start(new DownloadSyncTask(this, download.programmeId, download.downloader->filename(),
+                                          bytes, logFile));
+}
+
+void DownloadTableModel::truncateLog()
+{
+    /* Taustasäikeen samaan aikaan kirjoittama rivi voi kadota, mutta listassa on silloin
+       vain pienempi, yhä levyllä oleva tavumäärä. */
+    QFile::remove(logFilename(filename()));
+}
+
 QString DownloadTableModel::formatBytes(qint64 bytes) const
 {
     if (bytes < 1024) {
@@ -572,3 +1033,46 @@ QString DownloadTableModel::removeInvalidCharacters(const QString &s)
 
     return r;
 }
+
+int DownloadTableModel::rowForFilename(const QString &path)
+{
+    if (!m_rowIndexValid) {
+        m_rowsByFilename.clear();
+        int count = m_downloads.size();
+
+        for (int i = 0; i < count; i++) {
+            if (m_downloads.at(i).status == 1 && !m_downloads.at(i).filename.isEmpty()) {
+                m_rowsByFilename.insert(QFileInfo(m_downloads.at(i).filename).absoluteFilePath(), i);
+            }
+        }
+
+        m_rowIndexValid = true;
+    }
+
+    return m_rowsByFilename.value(path, -1);
+}
+
+void DownloadTableModel::startProgressTimer()
+{
+    if (!m_timer->isActive()) {
+        m_idleTicks = 0;
+        m_timer->start(progressInterval());
+    }
+
+    if (!m_checkpointTimer->isActive()) {
+        m_checkpointTimer->start(CHECKPOINT_INTERVAL);
+    }
+}
+
+int DownloadTableModel::progressInterval() const
+{
+    if (!m_progressVisible) {
+        return HIDDEN_INTERVAL;
+    }
+
+    if (m_idleTicks >= 3) {
+        return IDLE_INTERVAL;
+    }
+
+    return ACTIVE_INTERVAL;
+}
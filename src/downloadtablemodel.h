@@ -2,14 +2,18 @@
 #define DOWNLOADTABLEMODEL_H
 
 #include <QAbstractTableModel>
-#include <QFileSystemWatcher>
+#include <QHash>
 #include <QDateTime>
+#include <QElapsedTimer>
+#include <QSet>
+#include <QThreadPool>
 #include <QUrl>
 #include "programme.h"
 
+class AppSettings;
 class Downloader;
+class FileMonitor;
 class TvkaistaClient;
-class QSettings;
 class QTimer;
 
 struct FileDownload
@@ -30,7 +34,12 @@ struct FileDownload
       * 4 = videotiedosto poistettu
      */
     int status;
-    double progress;
+    qint64 bytesReceived;
+    qint64 bytesTotal;
+
+    /* Tiedostoon varmasti kirjoitettu tavumäärä, -1 jos ei tiedossa. */
+    qint64 bytesCommitted;
+    int streamErrors;
     Downloader *downloader;
 };
 
@@ -38,11 +47,14 @@ class DownloadTableModel : public QAbstractTableModel
 {
     Q_OBJECT
 public:
-    DownloadTableModel(QSettings *settings, QObject *parent = 0);
+    DownloadTableModel(AppSettings *settings, QObject *parent = 0);
+    ~DownloadTableModel();
     int rowCount(const QModelIndex &parent) const;
     int columnCount(const QModelIndex &parent) const;
     QVariant data(const QModelIndex &index, int role) const;
     QString descriptionString(const FileDownload &download) const;
+    QString progressString(const FileDownload &download) const;
+    static QString finishedString(int streamErrors);
     QVariant headerData(int section, Qt::Orientation orientation, int role) const;
     Qt::ItemFlags flags(const QModelIndex &index) const;
     void setClient(TvkaistaClient *client);
@@ -57,8 +69,16 @@ public:
     int status(int index) const;
     int videoFormat(int index) const;
     int programmeId(int index) const;
+    int findDownload(int programmeId) const;
+    Downloader* downloader(int index) const;
+    QString filename() const;
+    static bool read(const QString &filename, QList<FileDownload> &downloads);
+    static QString logFilename(const QString &filename);
+    void setDownloads(const QList<FileDownload> &downloads);
     bool load();
     bool save();
+    void setProgressVisible(bool visible);
+    bool isProgressVisible() const;
 
 signals:
     void downloadStatusChanged(int index);
@@ -66,19 +86,38 @@ signals:
 private slots:
     void updateDownloadProgress();
     void downloaderFinished();
+    void downloaderRetrying();
     void networkError();
-    void fileChanged(const QString &path);
+    void fileRemoved(const QString &path);
+    void saveCheckpoint();
+    void downloadSynced(int programmeId, const QString &filename, qint64 bytes, bool ok);
 
 private:
-    int tryResumeDownload(int programmeId, const QUrl &url);
+    int tryResumeDownload(int programmeId, int format, const QUrl &url);
+    static bool readList(const QString &filename, QList<FileDownload> &downloads);
+    static bool replayLog(const QString &filename, QList<FileDownload> &downloads);
+    void syncDownload(const FileDownload &download, qint64 bytes);
+    void truncateLog();
     QString formatBytes(qint64 bytes) const;
     QString toAscii(const QString &s);
     QString removeInvalidCharacters(const QString &s);
-    QSettings *m_settings;
+    int rowForFilename(const QString &path);
+    void startProgressTimer();
+    int progressInterval() const;
+    AppSettings *m_settings;
     TvkaistaClient *m_client;
     QList<FileDownload> m_downloads;
     QTimer *m_timer;
-    QFileSystemWatcher *m_fileSystemWatcher;
+    QTimer *m_checkpointTimer;
+    QThreadPool m_syncPool;
+    QSet<int> m_syncing;
+    QElapsedTimer m_logElapsed;
+    bool m_progressVisible;
+    int m_idleTicks;
+    FileMonitor *m_fileMonitor;
+    QHash<QString, int> m_rowsByFilename;
+    bool m_rowIndexValid;
+    bool m_loaded;
 };
 
 #endif // DOWNLOADTABLEMODEL_H
@@ -0,0 +1,616 @@
+#include <QDateTime>
+#include <QKeyEvent>
+#include <QMouseEvent>
+#include <QPainter>
+#include <QRunnable>
+#include <QScrollBar>
+#include <QTimer>
+#include <algorithm>
+#include "cache.h"
+#include "epggridwidget.h"
+#include "tvkaistaclient.h"
+
+/* Ruudukon mitat pikseleinä. Yksi pikseli vastaa 15 sekuntia eli tunti 240 pikseliä. */
+static const int ROW_HEIGHT = 40;
+static const int HEADER_HEIGHT = 22;
+static const int CHANNEL_WIDTH = 120;
+static const int MSECS_PER_PIXEL = 15000;
+static const int DAY_WIDTH = 24 * 60 * 60 * 1000 / MSECS_PER_PIXEL;
+
+/* Kesto, jos sitä ei tiedetä eikä kanavalla ole seuraavaa ohjelmaa. */
+static const qint64 DEFAULT_LENGTH = 60 * 60 * 1000;
+
+/* Puuttuvat kanavat haetaan palvelimelta yksi kerrallaan silloin, kun asiakas on
+   vapaana. Vastaamaton haku yritetään vielä kerran aikakatkaisun jälkeen. */
+static const int FETCH_INTERVAL = 1000;
+static const int FETCH_TIMEOUT = 20000;
+
+static bool cellLessThan(const EpgGridCell &a, const EpgGridCell &b)
+{
+    return a.start < b.start;
+}
+
+static bool timeLessThanCellEnd(qint64 time, const EpgGridCell &cell)
+{
+    return time < cell.end;
+}
+
+class EpgLoadTask : public QRunnable
+{
+public:
+    EpgLoadTask(EpgGridWidget *grid, const QDir &cacheDir, int generation, int channelId, const QDate &date) :
+        m_grid(grid), m_cacheDir(cacheDir), m_generation(generation), m_channelId(channelId), m_date(date)
+    {
+    }
+
+    void run()
+    {
+        /* Oma välimuistiolio, koska pääikkuna voi vaihtaa jaetun välimuistin hakemiston
+           kesken luvun. */
+        Cache cache;
+        cache.setDirectory(m_cacheDir);
+        bool ok;
+        bool previousOk;
+        int age;
+        ProgrammeSnapshot programmes = cache.readProgrammes(m_channelId, m_date, ok, age);
+
+        /* Edellisen päivän ohjelmat voivat jatkua puolenyön yli. */
+        ProgrammeSnapshot previousDay = cache.readProgrammes(m_channelId, m_date.addDays(-1), previousOk, age);
+
+        if (programmes.isEmpty()) {
+            ok = false;
+        }
+
+        QMetaObject::invokeMethod(m_grid, "programmesLoaded", Qt::QueuedConnection,
+                                  Q_ARG(int, m_generation), Q_ARG(int, m_channelId),
+                                  Q_ARG(ProgrammeSnapshot, programmes), Q_ARG(bool, ok),
+                                  Q_ARG(ProgrammeSnapshot, previousDay), Q_ARG(bool, previousOk));
+    }
+
+private:
+    EpgGridWidget *m_grid;
+    QDir m_cacheDir;
+    int m_generation;
+    int m_channelId;
+    QDate m_date;
+};
+
+EpgGridWidget::EpgGridWidget(Cache *cache, TvkaistaClient *client, QWidget *parent) :
+    QAbstractScrollArea(parent), m_cache(cache), m_client(client), m_fetchTimer(new QTimer(this)),
+    m_dayStart(0), m_fetchingChannelId(-1), m_generation(0)
+{
+    qRegisterMetaType<ProgrammeSnapshot>("ProgrammeSnapshot");
+    setWindowFlags(Qt::Window);
+    resize(900, 600);
+    horizontalScrollBar()->setSingleStep(15 * 60 * 1000 / MSECS_PER_PIXEL);
+    verticalScrollBar()->setSingleStep(ROW_HEIGHT);
+
+    for (int i = 0; i < 24; i++) {
+        m_hourTexts[i].setText(QString("%1:00").arg(i, 2, 10, QChar('0')));
+    }
+
+    m_fetchTimer->setInterval(FETCH_INTERVAL);
+    connect(m_fetchTimer, SIGNAL(timeout()), SLOT(fetchNext()));
+    connect(m_client, SIGNAL(programmesFetched(int,QDate,ProgrammeSnapshot)), SLOT(programmesFetched(int,QDate,ProgrammeSnapshot)));
+    connect(m_client, SIGNAL(backgroundRequestFailed()), SLOT(fetchFailed()));
+}
+
+EpgGridWidget::~EpgGridWidget()
+{
+    m_threadPool.clear();
+    m_threadPool.waitForDone();
+}
+
+void EpgGridWidget::setChannels(const QList<Channel> &channels)
+{
+    m_rows.clear();
+    m_rowsByChannel.clear();
+    int count = channels.size();
+    m_rows.reserve(count);
+
+    for (int i = 0; i < count; i++) {
+        EpgGridRow row;
+        row.channel = channels.at(i);
+        row.nameText.setTextFormat(Qt::PlainText);
+        row.nameText.setTextWidth(CHANNEL_WIDTH - 8);
+        row.nameText.setText(row.channel.name);
+        m_rows.append(row);
+        m_rowsByChannel.insert(row.channel.id, i);
+    }
+
+    updateScrollBars();
+    reload();
+}
+
+void EpgGridWidget::setDate(const QDate &date)
+{
+    if (date == m_date) {
+        return;
+    }
+
+    m_date = date;
+    m_dayStart = QDateTime(date, QTime(0, 0)).toMSecsSinceEpoch();
+    updateWindowTitle();
+    reload();
+
+    if (date == QDate::currentDate()) {
+        scrollToTime(QDateTime::currentMSecsSinceEpoch() - 30 * 60 * 1000);
+    }
+    else {
+        scrollToTime(m_dayStart + 18 * 60 * 60 * 1000);
+    }
+}
+
+QDate EpgGridWidget::date() const
+{
+    return m_date;
+}
+
+void EpgGridWidget::paintEvent(QPaintEvent *e)
+{
+    QPainter painter(viewport());
+    const QPalette &pal = palette();
+    QRect area = viewport()->rect();
+    QRect content(CHANNEL_WIDTH, HEADER_HEIGHT, area.width() - CHANNEL_WIDTH, area.height() - HEADER_HEIGHT);
+    int hs = horizontalScrollBar()->value();
+    int vs = verticalScrollBar()->value();
+    qint64 visibleStart = m_dayStart + qint64(hs) * MSECS_PER_PIXEL;
+    qint64 visibleEnd = visibleStart + qint64(content.width()) * MSECS_PER_PIXEL;
+    qint64 now = QDateTime::currentMSecsSinceEpoch();
+    int firstRow = qMax(0, vs / ROW_HEIGHT);
+    int lastRow = qMin(m_rows.size() - 1, (vs + content.height()) / ROW_HEIGHT);
+    painter.fillRect(e->rect(), pal.base());
+
+    for (int row = firstRow; row <= lastRow; row++) {
+        EpgGridRow &r = m_rows[row];
+        int y = HEADER_HEIGHT + row * ROW_HEIGHT - vs;
+        QRect rowRect(content.left(), y, content.width(), ROW_HEIGHT);
+
+        if (!rowRect.intersects(e->rect())) {
+            continue;
+        }
+
+        if (!r.loaded) {
+            painter.setClipRect(rowRect & content);
+            painter.setPen(pal.color(QPalette::Disabled, QPalette::Text));
+            painter.drawText(rowRect.adjusted(6, 0, 0, 0), Qt::AlignLeft | Qt::AlignVCenter, trUtf8("Ladataan..."));
+            continue;
+        }
+
+        /* Solut ovat alkamisajan mukaan järjestyksessä eivätkä mene päällekkäin,
+           joten ensimmäinen näkyvä solu löytyy binäärihaulla. */
+        QVector<EpgGridCell>::iterator cell = std::upper_bound(r.cells.begin(), r.cells.end(),
+                                                               visibleStart, timeLessThanCellEnd);
+
+        for (; cell != r.cells.end() && cell->start < visibleEnd; ++cell) {
+            int x1 = xForTime(qMax(cell->start, m_dayStart)) - hs;
+            int x2 = xForTime(cell->end) - hs;
+            QRect cellRect(x1, y, qMax(1, x2 - x1), ROW_HEIGHT);
+            bool running = cell->start <= now && now < cell->end;
+            painter.setClipRect(cellRect & content);
+            painter.fillRect(cellRect, running ? pal.alternateBase() : pal.base());
+            painter.setPen(pal.color(QPalette::Mid));
+            painter.drawRect(cellRect.adjusted(0, 0, -1, -1));
+
+            if (!cell->textValid) {
+                const Programme &programme = r.programmes.at(cell->index);
+                cell->text.setTextFormat(Qt::PlainText);
+                cell->text.setTextWidth(qMax(10, cellRect.width() - 6));
+                cell->text.setText(QString("%1 %2").arg(
+                        QDateTime::fromMSecsSinceEpoch(cell->start).toString("hh:mm"), programme.title));
+                cell->text.prepare(QTransform(), font());
+                cell->textValid = true;
+            }
+
+            painter.setPen(pal.color(QPalette::Text));
+            painter.drawStaticText(x1 + 3, y + 3, cell->text);
+        }
+    }
+
+    if (now >= visibleStart && now < visibleEnd) {
+        int x = xForTime(now) - hs;
+        painter.setClipRect(content);
+        painter.setPen(Qt::red);
+        painter.drawLine(x, content.top(), x, content.bottom());
+    }
+
+    QRect header(CHANNEL_WIDTH, 0, content.width(), HEADER_HEIGHT);
+    painter.setClipRect(header);
+    painter.fillRect(header, pal.button());
+    painter.setPen(pal.color(QPalette::ButtonText));
+    int firstHour = qBound(0, int((visibleStart - m_dayStart) / 3600000), 23);
+    int lastHour = qBound(0, int((visibleEnd - m_dayStart) / 3600000), 23);
+
+    for (int hour = firstHour; hour <= lastHour; hour++) {
+        int x = xForTime(m_dayStart + hour * 3600000LL) - hs;
+        painter.drawLine(x, HEADER_HEIGHT - 5, x, HEADER_HEIGHT);
+        painter.drawStaticText(x + 3, 3, m_hourTexts[hour]);
+    }
+
+    QRect channels(0, HEADER_HEIGHT, CHANNEL_WIDTH, content.height());
+    painter.setClipRect(channels);
+    painter.fillRect(channels, pal.button());
+
+    for (int row = firstRow; row <= lastRow; row++) {
+        int y = HEADER_HEIGHT + row * ROW_HEIGHT - vs;
+        painter.setPen(pal.color(QPalette::ButtonText));
+        painter.drawStaticText(4, y + 3, m_rows.at(row).nameText);
+        painter.setPen(pal.color(QPalette::Mid));
+        painter.drawLine(0, y + ROW_HEIGHT - 1, CHANNEL_WIDTH, y + ROW_HEIGHT - 1);
+    }
+}
+
+void EpgGridWidget::resizeEvent(QResizeEvent *e)
+{
+    QAbstractScrollArea::resizeEvent(e);
+    updateScrollBars();
+}
+
+void EpgGridWidget::changeEvent(QEvent *e)
+{
+    QAbstractScrollArea::changeEvent(e);
+
+    if (e->type() == QEvent::FontChange) {
+        invalidateTexts();
+    }
+}
+
+void EpgGridWidget::showEvent(QShowEvent *e)
+{
+    QAbstractScrollArea::showEvent(e);
+    updateScrollBars();
+
+    if (!m_fetchQueue.isEmpty() || !m_overnightQueue.isEmpty()) {
+        m_fetchTimer->start();
+    }
+}
+
+void EpgGridWidget::keyPressEvent(QKeyEvent *e)
+{
+    if (e->modifiers() == Qt::AltModifier && e->key() == Qt::Key_Left) {
+        setDate(m_date.addDays(-1));
+    }
+    else if (e->modifiers() == Qt::AltModifier && e->key() == Qt::Key_Right) {
+        setDate(m_date.addDays(1));
+    }
+    else {
+        QAbstractScrollArea::keyPressEvent(e);
+    }
+}
+
+void EpgGridWidget::mouseDoubleClickEvent(QMouseEvent *e)
+{
+    QPoint pos = e->pos();
+    int row = rowAt(pos.y());
+
+    if (pos.x() < CHANNEL_WIDTH || row < 0) {
+        return;
+    }
+
+    const EpgGridRow &r = m_rows.at(row);
+    qint64 time = m_dayStart + qint64(pos.x() - CHANNEL_WIDTH + horizontalScrollBar()->value()) * MSECS_PER_PIXEL;
+    QVector<EpgGridCell>::const_iterator cell = std::upper_bound(r.cells.constBegin(), r.cells.constEnd(),
+                                                                 time, timeLessThanCellEnd);
+
+    if (cell != r.cells.constEnd() && cell->start <= time) {
+        emit programmeActivated(r.programmes.at(cell->index));
+    }
+}
+
+void EpgGridWidget::programmesLoaded(int generation, int channelId, const ProgrammeSnapshot &programmes, bool ok,
+                                     const ProgrammeSnapshot &previousDay, bool previousOk)
+{
+    if (generation != m_generation) {
+        return;
+    }
+
+    int row = m_rowsByChannel.value(channelId, -1);
+
+    if (row < 0) {
+        return;
+    }
+
+    if (previousOk) {
+        setRowOvernight(row, previousDay);
+    }
+    else if (m_client->isValidUsernameAndPassword()) {
+        m_overnightQueue.append(channelId);
+    }
+
+    if (ok) {
+        setRowProgrammes(row, programmes);
+    }
+    else if (m_client->isValidUsernameAndPassword()) {
+        m_fetchQueue.append(channelId);
+    }
+    else {
+        m_rows[row].loaded = true;
+    }
+
+    if ((!m_fetchQueue.isEmpty() || !m_overnightQueue.isEmpty()) && !m_fetchTimer->isActive()) {
+        m_fetchTimer->start();
+    }
+
+    if (isRowVisible(row)) {
+        viewport()->update();
+    }
+}
+
+void EpgGridWidget::programmesFetched(int channelId, const QDate &date, const ProgrammeSnapshot &programmes)
+{
+    if (date != m_date && date != m_date.addDays(-1)) {
+        return;
+    }
+
+    int row = m_rowsByChannel.value(channelId, -1);
+
+    if (row < 0) {
+        return;
+    }
+
+    if (date == m_date) {
+        setRowProgrammes(row, programmes);
+        m_fetchQueue.removeAll(channelId);
+    }
+    else {
+        setRowOvernight(row, programmes);
+        m_overnightQueue.removeAll(channelId);
+    }
+
+    if (channelId == m_fetchingChannelId && date == m_fetchingDate) {
+        m_fetchingChannelId = -1;
+    }
+
+    if (isRowVisible(row)) {
+        viewport()->update();
+    }
+}
+
+void EpgGridWidget::fetchNext()
+{
+    if (m_fetchingChannelId >= 0) {
+        if (m_fetchElapsed.elapsed() < FETCH_TIMEOUT) {
+            return;
+        }
+
+        /* Pääikkunan oma pyyntö on voinut keskeyttää haun. */
+        fetchFailed();
+    }
+
+    if (m_fetchQueue.isEmpty() && m_overnightQueue.isEmpty()) {
+        m_fetchTimer->stop();
+        return;
+    }
+
+    if (!isVisible() || m_client->isRequestUnfinished()) {
+        return;
+    }
+
+    /* Näytettävän päivän ohjelmat haetaan ennen puolenyön yli jatkuvia. */
+    if (!m_fetchQueue.isEmpty()) {
+        m_fetchingChannelId = m_fetchQueue.takeAt(nextFetchIndex(m_fetchQueue));
+        m_fetchingDate = m_date;
+    }
+    else {
+        m_fetchingChannelId = m_overnightQueue.takeAt(nextFetchIndex(m_overnightQueue));
+        m_fetchingDate = m_date.addDays(-1);
+    }
+
+    m_fetchElapsed.start();
+    m_client->sendProgrammeRequest(m_fetchingChannelId, m_fetchingDate);
+
+    /* Verkkovirheistä ei näytetä ilmoituksia, ruudukko yrittää itse uudelleen. */
+    m_client->markBackgroundRequest();
+}
+
+void EpgGridWidget::fetchFailed()
+{
+    if (m_fetchingChannelId < 0) {
+        return;
+    }
+
+    /* Näytettävän päivän haku yritetään kerran uudelleen, edellisen päivän ei. */
+    if (m_fetchingDate == m_date) {
+        if (!m_retried.contains(m_fetchingChannelId)) {
+            m_retried.insert(m_fetchingChannelId);
+            m_fetchQueue.append(m_fetchingChannelId);
+        }
+        else {
+            int row = m_rowsByChannel.value(m_fetchingChannelId, -1);
+
+            if (row >= 0) {
+                m_rows[row].loaded = true;
+                viewport()->update();
+            }
+        }
+    }
+
+    m_fetchingChannelId = -1;
+}
+
+void EpgGridWidget::reload()
+{
+    if (m_date.isNull()) {
+        return;
+    }
+
+    m_generation++;
+    m_threadPool.clear();
+    m_fetchQueue.clear();
+    m_overnightQueue.clear();
+    m_retried.clear();
+    m_fetchingChannelId = -1;
+    m_fetchTimer->stop();
+    int count = m_rows.size();
+
+    /* Välimuistitiedostot luetaan rinnakkain taustasäikeissä. */
+    for (int i = 0; i < count; i++) {
+        EpgGridRow &row = m_rows[i];
+        row.loaded = false;
+        row.dayProgrammes = ProgrammeSnapshot();
+        row.overnight.clear();
+        row.programmes = ProgrammeSnapshot();
+        row.cells.clear();
+        m_threadPool.start(new EpgLoadTask(this, m_cache->directory(), m_generation, row.channel.id, m_date));
+    }
+
+    viewport()->update();
+}
+
+void EpgGridWidget::setRowProgrammes(int row, const ProgrammeSnapshot &programmes)
+{
+    EpgGridRow &r = m_rows[row];
+    r.dayProgrammes = programmes;
+    r.loaded = true;
+    updateRowCells(row);
+}
+
+void EpgGridWidget::setRowOvernight(int row, const ProgrammeSnapshot &previousDay)
+{
+    /* Edelliseltä päivältä otetaan ohjelmat, jotka alkavat ennen puoltayötä ja
+       päättyvät sen jälkeen. Ilman kestoa loppu on seuraavan ohjelman alku. */
+    EpgGridRow &r = m_rows[row];
+    r.overnight.clear();
+    int count = previousDay.size();
+
+    for (int i = 0; i < count; i++) {
+        const Programme &programme = previousDay.at(i);
+
+        if (programme.startTime < 0 || programme.startTime >= m_dayStart) {
+            continue;
+        }
+
+        qint64 end = -1;
+
+        if (programme.duration > 0) {
+            end = programme.startTime + programme.duration * 1000LL;
+        }
+        else if (i + 1 < count && previousDay.at(i + 1).startTime > programme.startTime) {
+            end = previousDay.at(i + 1).startTime;
+        }
+
+        if (end > m_dayStart) {
+            r.overnight.append(programme);
+        }
+    }
+
+    if (r.loaded) {
+        updateRowCells(row);
+    }
+}
+
+void EpgGridWidget::updateRowCells(int row)
+{
+    EpgGridRow &r = m_rows[row];
+    r.programmes = r.overnight.isEmpty() ? r.dayProgrammes : ProgrammeSnapshot(r.overnight + r.dayProgrammes.toList());
+    r.cells.clear();
+    int count = r.programmes.size();
+    r.cells.reserve(count);
+
+    for (int i = 0; i < count; i++) {
+        const Programme &programme = r.programmes.at(i);
+
+        if (programme.startTime < 0) {
+            continue;
+        }
+
+        EpgGridCell cell;
+        cell.start = programme.startTime;
+        cell.end = programme.duration > 0 ? programme.startTime + programme.duration * 1000LL : -1;
+        cell.index = i;
+        cell.textValid = false;
+        r.cells.append(cell);
+    }
+
+    std::stable_sort(r.cells.begin(), r.cells.end(), cellLessThan);
+    count = r.cells.size();
+
+    /* Loppuajat rajataan seuraavan ohjelman alkuun, jotta myös ne ovat järjestyksessä. */
+    for (int i = 0; i < count; i++) {
+        EpgGridCell &cell = r.cells[i];
+        qint64 next = i + 1 < count ? r.cells.at(i + 1).start : -1;
+
+        if (cell.end < 0) {
+            cell.end = next >= 0 ? next : cell.start + DEFAULT_LENGTH;
+        }
+        else if (next >= 0 && cell.end > next) {
+            cell.end = next;
+        }
+    }
+}
+
+void EpgGridWidget::invalidateTexts()
+{
+    int count = m_rows.size();
+
+    for (int i = 0; i < count; i++) {
+        EpgGridRow &row = m_rows[i];
+        int cellCount = row.cells.size();
+
+        for (int j = 0; j < cellCount; j++) {
+            row.cells[j].textValid = false;
+        }
+    }
+
+    viewport()->update();
+}
+
+void EpgGridWidget::updateScrollBars()
+{
+    QSize size = viewport()->size();
+    int width = size.width() - CHANNEL_WIDTH;
+    int height = size.height() - HEADER_HEIGHT;
+    horizontalScrollBar()->setPageStep(width);
+    horizontalScrollBar()->setRange(0, qMax(0, DAY_WIDTH - width));
+    verticalScrollBar()->setPageStep(height);
+    verticalScrollBar()->setRange(0, qMax(0, m_rows.size() * ROW_HEIGHT - height));
+}
+
+void EpgGridWidget::updateWindowTitle()
+{
+    setWindowTitle(trUtf8("Ohjelmakartta - %1").arg(m_date.toString("d.M.yyyy")));
+}
+
+void EpgGridWidget::scrollToTime(qint64 time)
+{
+    horizontalScrollBar()->setValue(int((time - m_dayStart) / MSECS_PER_PIXEL));
+}
+
+bool EpgGridWidget::isRowVisible(int row) const
+{
+    if (row < 0) {
+        return false;
+    }
+
+    int y = row * ROW_HEIGHT - verticalScrollBar()->value();
+    return y + ROW_HEIGHT > 0 && y < viewport()->height() - HEADER_HEIGHT;
+}
+
+int EpgGridWidget::rowAt(int y) const
+{
+    if (y < HEADER_HEIGHT) {
+        return -1;
+    }
+
+    int row = (y - HEADER_HEIGHT + verticalScrollBar()->value()) / ROW_HEIGHT;
+    return row < m_rows.size() ? row : -1;
+}
+
+int EpgGridWidget::nextFetchIndex(const QList<int> &queue) const
+{
+    /* Näkyvät rivit haetaan ensin. */
+    int count = queue.size();
+
+    for (int i = 0; i < count; i++) {
+        if (isRowVisible(m_rowsByChannel.value(queue.at(i), -1))) {
+            return i;
+        }
+    }
+
+    return 0;
+}
+
+int EpgGridWidget::xForTime(qint64 time) const
+{
+    return CHANNEL_WIDTH + int((time - m_dayStart) / MSECS_PER_PIXEL);
+}
@@ -0,0 +1,102 @@
+#ifndef EPGGRIDWIDGET_H
+#define EPGGRIDWIDGET_H
+
+#include <QAbstractScrollArea>
+#include <QDate>
+#include <QElapsedTimer>
+#include <QHash>
+#include <QList>
+#include <QSet>
+#include <QStaticText>
+#include <QThreadPool>
+#include <QVector>
+#include "channel.h"
+#include "programmesnapshot.h"
+
+class QTimer;
+class Cache;
+class TvkaistaClient;
+
+struct EpgGridCell
+{
+    qint64 start;
+    qint64 end;
+    int index;
+    bool textValid;
+    QStaticText text;
+};
+
+struct EpgGridRow
+{
+    EpgGridRow() : loaded(false) {}
+    Channel channel;
+    ProgrammeSnapshot dayProgrammes;
+    QList<Programme> overnight;
+    ProgrammeSnapshot programmes;
+    QVector<EpgGridCell> cells;
+    QStaticText nameText;
+    bool loaded;
+};
+
+/* Kaikkien kanavien yhden päivän ohjelmat ruudukkona. Vain näkyvä alue piirretään,
+   ja solujen tekstit asetellaan kerran QStaticText-olioihin. */
+class EpgGridWidget : public QAbstractScrollArea
+{
+    Q_OBJECT
+public:
+    EpgGridWidget(Cache *cache, TvkaistaClient *client, QWidget *parent = 0);
+    ~EpgGridWidget();
+    void setChannels(const QList<Channel> &channels);
+    void setDate(const QDate &date);
+    QDate date() const;
+
+signals:
+    void programmeActivated(const Programme &programme);
+
+protected:
+    void paintEvent(QPaintEvent *e);
+    void resizeEvent(QResizeEvent *e);
+    void changeEvent(QEvent *e);
+    void showEvent(QShowEvent *e);
+    void keyPressEvent(QKeyEvent *e);
+    void mouseDoubleClickEvent(QMouseEvent *e);
+
+private slots:
+    void programmesLoaded(int generation, int channelId, const ProgrammeSnapshot &programmes, bool ok,
+                          const ProgrammeSnapshot &previousDay, bool previousOk);
+    void programmesFetched(int channelId, const QDate &date, const ProgrammeSnapshot &programmes);
+    void fetchNext();
+    void fetchFailed();
+
+private:
+    void reload();
+    void setRowProgrammes(int row, const ProgrammeSnapshot &programmes);
+    void setRowOvernight(int row, const ProgrammeSnapshot &previousDay);
+    void updateRowCells(int row);
+    int nextFetchIndex(const QList<int> &queue) const;
+    void invalidateTexts();
+    void updateScrollBars();
+    void updateWindowTitle();
+    void scrollToTime(qint64 time);
+    bool isRowVisible(int row) const;
+    int rowAt(int y) const;
+    int xForTime(qint64 time) const;
+    Cache *m_cache;
+    TvkaistaClient *m_client;
+    QThreadPool m_threadPool;
+    QTimer *m_fetchTimer;
+    QVector<EpgGridRow> m_rows;
+    QHash<int, int> m_rowsByChannel;
+    QStaticText m_hourTexts[24];
+    QList<int> m_fetchQueue;
+    QList<int> m_overnightQueue;
+    QSet<int> m_retried;
+    QElapsedTimer m_fetchElapsed;
+    QDate m_fetchingDate;
+    QDate m_date;
+    qint64 m_dayStart;
+    int m_fetchingChannelId;
+    int m_generation;
+};
+
+#endif // EPGGRIDWIDGET_H
@@ -0,0 +1,207 @@
+#include <QDebug>
+#include <QDir>
+#include <QFileInfo>
+#include <QFileSystemWatcher>
+#include <QTimer>
+#include "filemonitor.h"
+
+/* Yhdellä ajastimen kierroksella tarkistettavien tiedostojen enimmäismäärä. */
+static const int FILES_PER_SWEEP = 50;
+
+/* Hakemiston muutokset kerätään tämän ajan ennen tarkistusta, koska jokainen lataus,
+   sen hakemisto ja nimen vaihto aiheuttavat oman tapahtumansa. */
+static const int CHANGE_DELAY = 500;
+
+FileMonitor::FileMonitor(QObject *parent) :
+    QObject(parent), m_watcher(new QFileSystemWatcher(this)), m_sweepTimer(new QTimer(this)),
+    m_changeTimer(new QTimer(this)), m_sweepInterval(30 * 1000)
+{
+    m_changeTimer->setSingleShot(true);
+    m_changeTimer->setInterval(CHANGE_DELAY);
+    connect(m_watcher, SIGNAL(directoryChanged(QString)), SLOT(directoryChanged(QString)));
+    connect(m_sweepTimer, SIGNAL(timeout()), SLOT(sweep()));
+    connect(m_changeTimer, SIGNAL(timeout()), SLOT(checkChangedDirectories()));
+}
+
+void FileMonitor::addFile(const QString &path)
+{
+    addFiles(QStringList() << path);
+}
+
+void FileMonitor::addFiles(const QStringList &paths)
+{
+    QStringList newDirectories;
+    int count = paths.size();
+
+    for (int i = 0; i < count; i++) {
+        QFileInfo info(paths.at(i));
+        QString dirPath = info.absolutePath();
+
+        if (!m_files.contains(dirPath)) {
+            newDirectories.append(dirPath);
+        }
+
+        m_files[dirPath].insert(info.absoluteFilePath());
+    }
+
+    if (newDirectories.isEmpty()) {
+        return;
+    }
+
+    /* Vahdit loppuvat helposti kesken, jolloin loput hakemistot tarkistetaan ajastimella. */
+    QStringList failed = m_watcher->addPaths(newDirectories);
+    count = failed.size();
+
+    for (int i = 0; i < count; i++) {
+        m_polledDirectories.insert(failed.at(i));
+    }
+
+    if (!failed.isEmpty()) {
+        qWarning() << "FileMonitor: polling" << failed.size() << "directories";
+
+        if (!m_sweepTimer->isActive()) {
+            m_sweepTimer->start(m_sweepInterval);
+        }
+    }
+}
+
+void FileMonitor::removeFile(const QString &path)
+{
+    QFileInfo info(path);
+    QString dirPath = info.absolutePath();
+    QHash<QString, QSet<QString> >::iterator iter = m_files.find(dirPath);
+
+    if (iter == m_files.end()) {
+        return;
+    }
+
+    iter.value().remove(info.absoluteFilePath());
+
+    if (!iter.value().isEmpty()) {
+        return;
+    }
+
+    m_files.erase(iter);
+
+    if (m_polledDirectories.remove(dirPath)) {
+        m_sweepQueue.removeAll(dirPath);
+
+        if (m_polledDirectories.isEmpty()) {
+            m_sweepTimer->stop();
+        }
+    }
+    else {
+        m_watcher->removePath(dirPath);
+    }
+}
+
+void FileMonitor::clear()
+{
+    QStringList directories = m_watcher->directories();
+
+    if (!directories.isEmpty()) {
+        m_watcher->removePaths(directories);
+    }
+
+    m_files.clear();
+    m_polledDirectories.clear();
+    m_sweepQueue.clear();
+    m_changedDirectories.clear();
+    m_sweepTimer->stop();
+    m_changeTimer->stop();
+}
+
+void FileMonitor::setSweepInterval(int msecs)
+{
+    m_sweepInterval = msecs;
+
+    if (m_sweepTimer->isActive()) {
+        m_sweepTimer->start(m_sweepInterval);
+    }
+}
+
+int FileMonitor::sweepInterval() const
+{
+    return m_sweepInterval;
+}
+
+void FileMonitor::directoryChanged(const QString &path)
+{
+    m_changedDirectories.insert(path);
+
+    if (!m_changeTimer->isActive()) {
+        m_changeTimer->start();
+    }
+}
+
+void FileMonitor::checkChangedDirectories()
+{
+    QStringList directories = m_changedDirectories.toList();
+    m_changedDirectories.clear();
+    int count = directories.size();
+
+    for (int i = 0; i < count; i++) {
+        checkDirectory(directories.at(i));
+    }
+}
+
+void FileMonitor::sweep()
+{
+    if (m_sweepQueue.isEmpty()) {
+        m_sweepQueue = m_polledDirectories.toList();
+    }
+
+    int checked = 0;
+
+    while (!m_sweepQueue.isEmpty() && checked < FILES_PER_SWEEP) {
+        QString dirPath = m_sweepQueue.takeFirst();
+        QStringList files = m_files.value(dirPath).toList();
+        checkFiles(files);
+        checked += files.size();
+    }
+}
+
+void FileMonitor::checkDirectory(const QString &dirPath)
+{
+    QHash<QString, QSet<QString> >::const_iterator iter = m_files.constFind(dirPath);
+
+    if (iter == m_files.constEnd()) {
+        return;
+    }
+
+    /* Yksi hakemistolistaus korvaa tiedostokohtaiset tarkistukset. */
+    QDir dir(dirPath);
+    QStringList names = dir.entryList(QDir::AllEntries | QDir::Hidden | QDir::System | QDir::NoDotAndDotDot);
+    QSet<QString> existing;
+    int count = names.size();
+
+    for (int i = 0; i < count; i++) {
+        existing.insert(dir.absoluteFilePath(names.at(i)));
+    }
+
+    QList<QString> files = iter.value().toList();
+    count = files.size();
+
+    for (int i = 0; i < count; i++) {
+        QString filename = files.at(i);
+
+        if (!existing.contains(filename)) {
+            removeFile(filename);
+            emit fileRemoved(filename);
+        }
+    }
+}
+
+void FileMonitor::checkFiles(const QStringList &files)
+{
+    int count = files.size();
+
+    for (int i = 0; i < count; i++) {
+        QString filename = files.at(i);
+
+        if (!QFileInfo(filename).exists()) {
+            removeFile(filename);
+            emit fileRemoved(filename);
+        }
+    }
+}
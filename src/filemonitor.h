@@ -0,0 +1,48 @@
+#ifndef FILEMONITOR_H
+#define FILEMONITOR_H
+
+#include <QHash>
+#include <QObject>
+#include <QSet>
+#include <QStringList>
+
+class QFileSystemWatcher;
+class QTimer;
+
+/* Seuraa valmiiden tiedostojen poistamista. Jokaista hakemistoa kohden käytetään
+   vain yhtä vahtia, ja jos vahteja ei saada lisää, hakemistot tarkistetaan ajastimella
+   pienissä erissä. */
+class FileMonitor : public QObject
+{
+    Q_OBJECT
+public:
+    FileMonitor(QObject *parent = 0);
+    void addFile(const QString &path);
+    void addFiles(const QStringList &paths);
+    void removeFile(const QString &path);
+    void clear();
+    void setSweepInterval(int msecs);
+    int sweepInterval() const;
+
+signals:
+    void fileRemoved(const QString &path);
+
+private slots:
+    void directoryChanged(const QString &path);
+    void checkChangedDirectories();
+    void sweep();
+
+private:
+    void checkDirectory(const QString &dirPath);
+    void checkFiles(const QStringList &files);
+    QFileSystemWatcher *m_watcher;
+    QTimer *m_sweepTimer;
+    QTimer *m_changeTimer;
+    QSet<QString> m_changedDirectories;
+    QHash<QString, QSet<QString> > m_files;
+    QSet<QString> m_polledDirectories;
+    QStringList m_sweepQueue;
+    int m_sweepInterval;
+};
+
+#endif // FILEMONITOR_H
@@ -7,16 +7,18 @@
 #include <QXmlStreamWriter>
 #include "historymanager.h"
 
-HistoryManager::HistoryManager(QSettings *settings) : m_settings(settings)
+HistoryManager::HistoryManager(QSettings *settings) :
+    m_settings(settings), m_loaded(false), m_savePending(false)
 {
 }
 
-bool HistoryManager::load()
+QString HistoryManager::filename() const
+{
+    return QString("%1/history.xml").arg(QFileInfo(m_settings->fileName()).path());
+}
+
+bool HistoryManager::read(const QString &filename, QList<HistoryEntry> &entries)
 {
-    m_entries.clear();
-    m_programmeSet.clear();
-    QString dirPath = QFileInfo(m_settings->fileName()).path();
-    QString filename = QString("%1/history.xml").arg(dirPath);
     QFile file(filename);
 
     if (!file.exists()) {
@@ -52,18 +54,71 @@ bool HistoryManager::load()
 
         entry.dateTime = QDateTime::fromString(attrs.value("dateTime").toString(),
                                                "yyyy-MM-dd'T'hh:mm:ss");
-        m_entries.append(entry);
-        m_programmeSet.insert(entry.programmeId);
+        entries.append(entry);
         reader.skipCurrentElement();
     }
 
     return true;
 }
 
+void HistoryManager::setEntries(const QList<HistoryEntry> &entries)
+{
+    /* Ennen latauksen valmistumista lisätyt merkinnät säilytetään. */
+    QList<HistoryEntry> added = m_entries;
+    m_entries = entries;
+    m_programmeSet.clear();
+    int count = m_entries.size();
+
+    for (int i = 0; i < count; i++) {
+        m_programmeSet.insert(m_entries.at(i).programmeId);
+    }
+
+    count = added.size();
+
+    for (int i = 0; i < count; i++) {
+        if (!m_programmeSet.contains(added.at(i).programmeId)) {
+            m_entries.append(added.at(i));
+            m_programmeSet.insert(added.at(i).programmeId);
+        }
+    }
+
+    m_loaded = true;
+
+    if (m_savePending) {
+        m_savePending = false;
+        save();
+    }
+}
+
+bool HistoryManager::isLoaded() const
+{
+    return m_loaded;
+}
+
+bool HistoryManager::load()
+{
+    QList<HistoryEntry> entries;
+
+    if (!read(filename(), entries)) {
+        return false;
+    }
+
+    m_entries.clear();
+    m_programmeSet.clear();
+    setEntries(entries);
+    return true;
+}
+
 bool HistoryManager::save()
 {
-    QString dirPath = QFileInfo(m_settings->fileName()).path();
-    QString filename = QString("%1/history.xml").arg(dirPath);
+    /* Keskeneräisen latauksen aikana tiedostoon ei kirjoiteta, ettei historia katoa. */
+    if (!m_loaded) {
+        m_savePending = true;
+        return true;
+    }
+
+    QString filename = this->filename();
+    QString dirPath = QFileInfo(filename).path();
     QDir dir(dirPath);
 
     if (!dir.exists()) {
@@ -11,6 +11,10 @@ class HistoryManager
 {
 public:
     HistoryManager(QSettings *settings);
+    QString filename() const;
+    static bool read(const QString &filename, QList<HistoryEntry> &entries);
+    void setEntries(const QList<HistoryEntry> &entries);
+    bool isLoaded() const;
     bool load();
     bool save();
     void addEntry(int programmeId);
@@ -22,6 +26,8 @@ private:
     QSettings *m_settings;
     QList<HistoryEntry> m_entries;
     QSet<int> m_programmeSet;
+    bool m_loaded;
+    bool m_savePending;
 };
 
 #endif // HISTORYMANAGER_H
@@ -17,62 +17,72 @@ bool HtmlParser::parse(QIODevice *device)
     m_len = device->read(m_buf, 4096);
 
     while (m_len > 0) {
-        for (int i = 0; i < m_len; i++) {
-            char c = m_buf[i];
+        parseData(m_buf, m_len);
+        m_len = device->read(m_buf, 4096);
+    }
 
-            if (c == '<') {
-                if (m_x == 0 && m_parseContent) {
-                    contentParsed(m_codec->toUnicode(m_s));
-                }
+    return true;
+}
 
-                m_x = 1;
-                m_s.clear();
-                m_a.clear();
-                m_attrsParsed = false;
-                m_attrs.clear();
-            }
-            else if (c == '>') {
-                if (m_x > 0 && !m_s.isEmpty()) {
-                    if (m_s.startsWith("/")) {
-                        m_s.remove(0, 1);
-                        endElementParsed(m_codec->toUnicode(m_s));
-                    }
-                    else {
-                        startElementParsed(m_codec->toUnicode(m_s));
-                    }
-                }
+bool HtmlParser::parse(const QByteArray &data)
+{
+    parseData(data.constData(), data.size());
+    return true;
+}
+
+void HtmlParser::parseData(const char *data, int len)
+{
+    for (int i = 0; i < len; i++) {
+        char c = data[i];
 
-                m_x = 0;
-                m_s.clear();
-                m_a.clear();
+        if (c == '<') {
+            if (m_x == 0 && m_parseContent) {
+                contentParsed(m_codec->toUnicode(m_s));
             }
-            else if (m_x == 1) {
-                if (c == ' ') {
-                    m_x = 2;
+
+            m_x = 1;
+            m_s.clear();
+            m_a.clear();
+            m_attrsParsed = false;
+            m_attrs.resize(0);
+        }
+        else if (c == '>') {
+            if (m_x > 0 && !m_s.isEmpty()) {
+                if (m_s.startsWith("/")) {
+                    m_s.remove(0, 1);
+                    endElementParsed(m_s);
                 }
                 else {
-                    m_s.append(c);
+                    startElementParsed(m_s);
                 }
             }
-            else if (m_x == 2) {
-                m_a.append(c);
+
+            m_x = 0;
+            m_s.clear();
+            m_a.clear();
+        }
+        else if (m_x == 1) {
+            if (c == ' ') {
+                m_x = 2;
             }
-            else if (m_x == 0 && m_parseContent) {
+            else {
                 m_s.append(c);
             }
         }
-
-        m_len = device->read(m_buf, 4096);
+        else if (m_x == 2) {
+            m_a.append(c);
+        }
+        else if (m_x == 0 && m_parseContent) {
+            m_s.append(c);
+        }
     }
-
-    return true;
 }
 
-void HtmlParser::startElementParsed(const QString&)
+void HtmlParser::startElementParsed(const QByteArray&)
 {
 }
 
-void HtmlParser::endElementParsed(const QString&)
+void HtmlParser::endElementParsed(const QByteArray&)
 {
 }
 
@@ -80,13 +90,21 @@ void HtmlParser::contentParsed(const QString&)
 {
 }
 
-QString HtmlParser::attribute(const QString &name)
+QByteArray HtmlParser::attribute(quint32 hash, const char *name, int len)
 {
     if (!m_attrsParsed) {
         parseAttributes();
     }
 
-    return m_attrs.value(name);
+    for (int i = 0; i < m_attrs.size(); i++) {
+        const HtmlAttribute &attr = m_attrs.at(i);
+
+        if (attr.hash == hash && attr.name.size() == len && qstrncmp(attr.name.constData(), name, len) == 0) {
+            return attr.value;
+        }
+    }
+
+    return QByteArray();
 }
 
 void HtmlParser::parseAttributes()
@@ -105,7 +123,7 @@ void HtmlParser::parseAttributes()
         }
         else if (y) {
             if (!quotes && c == ' ') {
-                m_attrs.insert(m_codec->toUnicode(name), m_codec->toUnicode(value));
+                addAttribute(name, value);
                 name.clear();
                 value.clear();
                 y = false;
@@ -125,8 +143,17 @@ void HtmlParser::parseAttributes()
     }
 
     if (!value.isEmpty()) {
-        m_attrs.insert(m_codec->toUnicode(name), m_codec->toUnicode(value));
+        addAttribute(name, value);
     }
 
     m_attrsParsed = true;
 }
+
+void HtmlParser::addAttribute(const QByteArray &name, const QByteArray &value)
+{
+    HtmlAttribute attr;
+    attr.hash = htmlNameHash(name.constData(), name.size());
+    attr.name = name;
+    attr.value = value;
+    m_attrs.append(attr);
+}
@@ -1,35 +1,65 @@
 #ifndef HTMLPARSER_H
 #define HTMLPARSER_H
 
-#include <QMap>
 #include <QString>
 #include <QTextCodec>
+#include <QVarLengthArray>
 
 class QIODevice;
 
+/* FNV-1a -tiivisteen kääntäjässä laskettava versio. Aliluokat muuntavat tunnettujen
+   elementtien ja attribuuttien nimet sen avulla pieniksi kokonaisluvuiksi. */
+inline constexpr quint32 htmlNameHash(const char *s, int len, quint32 h = 2166136261u)
+{
+    return len <= 0 ? h : htmlNameHash(s + 1, len - 1, (h ^ quint8(*s)) * 16777619u);
+}
+
+template <int N>
+inline constexpr quint32 htmlNameHash(const char (&s)[N])
+{
+    return htmlNameHash(s, N - 1);
+}
+
+struct HtmlAttribute
+{
+    quint32 hash;
+    QByteArray name;
+    QByteArray value;
+};
+
 class HtmlParser
 {
 public:
     HtmlParser();
     virtual ~HtmlParser();
     bool parse(QIODevice *device);
+    bool parse(const QByteArray &data);
 
 protected:
-    virtual void startElementParsed(const QString &name);
-    virtual void endElementParsed(const QString &name);
+    virtual void startElementParsed(const QByteArray &name);
+    virtual void endElementParsed(const QByteArray &name);
     virtual void contentParsed(const QString &content);
-    QString attribute(const QString &name);
+    QByteArray attribute(quint32 hash, const char *name, int len);
+
+    template <int N>
+    QByteArray attribute(const char (&name)[N])
+    {
+        return attribute(htmlNameHash(name), name, N - 1);
+    }
+
     bool m_parseContent;
     QTextCodec *m_codec;
 
 private:
+    void parseData(const char *data, int len);
     void parseAttributes();
+    void addAttribute(const QByteArray &name, const QByteArray &value);
     char *m_buf;
     QByteArray m_s;
     QByteArray m_a;
     int m_len;
     int m_x;
-    QMap<QString, QString> m_attrs;
+    QVarLengthArray<HtmlAttribute, 8> m_attrs;
     bool m_attrsParsed;
 };
 
@@ -3,6 +3,7 @@
 #include <QComboBox>
 #include <QDebug>
 #include <QDesktopServices>
+#include <QFile>
 #include <QLabel>
 #include <QLineEdit>
 #include <QMessageBox>
@@ -10,39 +11,138 @@
 #include <QNetworkProxy>
 #include <QPainter>
 #include <QProcess>
+#include <QSet>
 #include <QSignalMapper>
 #include <QTimer>
+#include <QToolTip>
 #include "aboutdialog.h"
+#include "appsettings.h"
 #include "cache.h"
+#include "cachemaintainer.h"
 #include "downloader.h"
 #include "downloaddelegate.h"
 #include "downloadtablemodel.h"
+#include "epggridwidget.h"
 #include "historymanager.h"
+#include "prebuffersource.h"
+#include "posterloader.h"
 #include "programmefeedparser.h"
+#include "programmeindexloader.h"
 #include "programmetablemodel.h"
 #include "tvkaistaclient.h"
 #include "screenshotwindow.h"
+#include "serverprober.h"
 #include "settingsdialog.h"
+#include "startuploader.h"
+#include "streamserver.h"
+#include "syncengine.h"
+#include "tsvalidator.h"
 #include "mainwindow.h"
 #include "ui_mainwindow.h"
+#ifdef Q_OS_LINUX
+#include <unistd.h>
+#endif
+
+/* Prosessin muistissa pysyvä koko kilotavuina tai -1, jos sitä ei saa selville.
+   Kirjataan ohjelmalistojen vaihtuessa, jotta selaamisen muistinkulutusta voi seurata. */
+static qint64 residentMemorySize()
+{
+#ifdef Q_OS_LINUX
+    QFile file("/proc/self/statm");
+
+    if (!file.open(QIODevice::ReadOnly)) {
+        return -1;
+    }
+
+    QList<QByteArray> fields = file.readAll().split(' ');
+
+    if (fields.size() < 2) {
+        return -1;
+    }
+
+    return fields.at(1).toLongLong() * (sysconf(_SC_PAGESIZE) / 1024);
+#else
+    return -1;
+#endif
+}
+
+/* Soveltaa listaan muokkauserän onnistuneet muutokset. Tyypit ovat samat kuin
+   TvkaistaClient::sendEditRequests-funktiossa. */
+static ProgrammeSnapshot applyEdits(const ProgrammeSnapshot &programmes, int type,
+                                    const QList<Programme> &edited, const QList<int> &failedIds)
+{
+    QSet<int> ids;
+    int count = edited.size();
+
+    for (int i = 0; i < count; i++) {
+        int id = type == 4 ? edited.at(i).seasonPassId : edited.at(i).id;
+
+        if (id >= 0 && !failedIds.contains(id)) {
+            ids.insert(id);
+        }
+    }
+
+    QList<Programme> result;
+    count = programmes.size();
+
+    if (type == 1 || type == 3) {
+        QSet<int> existing;
+
+        for (int i = 0; i < count; i++) {
+            result.append(programmes.at(i));
+            existing.insert(programmes.at(i).id);
+        }
+
+        for (int i = 0; i < edited.size(); i++) {
+            Programme programme = edited.at(i);
+
+            if (ids.contains(programme.id) && !existing.contains(programme.id)) {
+                /* Uuden sarjan tunniste saadaan vasta palvelimelta. */
+                if (type == 3) {
+                    programme.seasonPassId = -1;
+                }
+
+                result.append(programme);
+            }
+        }
+    }
+    else {
+        for (int i = 0; i < count; i++) {
+            const Programme &programme = programmes.at(i);
+            int id = type == 4 ? programme.seasonPassId : programme.id;
+
+            if (id < 0 || !ids.contains(id)) {
+                result.append(programme);
+            }
+        }
+    }
+
+    return ProgrammeSnapshot(result);
+}
 
 MainWindow::MainWindow(QWidget *parent) :
     QMainWindow(parent), ui(new Ui::MainWindow),
     m_settings(QSettings::IniFormat, QSettings::UserScope,
                    QCoreApplication::applicationName(),
                    QCoreApplication::applicationName()),
-    m_client(new TvkaistaClient(this)),
+    m_appSettings(new AppSettings(&m_settings, this)),
+    m_client(new TvkaistaClient(this)), m_syncEngine(new SyncEngine(m_client, this)),
     m_historyManager(new HistoryManager(&m_settings)),
-    m_downloadTableModel(new DownloadTableModel(&m_settings, this)),
+    m_downloadTableModel(new DownloadTableModel(m_appSettings, this)),
     m_programmeListTableModel(new ProgrammeTableModel(m_historyManager, false, this)),
     m_searchResultsTableModel(new ProgrammeTableModel(m_historyManager, true, this)),
     m_playlistTableModel(new ProgrammeTableModel(m_historyManager, true, this)),
     m_seasonPassesTableModel(new ProgrammeTableModel(m_historyManager, true, this)),
     m_currentTableModel(m_programmeListTableModel),
-    m_cache(new Cache), m_settingsDialog(0), m_screenshotWindow(0),
-    m_currentChannelId(-1), m_searchIcon(":/images/list-22x22.png"),
+    m_cache(new Cache), m_cacheMaintainer(new CacheMaintainer(this)),
+    m_startupLoader(new StartupLoader(this)),
+    m_programmeIndexLoader(new ProgrammeIndexLoader(m_cache, this)), m_streamServer(new StreamServer(this)),
+    m_prebufferSource(0), m_downloadSource(0), m_prebufferPending(false),
+    m_settingsDialog(0), m_screenshotWindow(0), m_epgGridWidget(0),
+    m_incrementalSearch(false), m_currentChannelId(-1), m_fetchChannelId(-1), m_searchIcon(":/images/list-22x22.png"),
     m_downloading(false), m_currentView(0)
 {
+    m_startupTimer.start();
     ui->setupUi(this);
     m_client->setCache(m_cache);
     m_downloadTableModel->setClient(m_client);
@@ -56,6 +156,7 @@ MainWindow::MainWindow(QWidget *parent) :
     ui->downloadsTableView->setContextMenuPolicy(Qt::ActionsContextMenu);
     ui->downloadsTableView->setItemDelegateForColumn(0, new DownloadDelegate(this));
     ui->downloadsTableView->viewport()->installEventFilter(this);
+    ui->channelListWidget->viewport()->installEventFilter(this);
     ui->programmeTableView->setModel(m_programmeListTableModel);
     ui->channelListWidget->addAction(ui->actionRefreshChannels);
     ui->channelListWidget->setContextMenuPolicy(Qt::ActionsContextMenu);
@@ -75,6 +176,19 @@ MainWindow::MainWindow(QWidget *parent) :
     m_posterTimer = new QTimer(this);
     m_posterTimer->setSingleShot(false);
     connect(m_posterTimer, SIGNAL(timeout()), SLOT(posterTimeout()));
+    m_resolveTimer = new QTimer(this);
+    m_resolveTimer->setSingleShot(true);
+    m_resolveTimer->setInterval(400);
+    connect(m_resolveTimer, SIGNAL(timeout()), SLOT(resolveTimeout()));
+    m_prebufferTimer = new QTimer(this);
+    m_prebufferTimer->setSingleShot(true);
+    m_prebufferTimer->setInterval(1500);
+    connect(m_prebufferTimer, SIGNAL(timeout()), SLOT(prebufferTimeout()));
+    m_searchTimer = new QTimer(this);
+    m_searchTimer->setSingleShot(true);
+    m_searchTimer->setInterval(400);
+    connect(m_searchTimer, SIGNAL(timeout()), SLOT(searchTimeout()));
+    connect(m_searchComboBox->lineEdit(), SIGNAL(textEdited(QString)), m_searchTimer, SLOT(start()));
     QAction *searchAction = new QAction(this);
     searchAction->setText(trUtf8("Hae"));
     m_searchToolButton = new QToolButton(this);
@@ -102,6 +216,11 @@ MainWindow::MainWindow(QWidget *parent) :
     painter.fillRect(m_noPosterImage.rect(), QBrush(ui->descriptionTextEdit->palette().color(QPalette::Base)));
     painter.end();
 
+    m_posterLoader = new PosterLoader(this);
+    m_posterLoader->setDisplaySize(m_noPosterImage.size());
+    m_posterLoader->setBackgroundColor(ui->descriptionTextEdit->palette().color(QPalette::Base));
+    connect(m_posterLoader, SIGNAL(posterLoaded(int,QImage)), SLOT(posterLoaded(int,QImage)));
+
     m_formatComboBox->addItems(videoFormats());
 
     ui->actionProgrammeList->setChecked(true);
@@ -153,6 +272,7 @@ MainWindow::MainWindow(QWidget *parent) :
     connect(ui->actionWatch, SIGNAL(triggered()), SLOT(watchProgramme()));    
     connect(ui->actionDownload, SIGNAL(triggered()), SLOT(downloadProgramme()));
     connect(ui->actionScreenshots, SIGNAL(triggered()), SLOT(openScreenshotWindow()));
+    connect(ui->actionEpgGrid, SIGNAL(triggered()), SLOT(openEpgGrid()));
     connect(ui->actionProgrammeList, SIGNAL(triggered()), SLOT(showProgrammeList()));
     connect(ui->actionProgrammeListButton, SIGNAL(triggered()), SLOT(showProgrammeList()));
     connect(ui->actionSearchResults, SIGNAL(triggered()), SLOT(showSearchResults()));
@@ -185,18 +305,28 @@ MainWindow::MainWindow(QWidget *parent) :
     connect(m_searchComboBox, SIGNAL(activated(QString)), SLOT(search()));
     connect(m_searchToolButton, SIGNAL(clicked()), SLOT(search()));
     connect(m_client, SIGNAL(channelsFetched(QList<Channel>)), SLOT(channelsFetched(QList<Channel>)));
-    connect(m_client, SIGNAL(programmesFetched(int,QDate,QList<Programme>)), SLOT(programmesFetched(int,QDate,QList<Programme>)));
-    connect(m_client, SIGNAL(posterFetched(Programme,QImage)), SLOT(posterFetched(Programme,QImage)));
+    connect(m_client, SIGNAL(programmesFetched(int,QDate,ProgrammeSnapshot)), SLOT(programmesFetched(int,QDate,ProgrammeSnapshot)));
+    connect(m_client, SIGNAL(posterFetched(Programme,QByteArray)), SLOT(posterFetched(Programme,QByteArray)));
     connect(m_client, SIGNAL(streamUrlFetched(Programme,int,QUrl)), SLOT(streamUrlFetched(Programme,int,QUrl)));
-    connect(m_client, SIGNAL(searchResultsFetched(QList<Programme>)), SLOT(searchResultsFetched(QList<Programme>)));
-    connect(m_client, SIGNAL(playlistFetched(QList<Programme>)), SLOT(playlistFetched(QList<Programme>)));
-    connect(m_client, SIGNAL(seasonPassListFetched(QList<Programme>)), SLOT(seasonPassListFetched(QList<Programme>)));
+    connect(m_client, SIGNAL(streamUrlResolved(int,int,QUrl)), SLOT(streamUrlResolved(int,int,QUrl)));
+    connect(m_client, SIGNAL(searchResultsFetched(ProgrammeSnapshot)), SLOT(searchResultsFetched(ProgrammeSnapshot)));
+    connect(m_client, SIGNAL(playlistFetched(ProgrammeSnapshot)), SLOT(playlistFetched(ProgrammeSnapshot)));
+    connect(m_client, SIGNAL(seasonPassListFetched(ProgrammeSnapshot)), SLOT(seasonPassListFetched(ProgrammeSnapshot)));
     connect(m_client, SIGNAL(seasonPassIndexFetched(QMap<QString,int>)), SLOT(seasonPassIndexFetched(QMap<QString,int>)));
-    connect(m_client, SIGNAL(editRequestFinished(int,bool)), SLOT(editRequestFinished(int, bool)));
+    connect(m_client, SIGNAL(editRequestsFinished(int,QList<int>)), SLOT(editRequestsFinished(int,QList<int>)));
     connect(m_client, SIGNAL(networkError()), SLOT(networkError()));
     connect(m_client, SIGNAL(loginError()), SLOT(loginError()));
     connect(m_client, SIGNAL(streamNotFound()), SLOT(streamNotFound()));
+    connect(m_appSettings, SIGNAL(fontSizeChanged(int)), SLOT(updateFontSize()));
+    connect(m_appSettings, SIGNAL(posterVisibleChanged(bool)), SLOT(programmeSelectionChanged()));
+    connect(m_appSettings, SIGNAL(prebufferChanged(bool)), SLOT(prebufferSettingChanged(bool)));
     connect(m_downloadTableModel, SIGNAL(downloadStatusChanged(int)), SLOT(downloadStatusChanged(int)));
+    connect(ui->downloadsDockWidget, SIGNAL(visibilityChanged(bool)), SLOT(updateDownloadProgressVisibility()));
+    connect(m_cacheMaintainer, SIGNAL(finished(qint64,int)), SLOT(cacheMaintenanceFinished()));
+    connect(m_cacheMaintainer, SIGNAL(posterPackRemoved(QString)), SLOT(posterPackRemoved(QString)));
+    connect(m_startupLoader, SIGNAL(historyLoaded()), SLOT(historyLoaded()));
+    connect(m_startupLoader, SIGNAL(downloadsLoaded()), SLOT(downloadsLoaded()));
+    connect(m_startupLoader, SIGNAL(channelsLoaded()), SLOT(channelsLoaded()));
 
     QAction *action = new QAction(this);
     action->setShortcut(Qt::Key_F2);
@@ -272,14 +402,17 @@ MainWindow::MainWindow(QWidget *parent) :
     int format = qBound(0, m_settings.value("format", 1).toInt(), videoFormats().size() - 1);
     m_client->setCookies(m_settings.value("cookies").toByteArray());
     m_client->setFormat(format);
-    m_client->setServer(m_settings.value("server").toString());
+    m_manualServer = m_settings.value("server").toString();
+    m_client->setServer(m_manualServer);
+    m_cacheMaintainer->setMaxSize(m_settings.value("cacheMaxSize", 500).toLongLong() * 1024 * 1024);
+    m_cacheMaintainer->setMaxAge(m_settings.value("cacheMaxAge", 90).toInt());
     m_settings.endGroup();
 
     m_cache->setDirectory(QDir(cacheDirPath));
+    m_cacheMaintainer->setDirectory(QDir(cacheDirPath));
     m_formatComboBox->setCurrentIndex(format);
     loadClientSettings();
     setFormat(format);
-    m_historyManager->load();
 
     m_settings.beginGroup("mainWindow");
     restoreGeometry(m_settings.value("geometry").toByteArray());
@@ -289,7 +422,6 @@ MainWindow::MainWindow(QWidget *parent) :
         ui->splitter->setSizes(QList<int>() << 450 << 150);
     }
 
-    int cid = m_settings.value("channel").toInt();
     int phraseCount = m_settings.beginReadArray("searchHistory");
 
     for (int i = 0; i < phraseCount; i++) {
@@ -305,6 +437,7 @@ MainWindow::MainWindow(QWidget *parent) :
     setSortKeyToModel(m_settings.value("sortSeasonPasses").toString(), m_seasonPassesTableModel);
     m_settings.endGroup();
 
+    m_serverProber = new ServerProber(&m_settings, m_client, this);
     m_serverSignalMapper = new QSignalMapper(this);
     connect(m_serverSignalMapper, SIGNAL(mapped(int)), SLOT(setCurrentServer(int)));
     addServer(trUtf8("Suomi"), "");
@@ -312,6 +445,22 @@ MainWindow::MainWindow(QWidget *parent) :
     addServer(trUtf8("Ranska"), "721600");
     addServer(trUtf8("Saksa"), "8031916+6913675");
     addServer(trUtf8("Yhdysvallat"), "7064662+909967");
+    m_serverProber->load();
+
+    m_autoServerAction = new QAction(trUtf8("&Automaattinen"), this);
+    m_autoServerAction->setCheckable(true);
+    connect(m_autoServerAction, SIGNAL(triggered(bool)), SLOT(setAutomaticServer(bool)));
+    ui->menuServer->addSeparator();
+    ui->menuServer->addAction(m_autoServerAction);
+
+    m_settings.beginGroup("client");
+
+    if (m_settings.value("autoServer", false).toBool()) {
+        m_autoServerAction->setChecked(true);
+        setAutomaticServer(true);
+    }
+
+    m_settings.endGroup();
 
     QString version = m_settings.value("version").toString();
 
@@ -322,40 +471,25 @@ MainWindow::MainWindow(QWidget *parent) :
         m_settings.setValue("stream", addDefaultOptionsToVlcCommand(m_settings.value("stream").toString()));
         m_settings.setValue("file", addDefaultOptionsToVlcCommand(m_settings.value("file").toString()));
         m_settings.endGroup();
+        m_appSettings->load();
     }
 
     m_currentDate = QDate::currentDate();
-    fetchChannels(false);
-    int channelCount = m_channels.size();
-
-    for (int i = 0; i < channelCount; i++) {
-        if (m_channels.at(i).id == cid) {
-            ui->channelListWidget->setCurrentIndex(ui->channelListWidget->model()->index(i, 0, QModelIndex()));
-            m_currentChannelId = cid;
-            break;
-        }
-    }
-
-    if (m_currentChannelId < 0 && !m_channels.isEmpty()) {
-        fetchProgrammes(m_channels.at(0).id, QDate::currentDate(), false);
-    }
-
-    m_downloadTableModel->load();
-    int downloadCount = m_downloadTableModel->rowCount(QModelIndex());
-
-    if (downloadCount > 0) {
-        ui->downloadsTableView->scrollToBottom();
-        ui->downloadsTableView->resizeColumnToContents(0);
-        ui->downloadsTableView->resizeRowsToContents();
-        ui->downloadsTableView->selectRow(downloadCount - 1);
-    }
-
     downloadSelectionChanged();
     updateCalendar();
 
+    /* Tiedostot luetaan taustalla, jotta ikkuna tulee näkyviin heti. */
+    m_startupLoader->start(m_historyManager->filename(), m_downloadTableModel->filename(),
+                           m_cache->directory());
+    qDebug() << "Startup: window" << m_startupTimer.elapsed() << "ms";
+
     if (!m_client->isValidUsernameAndPassword()) {
         QTimer::singleShot(0, this, SLOT(openSettingsDialog()));
     }
+
+    /* Välimuistin siivous käynnistyy vasta, kun ohjelma on ehtinyt käynnistyä. */
+    QTimer::singleShot(60 * 1000, m_cacheMaintainer, SLOT(start()));
+    m_syncEngine->start();
 }
 
 MainWindow::~MainWindow()
@@ -405,7 +539,11 @@ void MainWindow::closeEvent(QCloseEvent *e)
     m_settings.beginGroup("client");
     m_settings.setValue("cookies", m_client->cookies());
     m_settings.setValue("format", m_formatComboBox->currentIndex());
-    m_settings.setValue("server", m_client->server());
+    m_settings.setValue("autoServer", m_serverProber->isEnabled());
+
+    /* Automaattinen valinta ei korvaa käyttäjän valitsemaa palvelinta. */
+    m_settings.setValue("server", m_manualServer);
+
     m_settings.endGroup();
 
     m_downloadTableModel->abortAllDownloads();
@@ -424,9 +562,30 @@ bool MainWindow::eventFilter(QObject *object, QEvent *event)
         }
     }
 
+    if (object == ui->channelListWidget->viewport() && event->type() == QEvent::ToolTip) {
+        QHelpEvent *helpEvent = static_cast<QHelpEvent*>(event);
+        int row = ui->channelListWidget->indexAt(helpEvent->pos()).row();
+
+        if (row >= 0 && row < m_channels.size()) {
+            QToolTip::showText(helpEvent->globalPos(), nowAndNextText(m_channels.at(row).id),
+                               ui->channelListWidget->viewport());
+        }
+
+        return true;
+    }
+
     return QMainWindow::eventFilter(object, event);
 }
 
+void MainWindow::changeEvent(QEvent *e)
+{
+    if (e->type() == QEvent::WindowStateChange) {
+        updateDownloadProgressVisibility();
+    }
+
+    QMainWindow::changeEvent(e);
+}
+
 void MainWindow::dateClicked(const QDate &date)
 {
     fetchProgrammes(m_currentChannelId, date, false);
@@ -443,11 +602,7 @@ void MainWindow::channelClicked(int index)
 
 void MainWindow::programmeDoubleClicked()
 {
-    m_settings.beginGroup("mainWindow");
-    bool download = m_settings.value("doubleClick").toString() == "download";
-    m_settings.endGroup();
-
-    if (download) {
+    if (m_appSettings->isDoubleClickDownload()) {
         downloadProgramme();
     }
     else {
@@ -463,28 +618,48 @@ void MainWindow::programmeSelectionChanged()
         return;
     }
 
-    m_currentProgramme = m_currentTableModel->programme(rows.at(0).row());
-    m_settings.beginGroup("mainWindow");
-    bool posterVisible = m_settings.value("posterVisible", true).toBool();
-    m_settings.endGroup();
+    /* Monivalinnassa kuvaus näytetään kohdistetusta rivistä. */
+    QItemSelectionModel *selectionModel = ui->programmeTableView->selectionModel();
+    int row = rows.at(0).row();
+
+    if (selectionModel->isRowSelected(selectionModel->currentIndex().row(), QModelIndex())) {
+        row = selectionModel->currentIndex().row();
+    }
+
+    m_currentProgramme = m_currentTableModel->programme(row);
+
+    if (m_currentProgramme.descriptionInCache) {
+        m_currentProgramme.description = m_cache->loadDescription(m_currentProgramme);
+        m_currentProgramme.descriptionInCache = false;
+    }
+
+    bool posterVisible = m_appSettings->isPosterVisible();
     m_posterImage = m_noPosterImage;
     m_posterTimer->stop();
+    m_posterLoader->setCurrentProgrammeId(-1);
 
     if (m_currentProgramme.id >= 0 && (m_currentProgramme.flags & 0x08) == 0 && posterVisible) {
-        if (m_client->isRequestUnfinished()) {
-            m_posterTimer->start(500);
-        }
-        else {
-            fetchPoster();
-        }
+        m_posterLoader->setCurrentProgrammeId(m_currentProgramme.id);
+        fetchPoster();
+    }
+
+    /* Videon osoite selvitetään ennakkoon, kun valinta on pysynyt hetken paikallaan. */
+    m_resolveTimer->start();
+    m_prebufferPending = false;
+
+    if (m_prebufferSource != 0 && m_prebufferSource->programmeId() != m_currentProgramme.id) {
+        discardPrebuffer();
     }
 
+    m_prebufferTimer->start();
+
     /* Ohjelmaa ei voi poistaa sarjoista, jos season pass id:tä ei ole haettu. */
-    bool enabled = m_currentView != 3 || (m_currentView == 3 && m_currentProgramme.seasonPassId >= 0);
+    bool enabled = (m_currentView != 3 || m_currentProgramme.seasonPassId >= 0) && !m_client->hasPendingEdits(3);
     ui->addToSeasonPassPushButton->setEnabled(enabled);
     ui->actionAddToSeasonPass->setEnabled(enabled);
-    ui->addToPlaylistPushButton->setEnabled(true);
-    ui->actionAddToPlaylist->setEnabled(true);
+    enabled = !m_client->hasPendingEdits(1);
+    ui->addToPlaylistPushButton->setEnabled(enabled);
+    ui->actionAddToPlaylist->setEnabled(enabled);
     updateDescription();
 }
 
@@ -582,7 +757,7 @@ void MainWindow::refreshProgrammes()
     m_lastRefreshTime = now;
 
     if (m_currentView == 1) {
-        fetchSearchResults(m_searchPhrase);
+        fetchSearchResults(m_searchPhrase, true);
     }
     else if (m_currentView == 2) {
         fetchPlaylist(true);
@@ -626,7 +801,15 @@ void MainWindow::watchProgramme()
         return;
     }
 
+    /* Kesken oleva lataus katsotaan paikallisen palvelimen kautta, ettei samaa ohjelmaa siirretä kahdesti. */
+    int row = m_downloadTableModel->findDownload(m_currentProgramme.id);
+
+    if (row >= 0 && m_downloadTableModel->status(row) == 0 && playDownloadInProgress(row)) {
+        return;
+    }
+
     m_downloading = false;
+    selectServer(0);
     m_client->sendStreamRequest(m_currentProgramme);
     startLoadingAnimation();
 }
@@ -639,6 +822,7 @@ void MainWindow::downloadProgramme()
     }
 
     m_downloading = true;
+    selectServer(1);
     m_client->sendStreamRequest(m_currentProgramme);
     startLoadingAnimation();
 }
@@ -656,8 +840,10 @@ void MainWindow::openScreenshotWindow()
     }
 
     if (m_screenshotWindow == 0) {
-        m_screenshotWindow = new ScreenshotWindow(&m_settings, this);
+        m_screenshotWindow = new ScreenshotWindow(m_appSettings, this);
         m_screenshotWindow->setClient(m_client);
+        connect(m_screenshotWindow, SIGNAL(screenshotActivated(Programme,int)),
+                SLOT(playFromScreenshot(Programme,int)));
     }
     else {
         m_screenshotWindow->activateWindow();
@@ -667,6 +853,39 @@ void MainWindow::openScreenshotWindow()
     m_screenshotWindow->show();
 }
 
+void MainWindow::openEpgGrid()
+{
+    if (m_epgGridWidget == 0) {
+        m_epgGridWidget = new EpgGridWidget(m_cache, m_client, this);
+        m_epgGridWidget->setChannels(m_channels);
+        connect(m_epgGridWidget, SIGNAL(programmeActivated(Programme)), SLOT(epgProgrammeActivated(Programme)));
+    }
+    else {
+        m_epgGridWidget->activateWindow();
+    }
+
+    m_epgGridWidget->setDate(m_currentDate.isValid() ? m_currentDate : QDate::currentDate());
+    m_epgGridWidget->show();
+}
+
+void MainWindow::epgProgrammeActivated(const Programme &programme)
+{
+    int count = m_channels.size();
+    m_currentDate = m_epgGridWidget->date();
+
+    for (int i = 0; i < count; i++) {
+        if (m_channels.at(i).id == programme.channelId && ui->channelListWidget->currentRow() != i) {
+            /* Kanavan vaihto hakee ohjelmat valitulle päivälle. */
+            ui->channelListWidget->setCurrentRow(i);
+            activateWindow();
+            return;
+        }
+    }
+
+    fetchProgrammes(programme.channelId, m_currentDate, false);
+    activateWindow();
+}
+
 void MainWindow::openSettingsDialog()
 {
     if (m_settingsDialog != 0) {
@@ -682,8 +901,8 @@ void MainWindow::openSettingsDialog()
 
 void MainWindow::settingsAccepted()
 {
+    m_appSettings->load();
     loadClientSettings();
-    updateFontSize();
 
     if (m_channels.isEmpty() || m_settingsDialog->isUsernameChanged()) {
         /* Tyhjennetään evästeet, jos käyttäjänimi on vaihtunut. */
@@ -747,9 +966,7 @@ void MainWindow::removeDownload()
         return;
     }
 
-    m_settings.beginGroup("mainWindow");
-    bool deleteFromDisk = m_settings.value("deleteFromDisk", false).toBool();
-    m_settings.endGroup();
+    bool deleteFromDisk = m_appSettings->isDeleteFromDisk();
 
     if (deleteFromDisk) {
         QString text;
@@ -790,6 +1007,8 @@ void MainWindow::removeDownload()
             if (file.exists() && !file.remove()) {
                 qWarning() << file.errorString();
             }
+
+            QFile::remove(TsValidator::indexFilename(filename));
         }
     }
 
@@ -810,12 +1029,15 @@ void MainWindow::playDownloadedFile()
     }
 
     int row = indexes.at(0).row();
+
+    if (m_downloadTableModel->status(row) == 0 && playDownloadInProgress(row)) {
+        return;
+    }
+
     addHistoryEntry(m_downloadTableModel->programmeId(row));
     QString filename = QDir::toNativeSeparators(m_downloadTableModel->filename(row));
     int format = m_downloadTableModel->videoFormat(row);
-    m_settings.beginGroup("mediaPlayer");
-    QString command = m_settings.value("file").toString();
-    m_settings.endGroup();
+    QString command = m_appSettings->filePlayerCommand();
 
     if (command.isEmpty()) {
         command = defaultFilePlayerCommand();
@@ -844,6 +1066,8 @@ void MainWindow::openDirectory()
 
 void MainWindow::search()
 {
+    m_searchTimer->stop();
+    m_incrementalSearch = false;
     QString phrase = m_searchComboBox->currentText().trimmed();
     m_searchHistory.removeAll(phrase);
     m_searchHistory.prepend(phrase);
@@ -860,8 +1084,21 @@ void MainWindow::search()
         refreshProgrammes();
     }
     else {
-        fetchSearchResults(phrase);
+        fetchSearchResults(phrase, false);
+    }
+}
+
+void MainWindow::searchTimeout()
+{
+    QString phrase = m_searchComboBox->currentText().trimmed();
+
+    /* Kirjoitettaessa haetaan vasta kolmesta merkistä alkaen. */
+    if (phrase.length() < 3 || phrase == m_searchPhrase) {
+        return;
     }
+
+    m_incrementalSearch = true;
+    fetchSearchResults(phrase, false);
 }
 
 void MainWindow::clearSearchHistory()
@@ -1047,41 +1284,128 @@ void MainWindow::setFocusToDownloadsList()
 
 void MainWindow::addToPlaylist()
 {
-    if (m_currentProgramme.id < 0) {
+    if (m_client->hasPendingEdits(1)) {
         return;
     }
 
-    if (m_currentView == 2) {
-        m_client->sendPlaylistRemoveRequest(m_currentProgramme.id);
-        m_playlistTableModel->setRemovedByProgrammeId(m_currentProgramme.id);
-    }
-    else {
-        m_client->sendPlaylistAddRequest(m_currentProgramme.id);
-    }
-
+    sendEdits(m_currentView == 2 ? 2 : 1, selectedProgrammes());
     ui->addToPlaylistPushButton->setEnabled(false);
     ui->actionAddToPlaylist->setEnabled(false);
-    m_cache->removePlaylist();
-    startLoadingAnimation();
 }
 
 void MainWindow::addToSeasonPass()
 {
-    if (m_currentProgramme.id < 0) {
+    if (m_client->hasPendingEdits(3)) {
         return;
     }
 
-    if (m_currentView == 3) {
-        m_client->sendSeasonPassRemoveRequest(m_currentProgramme.seasonPassId);
-        m_seasonPassesTableModel->setRemovedBySeasonPassId(m_currentProgramme.seasonPassId);
+    sendEdits(m_currentView == 3 ? 4 : 3, selectedProgrammes());
+    ui->addToSeasonPassPushButton->setEnabled(false);
+    ui->actionAddToSeasonPass->setEnabled(false);
+}
+
+QList<Programme> MainWindow::selectedProgrammes() const
+{
+    QList<Programme> programmes;
+
+    if (m_currentTableModel->programmeCount() == 0) {
+        return programmes;
+    }
+
+    QModelIndexList indexes = ui->programmeTableView->selectionModel()->selectedRows(0);
+    QList<int> rows;
+    int count = indexes.size();
+
+    for (int i = 0; i < count; i++) {
+        rows.append(indexes.at(i).row());
+    }
+
+    qSort(rows);
+    count = rows.size();
+
+    for (int i = 0; i < count; i++) {
+        Programme programme = m_currentTableModel->programme(rows.at(i));
+
+        if (programme.id >= 0) {
+            programmes.append(programme);
+        }
+    }
+
+    return programmes;
+}
+
+void MainWindow::sendEdits(int type, const QList<Programme> &programmes)
+{
+    int list = type <= 2 ? 0 : 1;
+    QList<int> ids;
+    int count = programmes.size();
+
+    for (int i = 0; i < count; i++) {
+        int id = type == 4 ? programmes.at(i).seasonPassId : programmes.at(i).id;
+
+        if (id >= 0 && !ids.contains(id)) {
+            ids.append(id);
+        }
+    }
+
+    if (ids.isEmpty()) {
+        return;
+    }
+
+    /* Lista päivitetään heti ennen palvelimen vastausta. Pohjana on välimuistin
+       lista, jotta muutos ei korvaa listaa, jota ei ole vielä näytetty. */
+    ProgrammeTableModel *model = list == 0 ? m_playlistTableModel : m_seasonPassesTableModel;
+    bool ok;
+    int age;
+    ProgrammeSnapshot base = list == 0 ? m_cache->loadPlaylist(ok, age) : m_cache->loadSeasonPasses(ok, age);
+
+    if (!ok) {
+        base = model->programmes();
+    }
+
+    PendingEdit &edit = m_pendingEdits[list];
+    edit.type = type;
+    edit.backup = base;
+    edit.programmes = programmes;
+    edit.baseKnown = ok || model->programmeCount() > 0;
+    ProgrammeSnapshot programmesAfter = applyEdits(base, type, programmes, QList<int>());
+
+    /* Poistettavat rivit näytetään harmaina, kunnes palvelin on vastannut. */
+    if (type == 2 || type == 4) {
+        for (int i = 0; i < ids.size(); i++) {
+            if (type == 2) {
+                model->setRemovedByProgrammeId(ids.at(i));
+            }
+            else {
+                model->setRemovedBySeasonPassId(ids.at(i));
+            }
+        }
+    }
+    else if (edit.baseKnown) {
+        if (list == 0) {
+            updatePlaylist(programmesAfter);
+        }
+        else {
+            updateSeasonPasses(programmesAfter);
+        }
+    }
+
+    if (!edit.baseKnown) {
+        if (list == 0) {
+            m_cache->removePlaylist();
+        }
+        else {
+            m_cache->removeSeasonPasses();
+        }
+    }
+    else if (list == 0) {
+        m_cache->savePlaylist(QDateTime::currentDateTime(), programmesAfter);
     }
     else {
-        m_client->sendSeasonPassAddRequest(m_currentProgramme.id);
+        m_cache->saveSeasonPasses(QDateTime::currentDateTime(), programmesAfter);
     }
 
-    ui->addToSeasonPassPushButton->setEnabled(false);
-    ui->actionAddToSeasonPass->setEnabled(false);
-    m_cache->removeSeasonPasses();
+    m_client->sendEditRequests(type, ids);
     startLoadingAnimation();
 }
 
@@ -1181,22 +1505,77 @@ void MainWindow::setCurrentServer(int index)
         action->setChecked(index == i);
     }
 
-    m_client->setServer(m_serverActions.at(index)->data().toString());
+    m_autoServerAction->setChecked(false);
+    m_serverProber->setEnabled(false);
+    m_manualServer = m_serverActions.at(index)->data().toString();
+    m_client->setServer(m_manualServer);
+}
+
+void MainWindow::setAutomaticServer(bool enabled)
+{
+    int count = m_serverActions.size();
+
+    if (!enabled) {
+        int index = 0;
+
+        /* Palataan käyttäjän itse valitsemaan palvelimeen. */
+        for (int i = 0; i < count; i++) {
+            if (m_serverActions.at(i)->data().toString() == m_manualServer) {
+                index = i;
+                break;
+            }
+        }
+
+        setCurrentServer(index);
+        return;
+    }
+
+    for (int i = 0; i < count; i++) {
+        m_serverActions.at(i)->setChecked(false);
+    }
+
+    m_serverProber->setEnabled(true);
 }
 
 void MainWindow::channelsFetched(const QList<Channel> &channels)
 {
-    m_channels = channels;
     stopLoadingAnimation();
+
+    if (!m_syncEngine->contentChanged(channels)) {
+        return;
+    }
+
+    m_channels = channels;
     updateChannelList();
 
+    if (m_epgGridWidget != 0) {
+        m_epgGridWidget->setChannels(m_channels);
+    }
+
     if (!m_channels.isEmpty()) {
-        ui->channelListWidget->setCurrentIndex(ui->channelListWidget->model()->index(0, 0, QModelIndex()));
+        int row = 0;
+        int count = m_channels.size();
+
+        /* Taustapäivitys ei saa vaihtaa valittua kanavaa. */
+        for (int i = 0; i < count; i++) {
+            if (m_channels.at(i).id == m_currentChannelId) {
+                row = i;
+                break;
+            }
+        }
+
+        ui->channelListWidget->setCurrentIndex(ui->channelListWidget->model()->index(row, 0, QModelIndex()));
     }
 }
 
-void MainWindow::programmesFetched(int channelId, const QDate &date, const QList<Programme> &programmes)
+void MainWindow::programmesFetched(int channelId, const QDate &date, const ProgrammeSnapshot &programmes)
 {
+    /* Ohjelmakartan taustahaut eivät vaihda näkyvää kanavaa. */
+    if (channelId != m_fetchChannelId || date != m_fetchDate) {
+        return;
+    }
+
+    m_fetchChannelId = -1;
     m_currentChannelId = channelId;
     m_currentDate = date;
     setCurrentView(0);
@@ -1208,6 +1587,8 @@ void MainWindow::programmesFetched(int channelId, const QDate &date, const QList
         m_programmeListTableModel->setProgrammes(programmes);
     }
 
+    qDebug() << "Programmes" << channelId << date.toString(Qt::ISODate) << programmes.size()
+             << "resident" << residentMemorySize() << "kB";
     stopLoadingAnimation();
     updateColumnSizes();
     updateWindowTitle();
@@ -1215,14 +1596,22 @@ void MainWindow::programmesFetched(int channelId, const QDate &date, const QList
     scrollProgrammes();
 }
 
-void MainWindow::posterFetched(const Programme &programme, const QImage &poster)
+void MainWindow::posterFetched(const Programme &programme, const QByteArray &data)
 {
     if (m_currentProgramme.id != programme.id) {
         return;
     }
 
+    m_posterLoader->load(programme.id, data);
+}
+
+void MainWindow::posterLoaded(int programmeId, const QImage &poster)
+{
+    if (m_currentProgramme.id != programmeId) {
+        return;
+    }
+
     m_posterImage = poster;
-    addBorderToPoster();
     updateDescription();
 }
 
@@ -1230,6 +1619,11 @@ void MainWindow::streamUrlFetched(const Programme &programme, int format, const
 {
     stopLoadingAnimation();
 
+    /* Palvelinten mittaukset tehdään viimeksi haetulla ohjelmalla. */
+    if (!url.path().startsWith("/login")) {
+        m_serverProber->setProbeProgramme(programme.id);
+    }
+
     if (m_downloading) {
         int row = m_downloadTableModel->download(
                 programme, format, m_channelMap.value(programme.channelId), url);
@@ -1240,19 +1634,24 @@ void MainWindow::streamUrlFetched(const Programme &programme, int format, const
     }
     else {
         addHistoryEntry(programme.id);
-        m_settings.beginGroup("mediaPlayer");
-        QString command = m_settings.value("stream").toString();
-        m_settings.endGroup();
+        QString command = m_appSettings->streamPlayerCommand();
 
         if (command.isEmpty()) {
             command = defaultStreamPlayerCommand();
         }
 
+        /* Soitin saa valmiiksi puskuroidun alun paikalliselta palvelimelta. */
+        if (m_prebufferSource != 0 && m_prebufferSource->programmeId() == programme.id &&
+                m_prebufferSource->format() == format && !m_prebufferSource->hasError()) {
+            startMediaPlayer(command, QString::fromLatin1(m_streamServer->sourceUrl(m_prebufferSource).toEncoded()), format);
+            return;
+        }
+
         startMediaPlayer(command, url.toString(), format);
     }
 }
 
-void MainWindow::searchResultsFetched(const QList<Programme> &programmes)
+void MainWindow::searchResultsFetched(const ProgrammeSnapshot &programmes)
 {
     if (programmes.isEmpty()) {
         m_searchResultsTableModel->setInfoText(trUtf8("Ei hakutuloksia"));
@@ -1261,25 +1660,45 @@ void MainWindow::searchResultsFetched(const QList<Programme> &programmes)
         m_searchResultsTableModel->setProgrammes(programmes);
         updateColumnSizes();
         updateWindowTitle();
-        ui->programmeTableView->setFocus();
+
+        /* Kirjoittamisen aikana fokus jätetään hakukenttään. */
+        if (!m_incrementalSearch) {
+            ui->programmeTableView->setFocus();
+        }
+
         scrollProgrammes();
     }
 
     stopLoadingAnimation();
 }
 
-void MainWindow::playlistFetched(const QList<Programme> &programmes)
+void MainWindow::playlistFetched(const ProgrammeSnapshot &programmes)
 {
-    updatePlaylist(programmes);
+    if (m_syncEngine->contentChanged(0, programmes)) {
+        updatePlaylist(programmes);
+    }
+
     stopLoadingAnimation();
 }
 
-void MainWindow::seasonPassListFetched(const QList<Programme> &programmes)
+void MainWindow::seasonPassListFetched(const ProgrammeSnapshot &programmes)
 {
+    if (!m_syncEngine->contentChanged(1, programmes)) {
+        /* Asiakas tallensi listan ilman sarjojen tunnisteita, joten tallennetaan ne takaisin. */
+        m_cache->saveSeasonPasses(QDateTime::currentDateTime(), m_seasonPassesTableModel->programmes());
+        stopLoadingAnimation();
+        return;
+    }
+
     updateSeasonPasses(programmes);
 
     if (m_client->isValidUsernameAndPassword()) {
+        bool background = m_client->isBackgroundResult();
         m_client->sendSeasonPassIndexRequest();
+
+        if (background) {
+            m_client->markBackgroundRequest();
+        }
     }
     else {
         stopLoadingAnimation();
@@ -1298,59 +1717,65 @@ void MainWindow::seasonPassIndexFetched(const QMap<QString, int> &seasonPasses)
     stopLoadingAnimation();
 }
 
-void MainWindow::editRequestFinished(int type, bool ok)
+void MainWindow::editRequestsFinished(int type, const QList<int> &failedIds)
 {
-    QString text;
+    int list = type <= 2 ? 0 : 1;
+    PendingEdit &edit = m_pendingEdits[list];
+    stopLoadingAnimation();
 
-    if (type == 1) { /* Ohjelma lisätty listaan. */
-        if (ok) {
-            fetchPlaylist(true);
-            text = trUtf8("Ohjelma on lisätty katselulistaan.");
-        }
-        else {
-            stopLoadingAnimation();
-            text = trUtf8("Ohjelma on jo aiemmin lisätty katselulistaan.");
-        }
-    }
-    else if (type == 2) { /* Ohjelma poistettu listasta. */
-        if (ok) {
-            fetchPlaylist(true);
-            text = trUtf8("Ohjelma on poistettu katselulistasta.");
+    /* Epäonnistuneet muutokset perutaan, ja onnistuneet jäävät voimaan siihen asti,
+       kunnes lopullinen tila on haettu palvelimelta. */
+    if (edit.type == type && edit.baseKnown) {
+        ProgrammeSnapshot programmes = applyEdits(edit.backup, type, edit.programmes, failedIds);
+        QDateTime now = QDateTime::currentDateTime();
+
+        if (list == 0) {
+            updatePlaylist(programmes);
+            m_cache->savePlaylist(now, programmes);
         }
         else {
-            stopLoadingAnimation();
-            text = trUtf8("Ohjelman poistaminen epäonnistui.");
+            updateSeasonPasses(programmes);
+            m_cache->saveSeasonPasses(now, programmes);
         }
     }
-    else if (type == 3) { /* Ohjelma lisätty sarjoihin. */
-        if (ok) {
-            fetchSeasonPasses(true);
-            text = trUtf8("Ohjelma on lisätty suosikkisarjoihin.");
+    else if (!failedIds.isEmpty()) {
+        if (list == 0) {
+            m_cache->removePlaylist();
         }
         else {
-            stopLoadingAnimation();
-            text = trUtf8("Ohjelma on jo aiemmin lisätty suosikkisarjoihin.");
+            m_cache->removeSeasonPasses();
         }
     }
-    else if (type == 4) { /* Ohjelma poistettu sarjoista. */
-        if (ok) {
-            fetchSeasonPasses(true);
-            text = trUtf8("Ohjelma on poistettu suosikkisarjoista.");
-        }
-        else {
-            stopLoadingAnimation();
-            text = trUtf8("Ohjelman poistaminen epäonnistui.");
-        }
+
+    edit = PendingEdit();
+    m_syncEngine->requestRefresh(list);
+    programmeSelectionChanged();
+
+    if (failedIds.isEmpty()) {
+        return;
     }
 
-    if (!text.isEmpty()) {
-        QMessageBox msgBox(this);
-        msgBox.setWindowTitle(windowTitle());
-        msgBox.setIcon(QMessageBox::Information);
-        msgBox.setText(text);
-        msgBox.setStandardButtons(QMessageBox::Ok);
-        msgBox.exec();
+    QString text;
+
+    if (type == 1) {
+        text = trUtf8("%1 ohjelman lisääminen katselulistaan epäonnistui.");
+    }
+    else if (type == 2) {
+        text = trUtf8("%1 ohjelman poistaminen katselulistasta epäonnistui.");
+    }
+    else if (type == 3) {
+        text = trUtf8("%1 ohjelman lisääminen suosikkisarjoihin epäonnistui.");
+    }
+    else {
+        text = trUtf8("%1 sarjan poistaminen suosikkisarjoista epäonnistui.");
     }
+
+    QMessageBox msgBox(this);
+    msgBox.setWindowTitle(windowTitle());
+    msgBox.setIcon(QMessageBox::Warning);
+    msgBox.setText(text.arg(failedIds.size()));
+    msgBox.setStandardButtons(QMessageBox::Ok);
+    msgBox.exec();
 }
 
 void MainWindow::posterTimeout()
@@ -1366,6 +1791,138 @@ void MainWindow::posterTimeout()
     }
 }
 
+void MainWindow::resolveTimeout()
+{
+    if (m_currentProgramme.id >= 0 && (m_currentProgramme.flags & 0x08) == 0 &&
+            m_client->isValidUsernameAndPassword()) {
+        selectServer(0);
+        m_client->resolveStreamUrl(m_currentProgramme);
+    }
+}
+
+void MainWindow::prebufferTimeout()
+{
+    bool prebuffer = m_appSettings->isPrebufferEnabled();
+    int format = m_client->format();
+
+    if (m_prebufferSource != 0 && m_prebufferSource->format() != format) {
+        discardPrebuffer();
+    }
+
+    /* Flash-videota ei toisteta VLC:llä, ja kesken oleva lataus toistetaan tiedostosta. */
+    if (!prebuffer || m_currentProgramme.id < 0 || (m_currentProgramme.flags & 0x08) != 0 ||
+            format == 1 || m_prebufferSource != 0 || !m_client->isValidUsernameAndPassword() ||
+            m_downloadTableModel->findDownload(m_currentProgramme.id) >= 0) {
+        return;
+    }
+
+    QUrl url = m_client->cachedStreamUrl(m_currentProgramme.id, format);
+
+    if (url.isValid()) {
+        startPrebuffer(url);
+    }
+    else {
+        m_prebufferPending = true;
+        selectServer(0);
+        m_client->resolveStreamUrl(m_currentProgramme);
+    }
+}
+
+void MainWindow::prebufferSettingChanged(bool enabled)
+{
+    if (!enabled && m_prebufferSource != 0) {
+        discardPrebuffer();
+    }
+    else if (enabled) {
+        m_prebufferTimer->start();
+    }
+}
+
+void MainWindow::streamUrlResolved(int programmeId, int format, const QUrl &url)
+{
+    if (m_prebufferPending && programmeId == m_currentProgramme.id && format == m_client->format()) {
+        m_prebufferPending = false;
+        startPrebuffer(url);
+    }
+}
+
+void MainWindow::cacheMaintenanceFinished()
+{
+    m_cache->compactPosters();
+}
+
+void MainWindow::posterPackRemoved(const QString &month)
+{
+    m_cache->closePosterPack(month);
+}
+
+void MainWindow::updateDownloadProgressVisibility()
+{
+    m_downloadTableModel->setProgressVisible(!isMinimized() && ui->downloadsDockWidget->isVisible());
+}
+
+void MainWindow::historyLoaded()
+{
+    m_historyManager->setEntries(m_startupLoader->historyEntries());
+    m_currentTableModel->updateHistory();
+    qDebug() << "Startup: history ready" << m_startupTimer.elapsed() << "ms";
+}
+
+void MainWindow::downloadsLoaded()
+{
+    m_downloadTableModel->setDownloads(m_startupLoader->downloads());
+    int downloadCount = m_downloadTableModel->rowCount(QModelIndex());
+
+    if (downloadCount > 0) {
+        ui->downloadsTableView->scrollToBottom();
+        ui->downloadsTableView->resizeColumnToContents(0);
+        ui->downloadsTableView->resizeRowsToContents();
+        ui->downloadsTableView->selectRow(downloadCount - 1);
+    }
+
+    downloadSelectionChanged();
+    qDebug() << "Startup: downloads ready" << m_startupTimer.elapsed() << "ms";
+}
+
+void MainWindow::channelsLoaded()
+{
+    /* Kanavat on voitu jo hakea palvelimelta asetusdialogin kautta. */
+    if (!m_channels.isEmpty()) {
+        return;
+    }
+
+    if (!m_startupLoader->hasChannels()) {
+        fetchChannels(true);
+        return;
+    }
+
+    m_channels = m_startupLoader->channels();
+    updateChannelList();
+
+    if (m_epgGridWidget != 0) {
+        m_epgGridWidget->setChannels(m_channels);
+    }
+
+    m_settings.beginGroup("mainWindow");
+    int cid = m_settings.value("channel").toInt();
+    m_settings.endGroup();
+    int channelCount = m_channels.size();
+
+    for (int i = 0; i < channelCount; i++) {
+        if (m_channels.at(i).id == cid) {
+            ui->channelListWidget->setCurrentIndex(ui->channelListWidget->model()->index(i, 0, QModelIndex()));
+            m_currentChannelId = cid;
+            break;
+        }
+    }
+
+    if (m_currentChannelId < 0 && !m_channels.isEmpty()) {
+        fetchProgrammes(m_channels.at(0).id, QDate::currentDate(), false);
+    }
+
+    qDebug() << "Startup: channels ready" << m_startupTimer.elapsed() << "ms";
+}
+
 void MainWindow::downloadStatusChanged(int index)
 {
     Q_UNUSED(index);
@@ -1435,7 +1992,7 @@ void MainWindow::fetchProgrammes(int channelId, const QDate &date, bool refresh)
 
     bool ok;
     int age;
-    QList<Programme> programmes = m_cache->loadProgrammes(channelId, date, ok, age);
+    ProgrammeSnapshot programmes = m_cache->loadProgrammes(channelId, date, ok, age);
 
     if (programmes.isEmpty()) {
         ok = false;
@@ -1450,6 +2007,8 @@ void MainWindow::fetchProgrammes(int channelId, const QDate &date, bool refresh)
         }
 
         m_programmeListTableModel->setProgrammes(programmes);
+        qDebug() << "Programmes" << channelId << date.toString(Qt::ISODate) << programmes.size()
+                 << "resident" << residentMemorySize() << "kB";
         updateWindowTitle();
         updateCalendar();
         scrollProgrammes();
@@ -1458,17 +2017,19 @@ void MainWindow::fetchProgrammes(int channelId, const QDate &date, bool refresh)
 
     if (m_client->isValidUsernameAndPassword()) {
         m_client->sendProgrammeRequest(channelId, date);
+        m_fetchChannelId = channelId;
+        m_fetchDate = date;
         startLoadingAnimation();
     }
 }
 
-void MainWindow::fetchSearchResults(const QString &phrase)
+void MainWindow::fetchSearchResults(const QString &phrase, bool refresh)
 {
     if (!m_client->isValidUsernameAndPassword()) {
         return;
     }
 
-    m_client->sendSearchRequest(phrase);
+    m_client->sendSearchRequest(phrase, refresh);
     m_searchPhrase = phrase;
     startLoadingAnimation();
     setCurrentView(1);
@@ -1478,10 +2039,16 @@ void MainWindow::fetchPlaylist(bool refresh)
 {
     bool ok;
     int age;
-    QList<Programme> programmes = m_cache->loadPlaylist(ok, age);
+    ProgrammeSnapshot programmes = m_cache->loadPlaylist(ok, age);
 
     if (ok && !refresh) {
         updatePlaylist(programmes);
+
+        /* Vanhentunut lista päivitetään taustalla. */
+        if (age >= 10 * 60) {
+            m_syncEngine->requestRefresh(0);
+        }
+
         return;
     }
 
@@ -1495,14 +2062,16 @@ void MainWindow::fetchSeasonPasses(bool refresh)
 {
     bool ok;
     int age;
-    QList<Programme> programmes = m_cache->loadSeasonPasses(ok, age);
+    ProgrammeSnapshot programmes = m_cache->loadSeasonPasses(ok, age);
 
     if (ok && !refresh) {
         updateSeasonPasses(programmes);
 
-        if (age < 10 * 60) {
-            return;
+        if (age >= 10 * 60) {
+            m_syncEngine->requestRefresh(1);
         }
+
+        return;
     }
 
     if (m_client->isValidUsernameAndPassword()) {
@@ -1513,18 +2082,27 @@ void MainWindow::fetchSeasonPasses(bool refresh)
 
 bool MainWindow::fetchPoster()
 {
-    m_posterImage = m_cache->loadPoster(m_currentProgramme);
+    QImage poster = m_posterLoader->poster(m_currentProgramme.id);
 
-    if (m_posterImage.isNull()) {
-        m_client->sendPosterRequest(m_currentProgramme);
-        m_posterImage = m_noPosterImage;
-        return false;
+    if (!poster.isNull()) {
+        m_posterImage = poster;
+        return true;
+    }
+
+    QByteArray data = m_cache->loadPosterData(m_currentProgramme);
+
+    /* Välimuistissa oleva kuva puretaan taustalla, posterLoaded päivittää kuvauksen. */
+    if (!data.isEmpty()) {
+        m_posterLoader->load(m_currentProgramme.id, data);
+    }
+    else if (m_client->isRequestUnfinished()) {
+        m_posterTimer->start(500);
     }
     else {
-        addBorderToPoster();
+        m_client->sendPosterRequest(m_currentProgramme);
     }
 
-    return true;
+    return false;
 }
 
 void MainWindow::loadClientSettings()
@@ -1564,13 +2142,19 @@ void MainWindow::addServer(const QString &name, const QString &serverId)
     m_serverSignalMapper->setMapping(action, index);
     connect(action, SIGNAL(triggered()), m_serverSignalMapper, SLOT(map()));
     ui->menuServer->addAction(action);
+    m_serverProber->addServer(serverId);
+}
+
+void MainWindow::selectServer(int requestClass)
+{
+    if (m_serverProber->isEnabled()) {
+        m_client->setServer(m_serverProber->server(requestClass));
+    }
 }
 
 void MainWindow::updateFontSize()
 {
-    m_settings.beginGroup("mainWindow");
-    int size = m_settings.value("fontSize", 10).toInt();
-    m_settings.endGroup();
+    int size = m_appSettings->fontSize();
 
     QFont font(ui->downloadsTableView->font());
     font.setPointSize(size);
@@ -1658,7 +2242,7 @@ void MainWindow::updateDescription()
     html.append(QString(m_currentProgramme.title).toHtmlEscaped());
     html.append("</b> ");
     html.append(trUtf8("%1 kanavalta %2").arg(
-            m_currentProgramme.startDateTime.toString(trUtf8("ddd d.M.yyyy 'klo' h.mm")),
+            m_currentProgramme.startDateTime().toString(trUtf8("ddd d.M.yyyy 'klo' h.mm")),
             m_channelMap.value(m_currentProgramme.channelId)));
 
     if (m_currentProgramme.duration > 0) {
@@ -1742,7 +2326,7 @@ void MainWindow::updateCalendar()
     }
 }
 
-void MainWindow::updatePlaylist(const QList<Programme> &programmes)
+void MainWindow::updatePlaylist(const ProgrammeSnapshot &programmes)
 {
     bool scroll = m_playlistTableModel->programmeCount() != programmes.size();
 
@@ -1763,7 +2347,7 @@ void MainWindow::updatePlaylist(const QList<Programme> &programmes)
     }
 }
 
-void MainWindow::updateSeasonPasses(const QList<Programme> &programmes)
+void MainWindow::updateSeasonPasses(const ProgrammeSnapshot &programmes)
 {
     bool scroll = m_seasonPassesTableModel->programmeCount() != programmes.size();
 
@@ -1801,6 +2385,7 @@ void MainWindow::resumeDownloadAt(int row)
     Programme programme;
     programme.id = programmeId;
     m_downloading = true;
+    selectServer(1);
     m_client->setFormat(m_downloadTableModel->videoFormat(row));
     m_client->sendStreamRequest(programme);
     m_client->setFormat(currentFormat);
@@ -1824,16 +2409,9 @@ void MainWindow::scrollProgrammes()
             return;
         }
 
+        /* Listan alku on aina ladattu, joten loput rivit ladataan vasta vieritettäessä. */
         QModelIndex modelIndex = m_currentTableModel->index(0, 0, QModelIndex());
-
-        if (m_currentTableModel->sortKey() == 1 && !m_currentTableModel->isDescending()) {
-            ui->programmeTableView->scrollToBottom();
-            modelIndex = m_currentTableModel->index(
-                    m_currentTableModel->rowCount(QModelIndex()) - 1, 0, QModelIndex());
-        }
-        else {
-            ui->programmeTableView->scrollToTop();
-        }
+        ui->programmeTableView->scrollToTop();
 
         ui->programmeTableView->selectionModel()->select(modelIndex,
             QItemSelectionModel::ClearAndSelect | QItemSelectionModel::Rows);
@@ -1842,6 +2420,9 @@ void MainWindow::scrollProgrammes()
     else {
         int row = m_currentTableModel->defaultProgrammeIndex();
 
+        /* Oletusrivi voi olla vielä lataamattomalla sivulla. */
+        m_currentTableModel->fetchUntil(row);
+
         if (row < 0) {
             ui->programmeTableView->selectionModel()->clear();
             ui->descriptionTextEdit->setPlainText(QString());
@@ -1877,15 +2458,6 @@ void MainWindow::addHistoryEntry(int programmeId)
     m_currentTableModel->updateHistory();
 }
 
-void MainWindow::addBorderToPoster()
-{
-    QImage image(m_posterImage.width() + 8, m_posterImage.height() + 8, QImage::Format_RGB32);
-    QPainter painter(&image);
-    painter.fillRect(m_noPosterImage.rect(), QBrush(ui->descriptionTextEdit->palette().color(QPalette::Base)));
-    painter.drawImage(QPoint(4, 4), m_posterImage);
-    m_posterImage = image;
-}
-
 void MainWindow::setSortKeyToModel(const QString &sortKey, ProgrammeTableModel *model)
 {
     if (sortKey == "timeAsc") model->setSortKey(1, false);
@@ -1907,9 +2479,7 @@ QString MainWindow::sortKeyFromModel(ProgrammeTableModel *model)
 
 void MainWindow::startFlashStream(const QUrl &url)
 {
-    m_settings.beginGroup("mediaPlayer");
-    QString command = m_settings.value("flash").toString();
-    m_settings.endGroup();
+    QString command = m_appSettings->flashPlayerCommand();
 
     if (command.isEmpty()) {
         if (!QDesktopServices::openUrl(url)) {
@@ -1945,27 +2515,140 @@ void MainWindow::startFlashStream(const QUrl &url)
     }
 }
 
+QString MainWindow::nowAndNextText(int channelId)
+{
+    /* Välimuistin aikaväli-indeksi vastaa kaikkien kanavien osalta kerralla.
+       Indeksistä puuttuvat päivät luetaan taustalla seuraavaa kertaa varten. */
+    QDateTime dateTime = QDateTime::currentDateTime();
+    bool ready = m_programmeIndexLoader->load(dateTime.date().addDays(-1), dateTime.date().addDays(1));
+    QHash<int, Programme> now;
+    QHash<int, Programme> next;
+    m_cache->nowAndNext(dateTime, now, next);
+    QStringList lines;
+
+    if (now.contains(channelId)) {
+        Programme programme = now.value(channelId);
+        lines.append(trUtf8("Nyt: %1 %2").arg(programme.startDateTime().toString("hh:mm"), programme.title));
+    }
+
+    if (next.contains(channelId)) {
+        Programme programme = next.value(channelId);
+        lines.append(trUtf8("Seuraavaksi: %1 %2").arg(programme.startDateTime().toString("hh:mm"), programme.title));
+    }
+
+    if (lines.isEmpty() && !ready) {
+        return trUtf8("Ladataan...");
+    }
+
+    return lines.join("\n");
+}
+
+bool MainWindow::playDownloadInProgress(int row)
+{
+    Downloader *downloader = m_downloadTableModel->downloader(row);
+
+    if (downloader == 0) {
+        return false;
+    }
+
+    if (!m_streamServer->listen()) {
+        qWarning() << m_streamServer->lastError();
+        return false;
+    }
+
+    /* Edellinen keskeneräinen tiedosto poistetaan jaosta, kun soitin lopettaa sen lukemisen. */
+    if (m_downloadSource != 0) {
+        m_streamServer->removeSourceWhenIdle(m_downloadSource);
+    }
+
+    m_downloadSource = new FileStreamSource(downloader);
+    QUrl url = m_streamServer->addSource(m_downloadSource, QFileInfo(downloader->filename()).fileName());
+    addHistoryEntry(m_downloadTableModel->programmeId(row));
+    QString command = m_appSettings->streamPlayerCommand();
+
+    if (command.isEmpty()) {
+        command = defaultStreamPlayerCommand();
+    }
+
+    startMediaPlayer(command, QString::fromLatin1(url.toEncoded()), m_downloadTableModel->videoFormat(row));
+    return true;
+}
+
+void MainWindow::playFromScreenshot(const Programme &programme, int msecs)
+{
+    /* Ladattu MPEG-TS-tallenne soitetaan kuvakaappauksen kohdasta, joka haetaan
+       latauksen aikana kirjoitetusta hakemistosta. */
+    int row = m_downloadTableModel->findDownload(programme.id);
+
+    if (row < 0 || m_downloadTableModel->status(row) != 1) {
+        return;
+    }
+
+    QString filename = m_downloadTableModel->filename(row);
+    QVector<TsIndexEntry> entries;
+
+    if (!TsValidator::readIndex(TsValidator::indexFilename(filename), entries)) {
+        return;
+    }
+
+    if (!m_streamServer->listen()) {
+        qWarning() << m_streamServer->lastError();
+        return;
+    }
+
+    if (m_downloadSource != 0) {
+        m_streamServer->removeSourceWhenIdle(m_downloadSource);
+    }
+
+    qint64 offset = TsValidator::offsetForTime(entries, msecs);
+    qDebug() << "SEEK" << filename << msecs << "ms at" << offset;
+    m_downloadSource = new FileStreamSource(filename, offset);
+    QUrl url = m_streamServer->addSource(m_downloadSource, QFileInfo(filename).fileName());
+    addHistoryEntry(programme.id);
+    QString command = m_appSettings->streamPlayerCommand();
+
+    if (command.isEmpty()) {
+        command = defaultStreamPlayerCommand();
+    }
+
+    startMediaPlayer(command, QString::fromLatin1(url.toEncoded()), m_downloadTableModel->videoFormat(row));
+}
+
+void MainWindow::startPrebuffer(const QUrl &url)
+{
+    if (!m_streamServer->listen()) {
+        qWarning() << m_streamServer->lastError();
+        return;
+    }
+
+    int format = m_client->format();
+    m_prebufferSource = new PrebufferSource(m_client, url, m_currentProgramme.id, format);
+    m_streamServer->addSource(m_prebufferSource, QString("%1.%2").arg(m_currentProgramme.id).arg(format == 3 ? "ts" : "mp4"));
+    m_prebufferSource->start();
+}
+
+void MainWindow::discardPrebuffer()
+{
+    /* Soitin voi vielä lukea lähdettä, joten palvelin tuhoaa sen vasta käytön loputtua. */
+    m_streamServer->removeSourceWhenIdle(m_prebufferSource);
+    m_prebufferSource = 0;
+}
+
 void MainWindow::startMediaPlayer(const QString &command, const QString &filename, int format)
 {
-    m_settings.beginGroup("mediaPlayer");
-    QString deinterlaceOptions = m_settings.value(
-            "deinterlaceOptions", "--video-filter=deinterlace --deinterlace-mode=linear").toString();
-    m_settings.endGroup();
+    QString deinterlaceOptions = m_appSettings->deinterlaceOptions();
 
     if (format != 3) {
          /* Lomitus tarvitsee poistaa vain 8 Mbps videoformaatista */
          deinterlaceOptions = QString();
     }
 
-    m_settings.beginGroup("client");
-    m_settings.beginGroup("proxy");
-    QString proxyHost = m_settings.value("host").toString();
-    int proxyPort = m_settings.value("port").toInt();
-    m_settings.endGroup();
-    m_settings.endGroup();
+    QString proxyHost = m_appSettings->proxyHost();
+    int proxyPort = m_appSettings->proxyPort();
     QString proxyOptions;
 
-    if (!proxyHost.isEmpty()) {
+    /* Paikallista palvelinta ei käytetä välityspalvelimen kautta. */
+    if (!proxyHost.isEmpty() && !filename.startsWith("http://127.0.0.1:")) {
         proxyOptions = QString("--http-proxy '%1:%2'").arg(proxyHost).arg(proxyPort);
     }
 
@@ -2,10 +2,11 @@
 #define MAINWINDOW_H
 
 #include <QDate>
+#include <QElapsedTimer>
 #include <QMainWindow>
 #include <QSettings>
 #include "channel.h"
-#include "programme.h"
+#include "programmesnapshot.h"
 
 namespace Ui {
     class MainWindow;
@@ -16,14 +17,34 @@ class QLabel;
 class QToolButton;
 class QSignalMapper;
 class Cache;
+class AppSettings;
+class CacheMaintainer;
 class DownloadTableModel;
+class EpgGridWidget;
 class HistoryManager;
+class PosterLoader;
 class ProgrammeFeedParser;
+class ProgrammeIndexLoader;
+class PrebufferSource;
 class ProgrammeTableModel;
 class ScreenshotWindow;
 class SettingsDialog;
+class ServerProber;
+class StartupLoader;
+class SyncEngine;
+class StreamServer;
+class StreamSource;
 class TvkaistaClient;
 
+struct PendingEdit
+{
+    PendingEdit() : type(0), baseKnown(false) {}
+    int type;
+    ProgrammeSnapshot backup;
+    QList<Programme> programmes;
+    bool baseKnown;
+};
+
 class MainWindow : public QMainWindow
 {
     Q_OBJECT
@@ -42,6 +63,7 @@ public:
 protected:
     void closeEvent(QCloseEvent *e);
     bool eventFilter(QObject *object, QEvent *event);
+    void changeEvent(QEvent *e);
 
 private slots:
     void dateClicked(const QDate &date);
@@ -59,6 +81,9 @@ private slots:
     void watchProgramme();
     void downloadProgramme();
     void openScreenshotWindow();
+    void openEpgGrid();
+    void epgProgrammeActivated(const Programme &programme);
+    void playFromScreenshot(const Programme &programme, int msecs);
     void openSettingsDialog();
     void settingsAccepted();
     void openAboutDialog();
@@ -70,6 +95,7 @@ private slots:
     void playDownloadedFile();
     void openDirectory();
     void search();
+    void searchTimeout();
     void clearSearchHistory();
     void sortByTimeAsc();
     void sortByTimeDesc();
@@ -93,49 +119,67 @@ private slots:
     void copyMiroFeedUrl();
     void copyItunesFeedUrl();
     void setCurrentServer(int index);
+    void setAutomaticServer(bool enabled);
     void channelsFetched(const QList<Channel> &channels);
-    void programmesFetched(int channelId, const QDate &date, const QList<Programme> &programmes);
-    void posterFetched(const Programme &programme, const QImage &poster);
+    void programmesFetched(int channelId, const QDate &date, const ProgrammeSnapshot &programmes);
+    void posterFetched(const Programme &programme, const QByteArray &data);
+    void posterLoaded(int programmeId, const QImage &poster);
     void streamUrlFetched(const Programme &programme, int format, const QUrl &url);
-    void searchResultsFetched(const QList<Programme> &programmes);
-    void playlistFetched(const QList<Programme> &programmes);
-    void seasonPassListFetched(const QList<Programme> &programmes);
+    void searchResultsFetched(const ProgrammeSnapshot &programmes);
+    void playlistFetched(const ProgrammeSnapshot &programmes);
+    void seasonPassListFetched(const ProgrammeSnapshot &programmes);
     void seasonPassIndexFetched(const QMap<QString, int> &seasonPasses);
-    void editRequestFinished(int type, bool ok);
+    void editRequestsFinished(int type, const QList<int> &failedIds);
     void posterTimeout();
+    void resolveTimeout();
+    void prebufferTimeout();
+    void streamUrlResolved(int programmeId, int format, const QUrl &url);
+    void cacheMaintenanceFinished();
+    void posterPackRemoved(const QString &month);
+    void historyLoaded();
+    void downloadsLoaded();
+    void channelsLoaded();
+    void updateDownloadProgressVisibility();
     void downloadStatusChanged(int index);
     void networkError();
     void loginError();
     void streamNotFound();
+    void updateFontSize();
+    void prebufferSettingChanged(bool enabled);
 
 private:
     void fetchChannels(bool refresh);
     void fetchProgrammes(int channelId, const QDate &date, bool refresh);
-    void fetchSearchResults(const QString &phrase);
+    void fetchSearchResults(const QString &phrase, bool refresh);
     void fetchPlaylist(bool refresh);
     void fetchSeasonPasses(bool refresh);
     bool fetchPoster();
     void loadClientSettings();
     void addServer(const QString &name, const QString &serverId);
-    void updateFontSize();
+    void selectServer(int requestClass);
     void updateColumnSizes();
     void updateChannelList();
     void updateDescription();
     void updateWindowTitle();
     void updateCalendar();
-    void updatePlaylist(const QList<Programme> &programmes);
-    void updateSeasonPasses(const QList<Programme> &programmes);
+    void updatePlaylist(const ProgrammeSnapshot &programmes);
+    void updateSeasonPasses(const ProgrammeSnapshot &programmes);
     void resumeDownloadAt(int row);
+    QList<Programme> selectedProgrammes() const;
+    void sendEdits(int type, const QList<Programme> &programmes);
     void setFormat(int format);
     void scrollProgrammes();
     void startLoadingAnimation();
     void stopLoadingAnimation();
     void addHistoryEntry(int programmeId);
-    void addBorderToPoster();
     void setSortKeyToModel(const QString &sortKey, ProgrammeTableModel *model);
     QString sortKeyFromModel(ProgrammeTableModel *model);
     void startFlashStream(const QUrl &url);
     void startMediaPlayer(const QString &command, const QString &filename, int format);
+    QString nowAndNextText(int channelId);
+    bool playDownloadInProgress(int row);
+    void startPrebuffer(const QUrl &url);
+    void discardPrebuffer();
     QStringList splitCommandLine(const QString &command);
     static QString addDefaultOptionsToVlcCommand(const QString &command);
     Ui::MainWindow *ui;
@@ -144,9 +188,15 @@ private:
     QLabel *m_loadLabel;
     QMovie *m_loadMovie;
     QTimer *m_posterTimer;
+    QTimer *m_resolveTimer;
+    QTimer *m_prebufferTimer;
+    QTimer *m_searchTimer;
+    PosterLoader *m_posterLoader;
     QToolButton *m_searchToolButton;
     QSettings m_settings;
+    AppSettings *m_appSettings;
     TvkaistaClient *m_client;
+    SyncEngine *m_syncEngine;
     HistoryManager *m_historyManager;
     DownloadTableModel *m_downloadTableModel;
     ProgrammeTableModel *m_programmeListTableModel;
@@ -155,18 +205,34 @@ private:
     ProgrammeTableModel *m_seasonPassesTableModel;
     ProgrammeTableModel *m_currentTableModel;
     Cache *m_cache;
+    CacheMaintainer *m_cacheMaintainer;
+    StartupLoader *m_startupLoader;
+    ProgrammeIndexLoader *m_programmeIndexLoader;
+    StreamServer *m_streamServer;
+    PrebufferSource *m_prebufferSource;
+    StreamSource *m_downloadSource;
+    bool m_prebufferPending;
+    QElapsedTimer m_startupTimer;
     SettingsDialog *m_settingsDialog;
     ScreenshotWindow *m_screenshotWindow;
+    EpgGridWidget *m_epgGridWidget;
     QList<Channel> m_channels;
     QList<QAction*> m_serverActions;
     QSignalMapper *m_serverSignalMapper;
+    ServerProber *m_serverProber;
+    QAction *m_autoServerAction;
+    QString m_manualServer;
     QMap<int, QString> m_channelMap;
     QStringList m_searchHistory;
     QString m_searchPhrase;
+    bool m_incrementalSearch;
     QDateTime m_lastRefreshTime;
     int m_currentChannelId;
     QDate m_currentDate;
+    int m_fetchChannelId;
+    QDate m_fetchDate;
     Programme m_currentProgramme;
+    PendingEdit m_pendingEdits[2];
     QImage m_posterImage;
     QImage m_noPosterImage;
     QIcon m_searchIcon;
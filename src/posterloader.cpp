@@ -0,0 +1,125 @@
+#include <QDebug>
+#include <QPainter>
+#include <QRunnable>
+#include "posterloader.h"
+
+class PosterDecodeTask : public QRunnable
+{
+public:
+    PosterDecodeTask(PosterLoader *loader, int programmeId, const QByteArray &data) :
+        m_loader(loader), m_programmeId(programmeId), m_data(data),
+        m_size(loader->m_displaySize), m_color(loader->m_backgroundColor) {}
+
+    void run()
+    {
+        /* Käyttäjä on jo siirtynyt toiseen ohjelmaan. */
+        if (m_loader->m_currentProgrammeId.load() != m_programmeId) {
+            return;
+        }
+
+        QImage poster = PosterLoader::decode(m_data, m_size, m_color);
+        QMetaObject::invokeMethod(m_loader, "decodeFinished", Qt::QueuedConnection,
+                                  Q_ARG(int, m_programmeId), Q_ARG(QImage, poster));
+    }
+
+private:
+    PosterLoader *m_loader;
+    int m_programmeId;
+    QByteArray m_data;
+    QSize m_size;
+    QColor m_color;
+};
+
+PosterLoader::PosterLoader(QObject *parent) :
+    QObject(parent), m_posters(4096), m_currentProgrammeId(-1), m_displaySize(104, 80),
+    m_backgroundColor(Qt::white)
+{
+    m_threadPool.setMaxThreadCount(1);
+}
+
+PosterLoader::~PosterLoader()
+{
+    m_currentProgrammeId.store(-1);
+    m_threadPool.clear();
+    m_threadPool.waitForDone();
+}
+
+void PosterLoader::setDisplaySize(const QSize &size)
+{
+    m_displaySize = size;
+    m_posters.clear();
+}
+
+QSize PosterLoader::displaySize() const
+{
+    return m_displaySize;
+}
+
+void PosterLoader::setBackgroundColor(const QColor &color)
+{
+    m_backgroundColor = color;
+    m_posters.clear();
+}
+
+QColor PosterLoader::backgroundColor() const
+{
+    return m_backgroundColor;
+}
+
+void PosterLoader::setCurrentProgrammeId(int programmeId)
+{
+    if (m_currentProgrammeId.fetchAndStoreRelaxed(programmeId) != programmeId) {
+        /* Jonossa olevat vanhat kuvat ohitetaan. */
+        m_threadPool.clear();
+    }
+}
+
+int PosterLoader::currentProgrammeId() const
+{
+    return m_currentProgrammeId.load();
+}
+
+QImage PosterLoader::poster(int programmeId) const
+{
+    QImage *poster = m_posters.object(programmeId);
+    return poster != 0 ? *poster : QImage();
+}
+
+void PosterLoader::load(int programmeId, const QByteArray &data)
+{
+    m_threadPool.start(new PosterDecodeTask(this, programmeId, data));
+}
+
+QImage PosterLoader::decode(const QByteArray &data, const QSize &size, const QColor &color)
+{
+    QImage image = QImage::fromData(data, "JPEG");
+
+    if (image.isNull()) {
+        return image;
+    }
+
+    if (image.width() > size.width() || image.height() > size.height()) {
+        image = image.scaled(size, Qt::KeepAspectRatio, Qt::SmoothTransformation);
+    }
+
+    QImage poster(image.width() + 8, image.height() + 8, QImage::Format_RGB32);
+    QPainter painter(&poster);
+    painter.fillRect(poster.rect(), color);
+    painter.drawImage(QPoint(4, 4), image);
+    painter.end();
+    return poster;
+}
+
+void PosterLoader::decodeFinished(int programmeId, const QImage &poster)
+{
+    if (poster.isNull()) {
+        qWarning() << "Invalid poster" << programmeId;
+        return;
+    }
+
+    m_posters.insert(programmeId, new QImage(poster), poster.byteCount() / 1024 + 1);
+
+    if (programmeId == m_currentProgrammeId.load()) {
+        emit posterLoaded(programmeId, poster);
+    }
+}
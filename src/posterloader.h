@@ -0,0 +1,45 @@
+#ifndef POSTERLOADER_H
+#define POSTERLOADER_H
+
+#include <QAtomicInt>
+#include <QCache>
+#include <QColor>
+#include <QImage>
+#include <QObject>
+#include <QSize>
+#include <QThreadPool>
+
+/* Purkaa kuvakaappaukset taustasäikeessä, skaalaa ne näyttökokoon ja lisää reunuksen.
+   Valmiit kuvat pidetään muistissa, jotta ohjelmalistan selaaminen ei hidastu. */
+class PosterLoader : public QObject
+{
+    Q_OBJECT
+public:
+    PosterLoader(QObject *parent = 0);
+    ~PosterLoader();
+    void setDisplaySize(const QSize &size);
+    QSize displaySize() const;
+    void setBackgroundColor(const QColor &color);
+    QColor backgroundColor() const;
+    void setCurrentProgrammeId(int programmeId);
+    int currentProgrammeId() const;
+    QImage poster(int programmeId) const;
+    void load(int programmeId, const QByteArray &data);
+    static QImage decode(const QByteArray &data, const QSize &size, const QColor &color);
+
+signals:
+    void posterLoaded(int programmeId, const QImage &poster);
+
+private slots:
+    void decodeFinished(int programmeId, const QImage &poster);
+
+private:
+    friend class PosterDecodeTask;
+    QThreadPool m_threadPool;
+    QCache<int, QImage> m_posters;
+    QAtomicInt m_currentProgrammeId;
+    QSize m_displaySize;
+    QColor m_backgroundColor;
+};
+
+#endif // POSTERLOADER_H
@@ -0,0 +1,388 @@
+#include <QDataStream>
+#include <QDebug>
+#include <QDir>
+#include <QFileInfo>
+#include <QLockFile>
+#include <QSaveFile>
+#include <QtEndian>
+#include "posterpack.h"
+
+/* Enimmäisaika, jonka toisen ohjelman lukkoa odotetaan. */
+static const int LOCK_TIMEOUT = 5000;
+
+/* Indeksitiedoston muutokset tarkistetaan hakujen yhteydessä enintään näin usein. */
+static const int INDEX_CHECK_INTERVAL = 2000;
+
+/* Tiivistetyn datatiedoston alku: tunniste ja sukupolven numero. Kuvat ovat JPEG-
+   tiedostoja, joten tunniste ei voi olla vanhan paketin ensimmäisen kuvan alku. */
+static const char PACK_MAGIC[] = "TKPP";
+static const int PACK_HEADER_SIZE = 12;
+
+/* Indeksin sukupolvitietueen ohjelmatunniste. */
+static const qint32 GENERATION_ID = -1;
+
+PosterPack::PosterPack(const QString &dataFilename, const QString &indexFilename) :
+    m_dataFilename(dataFilename), m_indexFilename(indexFilename), m_map(0), m_mapSize(0),
+    m_dataSize(0), m_wastedBytes(0), m_indexSize(-1), m_generation(0),
+    m_indexLoaded(false)
+{
+}
+
+PosterPack::~PosterPack()
+{
+    unmapData();
+}
+
+bool PosterPack::contains(int programmeId)
+{
+    PosterPackEntry entry;
+    return findEntry(programmeId, entry);
+}
+
+QByteArray PosterPack::data(int programmeId)
+{
+    PosterPackEntry entry;
+
+    if (!findEntry(programmeId, entry)) {
+        return QByteArray();
+    }
+
+    /* Toinen ohjelma on voinut tiivistää paketin indeksin lukemisen jälkeen. */
+    if (!mapData(entry.offset + entry.length)) {
+        refreshIndex(true);
+
+        if (!findEntry(programmeId, entry) || !mapData(entry.offset + entry.length)) {
+            return QByteArray();
+        }
+    }
+
+    return QByteArray(reinterpret_cast<const char*>(m_map + entry.offset), entry.length);
+}
+
+bool PosterPack::append(int programmeId, const QByteArray &data)
+{
+    QDir dir(QFileInfo(m_dataFilename).absolutePath());
+
+    if (!dir.exists()) {
+        dir.mkpath(dir.path());
+    }
+
+    QLockFile lock(lockFilename());
+
+    if (!lock.tryLock(LOCK_TIMEOUT)) {
+        m_lastError = "Poster pack is locked by another process";
+        return false;
+    }
+
+    refreshIndex(true);
+    QFile dataFile(m_dataFilename);
+
+    if (!dataFile.open(QIODevice::WriteOnly | QIODevice::Append)) {
+        m_lastError = dataFile.errorString();
+        return false;
+    }
+
+    PosterPackEntry entry;
+    entry.offset = dataFile.size();
+    entry.length = data.size();
+
+    if (dataFile.write(data) != data.size()) {
+        m_lastError = dataFile.errorString();
+        return false;
+    }
+
+    dataFile.close();
+    QFile indexFile(m_indexFilename);
+
+    if (!indexFile.open(QIODevice::WriteOnly | QIODevice::Append)) {
+        m_lastError = indexFile.errorString();
+        return false;
+    }
+
+    QDataStream stream(&indexFile);
+    stream.setByteOrder(QDataStream::LittleEndian);
+    stream << qint32(programmeId) << qint64(entry.offset) << qint32(entry.length);
+    indexFile.close();
+    updateIndexStamp();
+
+    if (m_index.contains(programmeId)) {
+        m_wastedBytes += m_index.value(programmeId).length;
+    }
+
+    m_index.insert(programmeId, entry);
+    m_dataSize = entry.offset + entry.length;
+    return true;
+}
+
+qint64 PosterPack::wastedBytes()
+{
+    loadIndex();
+    return m_wastedBytes;
+}
+
+qint64 PosterPack::dataSize()
+{
+    loadIndex();
+    return m_dataSize;
+}
+
+bool PosterPack::compact()
+{
+    /* Kirjoitetaan voimassa olevat kuvat uuteen tiedostoon ja korvataan vanha sillä. */
+    QLockFile lock(lockFilename());
+
+    if (!lock.tryLock(LOCK_TIMEOUT)) {
+        m_lastError = "Poster pack is locked by another process";
+        return false;
+    }
+
+    refreshIndex(true);
+    QSaveFile dataFile(m_dataFilename);
+    QSaveFile indexFile(m_indexFilename);
+
+    if (!dataFile.open(QIODevice::WriteOnly)) {
+        m_lastError = dataFile.errorString();
+        return false;
+    }
+
+    if (!indexFile.open(QIODevice::WriteOnly)) {
+        m_lastError = indexFile.errorString();
+        return false;
+    }
+
+    qint64 generation = m_generation + 1;
+    QDataStream dataStream(&dataFile);
+    dataStream.setByteOrder(QDataStream::LittleEndian);
+    dataStream.writeRawData(PACK_MAGIC, 4);
+    dataStream << qint64(generation);
+    QDataStream stream(&indexFile);
+    stream.setByteOrder(QDataStream::LittleEndian);
+    stream << GENERATION_ID << qint64(generation) << qint32(0);
+    QHash<int, PosterPackEntry> index;
+    QList<int> programmeIds = m_index.keys();
+    int count = programmeIds.size();
+
+    for (int i = 0; i < count; i++) {
+        int programmeId = programmeIds.at(i);
+        QByteArray data = this->data(programmeId);
+
+        if (data.isEmpty()) {
+            continue;
+        }
+
+        PosterPackEntry entry;
+        entry.offset = dataFile.pos();
+        entry.length = data.size();
+        dataFile.write(data);
+        stream << qint32(programmeId) << qint64(entry.offset) << qint32(entry.length);
+        index.insert(programmeId, entry);
+    }
+
+    qint64 dataSize = dataFile.pos();
+    unmapData();
+
+    /* Tiedostojen vaihdon välissä lukija voi saada eri sukupolven indeksin ja datan,
+       jolloin se hylkää kartoituksen ja lukee indeksin uudelleen. */
+    if (!dataFile.commit()) {
+        m_lastError = "Replacing compacted poster pack failed";
+        m_index.clear();
+        m_indexLoaded = false;
+        return false;
+    }
+
+    /* Uusi data ei sovi vanhaan indeksiin, joten paketti aloitetaan alusta. */
+    if (!indexFile.commit()) {
+        m_lastError = "Replacing compacted poster pack failed";
+        QFile::remove(m_dataFilename);
+        QFile::remove(m_indexFilename);
+        m_index.clear();
+        m_indexLoaded = false;
+        return false;
+    }
+
+    updateIndexStamp();
+    m_generation = generation;
+
+    qDebug() << "COMPACT" << m_dataFilename << m_dataSize << "->" << dataSize;
+    m_index = index;
+    m_dataSize = dataSize;
+    m_wastedBytes = 0;
+    return true;
+}
+
+QString PosterPack::lastError() const
+{
+    return m_lastError;
+}
+
+void PosterPack::loadIndex()
+{
+    if (m_indexLoaded) {
+        return;
+    }
+
+    m_indexLoaded = true;
+    m_index.clear();
+    m_dataSize = 0;
+    m_wastedBytes = 0;
+    m_generation = 0;
+    updateIndexStamp();
+    QFile indexFile(m_indexFilename);
+
+    if (!indexFile.open(QIODevice::ReadOnly)) {
+        return;
+    }
+
+    qDebug() << "READ" << m_indexFilename;
+    qint64 dataFileSize = QFileInfo(m_dataFilename).size();
+    QDataStream stream(&indexFile);
+    stream.setByteOrder(QDataStream::LittleEndian);
+
+    while (!stream.atEnd()) {
+        qint32 programmeId;
+        qint64 offset;
+        qint32 length;
+        stream >> programmeId >> offset >> length;
+
+        if (stream.status() != QDataStream::Ok) {
+            break;
+        }
+
+        if (programmeId == GENERATION_ID) {
+            m_generation = offset;
+            continue;
+        }
+
+        /* Katkennut kirjoitus, tietue osoittaa tiedoston loppua pidemmälle. */
+        if (offset < 0 || length <= 0 || offset + length > dataFileSize) {
+            continue;
+        }
+
+        if (m_index.contains(programmeId)) {
+            m_wastedBytes += m_index.value(programmeId).length;
+        }
+
+        PosterPackEntry entry;
+        entry.offset = offset;
+        entry.length = length;
+        m_index.insert(programmeId, entry);
+        m_dataSize = qMax(m_dataSize, offset + length);
+    }
+}
+
+bool PosterPack::mapData(qint64 minSize)
+{
+    if (m_map != 0 && m_mapSize >= minSize) {
+        return true;
+    }
+
+    /* Tiedosto on kasvanut edellisen kartoituksen jälkeen. */
+    unmapData();
+    m_dataFile.setFileName(m_dataFilename);
+
+    if (!m_dataFile.open(QIODevice::ReadOnly)) {
+        m_lastError = m_dataFile.errorString();
+        return false;
+    }
+
+    qint64 size = m_dataFile.size();
+
+    if (size < minSize) {
+        m_dataFile.close();
+        return false;
+    }
+
+    m_map = m_dataFile.map(0, size);
+
+    if (m_map == 0) {
+        m_lastError = m_dataFile.errorString();
+        m_dataFile.close();
+        return false;
+    }
+
+    m_mapSize = size;
+    qint64 generation = 0;
+
+    if (size >= PACK_HEADER_SIZE && QByteArray::fromRawData(reinterpret_cast<const char*>(m_map), 4) == PACK_MAGIC) {
+        generation = qFromLittleEndian<qint64>(m_map + 4);
+    }
+
+    if (generation != m_generation) {
+        qDebug() << "GENERATION" << m_dataFilename << generation << "!=" << m_generation;
+        m_lastError = "Poster pack data does not match its index";
+        unmapData();
+        return false;
+    }
+
+    return true;
+}
+
+bool PosterPack::findEntry(int programmeId, PosterPackEntry &entry)
+{
+    /* Löytynyt tietue on voimassa ilman tiedoston tarkistusta: tiedostoihin vain
+       lisätään, ja tiivistys havaitaan kartoitettaessa. */
+    if (!m_indexLoaded || !m_index.contains(programmeId)) {
+        refreshIndex(false);
+    }
+
+    QHash<int, PosterPackEntry>::const_iterator iter = m_index.constFind(programmeId);
+
+    if (iter == m_index.constEnd()) {
+        return false;
+    }
+
+    entry = iter.value();
+    return true;
+}
+
+void PosterPack::refreshIndex(bool force)
+{
+    if (!m_indexLoaded) {
+        loadIndex();
+        return;
+    }
+
+    if (!force && m_indexChecked.elapsed() < INDEX_CHECK_INTERVAL) {
+        return;
+    }
+
+    m_indexChecked.start();
+    QFileInfo info(m_indexFilename);
+
+    if (info.size() == m_indexSize && info.lastModified() == m_indexModified) {
+        return;
+    }
+
+    /* Toinen ohjelma on lisännyt kuvia tai tiivistänyt paketin. Tiivistetyssä
+       paketissa sijainnit muuttuvat, joten myös kartoitus on tehtävä uudelleen. */
+    qDebug() << "RELOAD" << m_indexFilename << m_indexSize << "->" << info.size();
+    unmapData();
+    m_indexLoaded = false;
+    loadIndex();
+}
+
+void PosterPack::updateIndexStamp()
+{
+    QFileInfo info(m_indexFilename);
+    m_indexSize = info.size();
+    m_indexModified = info.lastModified();
+    m_indexChecked.start();
+}
+
+QString PosterPack::lockFilename() const
+{
+    return QFileInfo(m_dataFilename).absolutePath() + "/posters.lock";
+}
+
+void PosterPack::unmapData()
+{
+    if (m_map != 0) {
+        m_dataFile.unmap(m_map);
+        m_map = 0;
+        m_mapSize = 0;
+    }
+
+    if (m_dataFile.isOpen()) {
+        m_dataFile.close();
+    }
+}
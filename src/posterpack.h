@@ -0,0 +1,61 @@
+#ifndef POSTERPACK_H
+#define POSTERPACK_H
+
+#include <QByteArray>
+#include <QDateTime>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QHash>
+#include <QString>
+
+struct PosterPackEntry
+{
+    qint64 offset;
+    int length;
+};
+
+/* Kuukauden kuvakaappaukset yhdessä tiedostossa: posters.dat sisältää JPEG-kuvat
+   peräkkäin ja posters.idx tietueet (ohjelman id, sijainti, pituus). Molempiin
+   tiedostoihin vain lisätään, joten myöhempi tietue korvaa aiemman. Useampi ohjelma
+   voi käyttää samaa pakettia: kirjoitukset tehdään posters.lock-lukon alla ja indeksi
+   luetaan uudelleen, kun toinen ohjelma on muuttanut sitä. Tiivistetyn paketin
+   molempien tiedostojen alussa on sukupolven numero, jolla vanha indeksi ja uusi data
+   (tai päinvastoin) tunnistetaan toisilleen kuulumattomiksi. */
+class PosterPack
+{
+public:
+    PosterPack(const QString &dataFilename, const QString &indexFilename);
+    ~PosterPack();
+    bool contains(int programmeId);
+    QByteArray data(int programmeId);
+    bool append(int programmeId, const QByteArray &data);
+    qint64 wastedBytes();
+    qint64 dataSize();
+    bool compact();
+    QString lastError() const;
+
+private:
+    void loadIndex();
+    void refreshIndex(bool force);
+    bool findEntry(int programmeId, PosterPackEntry &entry);
+    void updateIndexStamp();
+    QString lockFilename() const;
+    bool mapData(qint64 minSize);
+    void unmapData();
+    QString m_dataFilename;
+    QString m_indexFilename;
+    QFile m_dataFile;
+    QHash<int, PosterPackEntry> m_index;
+    uchar *m_map;
+    qint64 m_mapSize;
+    qint64 m_dataSize;
+    qint64 m_wastedBytes;
+    qint64 m_indexSize;
+    QDateTime m_indexModified;
+    QElapsedTimer m_indexChecked;
+    qint64 m_generation;
+    bool m_indexLoaded;
+    QString m_lastError;
+};
+
+#endif // POSTERPACK_H
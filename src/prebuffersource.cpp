@@ -0,0 +1,312 @@
+#include <QDebug>
+#include <QNetworkReply>
+#include <QNetworkRequest>
+#include "prebuffersource.h"
+#include "tvkaistaclient.h"
+
+static const qint64 READ_CHUNK_SIZE = 64 * 1024;
+
+PrebufferSource::PrebufferSource(TvkaistaClient *client, const QUrl &url, int programmeId, int format,
+                                 QObject *parent) :
+    StreamSource(parent), m_client(client), m_url(url), m_programmeId(programmeId), m_format(format),
+    m_headSize(4 * 1024 * 1024), m_bufferSize(8 * 1024 * 1024), m_bufferStart(0),
+    m_bufferConsumed(0), m_upstreamOffset(0), m_totalSize(-1), m_replyChecked(false),
+    m_playerAttached(false), m_finished(false), m_error(false)
+{
+}
+
+PrebufferSource::~PrebufferSource()
+{
+    abortRequest();
+}
+
+void PrebufferSource::setHeadSize(qint64 headSize)
+{
+    m_headSize = headSize;
+}
+
+qint64 PrebufferSource::headSize() const
+{
+    return m_headSize;
+}
+
+void PrebufferSource::setBufferSize(qint64 bufferSize)
+{
+    m_bufferSize = bufferSize;
+}
+
+qint64 PrebufferSource::bufferSize() const
+{
+    return m_bufferSize;
+}
+
+void PrebufferSource::start()
+{
+    m_head.reserve(m_headSize);
+    startRequest(0);
+}
+
+int PrebufferSource::programmeId() const
+{
+    return m_programmeId;
+}
+
+int PrebufferSource::format() const
+{
+    return m_format;
+}
+
+QUrl PrebufferSource::url() const
+{
+    return m_url;
+}
+
+bool PrebufferSource::hasError() const
+{
+    return m_error;
+}
+
+qint64 PrebufferSource::availableAt(qint64 offset) const
+{
+    if (offset < m_head.size()) {
+        return m_head.size() - offset;
+    }
+
+    qint64 bufferEnd = m_bufferStart + m_buffer.size();
+
+    if (offset >= m_bufferStart + m_bufferConsumed && offset < bufferEnd) {
+        return bufferEnd - offset;
+    }
+
+    return 0;
+}
+
+void PrebufferSource::requestAt(qint64 offset)
+{
+    m_playerAttached = true;
+
+    if (availableAt(offset) > 0) {
+        return;
+    }
+
+    /* Alku on vielä tulossa tai yhteys on jo etenemässä pyydettyyn kohtaan. Alun
+       sisällä olevaa kohtaa odotetaan, jotta alun lataus ei keskeydy. */
+    bool active = !m_reply.isNull() && !m_finished;
+    bool fillingHead = m_upstreamOffset < m_headSize && m_upstreamOffset == m_head.size();
+
+    if (active && (offset == m_upstreamOffset || (fillingHead && offset < m_headSize))) {
+        readReply();
+        return;
+    }
+
+    if (m_totalSize >= 0 && offset >= m_totalSize) {
+        return;
+    }
+
+    qDebug() << "Prebuffer: seek" << offset;
+    startRequest(offset);
+}
+
+qint64 PrebufferSource::totalSize() const
+{
+    return m_totalSize;
+}
+
+bool PrebufferSource::isComplete() const
+{
+    return m_error || (m_finished && m_totalSize >= 0 && m_upstreamOffset >= m_totalSize);
+}
+
+QByteArray PrebufferSource::read(qint64 offset, qint64 maxSize)
+{
+    m_playerAttached = true;
+    qint64 length = qMin(maxSize, availableAt(offset));
+
+    if (length <= 0) {
+        return QByteArray();
+    }
+
+    if (offset < m_head.size()) {
+        return m_head.mid(offset, length);
+    }
+
+    QByteArray data = m_buffer.mid(offset - m_bufferStart, length);
+
+    /* Luettu osa vapautetaan, ja puskuri tiivistetään vasta kun puolet siitä on luettu. */
+    m_bufferConsumed = offset + length - m_bufferStart;
+
+    if (m_bufferConsumed >= m_bufferSize / 2) {
+        m_buffer.remove(0, m_bufferConsumed);
+        m_bufferStart += m_bufferConsumed;
+        m_bufferConsumed = 0;
+    }
+
+    readReply();
+    return data;
+}
+
+QByteArray PrebufferSource::contentType() const
+{
+    return m_format == 3 ? "video/mp2t" : "video/mp4";
+}
+
+void PrebufferSource::replyReadyRead()
+{
+    readReply();
+}
+
+void PrebufferSource::replyFinished()
+{
+    if (m_reply.isNull() || sender() != m_reply) {
+        return;
+    }
+
+    if (m_reply->error() != QNetworkReply::NoError &&
+            m_reply->error() != QNetworkReply::OperationCanceledError) {
+        qWarning() << "Prebuffer:" << TvkaistaClient::networkErrorString(m_reply->error());
+        m_error = true;
+    }
+
+    readReply();
+    m_finished = true;
+    emit dataAvailable();
+}
+
+void PrebufferSource::startRequest(qint64 offset)
+{
+    abortRequest();
+    m_finished = false;
+    m_error = false;
+    m_replyChecked = false;
+    m_upstreamOffset = offset;
+    m_buffer.clear();
+    m_bufferStart = offset;
+    m_bufferConsumed = 0;
+
+    QNetworkRequest request(m_url);
+
+    if (offset > 0) {
+        request.setRawHeader("Range", QString("bytes=%1-").arg(offset).toLatin1());
+    }
+
+    m_reply = m_client->sendRequest(request);
+
+    /* Verkkopino lopettaa lukemisen, kun puskuri on täynnä, eli siirto pysähtyy
+       siihen asti, kunnes soitin lukee lisää. */
+    m_reply->setReadBufferSize(READ_CHUNK_SIZE * 4);
+    connect(m_reply, SIGNAL(readyRead()), SLOT(replyReadyRead()));
+    connect(m_reply, SIGNAL(finished()), SLOT(replyFinished()));
+}
+
+void PrebufferSource::abortRequest()
+{
+    if (m_reply.isNull()) {
+        return;
+    }
+
+    QNetworkReply *reply = m_reply;
+    m_reply = 0;
+    reply->disconnect(this);
+    reply->abort();
+    reply->deleteLater();
+}
+
+void PrebufferSource::readReply()
+{
+    if (m_reply.isNull()) {
+        return;
+    }
+
+    if (!m_replyChecked) {
+        m_replyChecked = true;
+
+        if (!checkReply()) {
+            m_error = true;
+            abortRequest();
+            emit dataAvailable();
+            return;
+        }
+    }
+
+    bool received = false;
+
+    while (m_reply->bytesAvailable() > 0) {
+        qint64 space;
+
+        if (m_upstreamOffset < m_headSize && m_upstreamOffset == m_head.size()) {
+            space = m_headSize - m_upstreamOffset;
+        }
+        else if (!m_playerAttached) {
+            /* Ennakkoon haetaan vain alku. */
+            break;
+        }
+        else {
+            space = m_bufferSize - (m_buffer.size() - m_bufferConsumed);
+        }
+
+        if (space <= 0) {
+            break;
+        }
+
+        QByteArray data = m_reply->read(qMin(space, READ_CHUNK_SIZE));
+
+        if (data.isEmpty()) {
+            break;
+        }
+
+        if (m_upstreamOffset < m_headSize && m_upstreamOffset == m_head.size()) {
+            m_head.append(data);
+            m_bufferStart = m_upstreamOffset + data.size();
+        }
+        else {
+            if (m_buffer.size() == m_bufferConsumed) {
+                m_buffer.clear();
+                m_bufferStart = m_upstreamOffset;
+                m_bufferConsumed = 0;
+            }
+
+            m_buffer.append(data);
+        }
+
+        m_upstreamOffset += data.size();
+        received = true;
+    }
+
+    if (received) {
+        emit dataAvailable();
+    }
+}
+
+bool PrebufferSource::checkReply()
+{
+    int status = m_reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+
+    if (status == 206) {
+        /* "Content-Range: bytes 1000-1999/2000" */
+        QByteArray range = m_reply->rawHeader("Content-Range");
+        int slash = range.lastIndexOf('/');
+        bool ok;
+        qint64 total = range.mid(slash + 1).toLongLong(&ok);
+
+        if (slash >= 0 && ok) {
+            m_totalSize = total;
+        }
+
+        return true;
+    }
+
+    /* Jos palvelin ei tue Range-pyyntöjä, keskeltä ei voi jatkaa. */
+    if (status == 200 && m_upstreamOffset == 0) {
+        bool ok;
+        qint64 length = m_reply->header(QNetworkRequest::ContentLengthHeader).toLongLong(&ok);
+
+        if (ok) {
+            m_totalSize = length;
+        }
+
+        return true;
+    }
+
+    qWarning() << "Prebuffer: HTTP" << status;
+    return false;
+}
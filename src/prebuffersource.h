@@ -0,0 +1,68 @@
+#ifndef PREBUFFERSOURCE_H
+#define PREBUFFERSOURCE_H
+
+#include <QByteArray>
+#include <QPointer>
+#include <QUrl>
+#include "streamserver.h"
+
+class QNetworkReply;
+class TvkaistaClient;
+
+/* Hakee videon alun muistiin jo ennen kuin soitin käynnistetään. Alku [0, headSize)
+   säilytetään koko ajan. Ennen kuin soitin on liittynyt, siirto pysähtyy alun jälkeen;
+   sen jälkeen yhteys jatkuu rajatun kokoiseen puskuriin, josta soittimen lukemat tavut
+   poistetaan. Jos soitin hyppää puskurin ulkopuolelle,
+   yhteys avataan uudelleen Range-otsakkeella. */
+class PrebufferSource : public StreamSource
+{
+    Q_OBJECT
+public:
+    PrebufferSource(TvkaistaClient *client, const QUrl &url, int programmeId, int format,
+                    QObject *parent = 0);
+    ~PrebufferSource();
+    void setHeadSize(qint64 headSize);
+    qint64 headSize() const;
+    void setBufferSize(qint64 bufferSize);
+    qint64 bufferSize() const;
+    void start();
+    int programmeId() const;
+    int format() const;
+    QUrl url() const;
+    bool hasError() const;
+    qint64 availableAt(qint64 offset) const;
+    void requestAt(qint64 offset);
+    qint64 totalSize() const;
+    bool isComplete() const;
+    QByteArray read(qint64 offset, qint64 maxSize);
+    QByteArray contentType() const;
+
+private slots:
+    void replyReadyRead();
+    void replyFinished();
+
+private:
+    void startRequest(qint64 offset);
+    void abortRequest();
+    void readReply();
+    bool checkReply();
+    TvkaistaClient *m_client;
+    QPointer<QNetworkReply> m_reply;
+    QUrl m_url;
+    int m_programmeId;
+    int m_format;
+    QByteArray m_head;
+    QByteArray m_buffer;
+    qint64 m_headSize;
+    qint64 m_bufferSize;
+    qint64 m_bufferStart;
+    qint64 m_bufferConsumed;
+    qint64 m_upstreamOffset;
+    qint64 m_totalSize;
+    bool m_replyChecked;
+    bool m_playerAttached;
+    bool m_finished;
+    bool m_error;
+};
+
+#endif // PREBUFFERSOURCE_H
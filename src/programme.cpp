@@ -1,9 +1,54 @@
+#include <QMutex>
+#include <QSet>
 #include "programme.h"
 
+static QMutex titlePoolMutex;
+static QSet<QString> titlePool;
+
+/* Varaston enimmäiskoko. Täyttyessään varasto tyhjennetään; jo jaetut nimet
+   säilyvät ohjelmissa, ne vain lakkaavat olemasta varastossa. */
+static const int MAX_POOLED_TITLES = 20000;
+
 Programme::Programme()
 {
+    startTime = -1;
     id = -1;
+    channelId = -1;
     flags = 0;
     duration = -1;
     seasonPassId = -1;
+    descriptionInCache = false;
+}
+
+QDateTime Programme::startDateTime() const
+{
+    if (startTime < 0) {
+        return QDateTime();
+    }
+
+    return QDateTime::fromMSecsSinceEpoch(startTime);
+}
+
+void Programme::setStartDateTime(const QDateTime &dateTime)
+{
+    startTime = dateTime.isValid() ? dateTime.toMSecsSinceEpoch() : -1;
+}
+
+QString Programme::internTitle(const QString &title)
+{
+    /* Sarjojen jaksoilla on sama nimi, joten nimet jaetaan kaikkien
+       ohjelmalistojen kesken yhdestä merkkijonovarastosta. */
+    QMutexLocker locker(&titlePoolMutex);
+    QSet<QString>::const_iterator iter = titlePool.constFind(title);
+
+    if (iter != titlePool.constEnd()) {
+        return *iter;
+    }
+
+    if (titlePool.size() >= MAX_POOLED_TITLES) {
+        titlePool.clear();
+    }
+
+    titlePool.insert(title);
+    return title;
 }
@@ -8,14 +8,20 @@ class Programme
 {
 public:
     Programme();
-    int id;
+    QDateTime startDateTime() const;
+    void setStartDateTime(const QDateTime &dateTime);
+    static QString internTitle(const QString &title);
+    qint64 startTime; /* Alkamisaika millisekunteina epochista, -1 jos ei tiedossa */
     QString title;
     QString description;
-    QDateTime startDateTime;
+    int id;
     int channelId;
     int flags;
     int duration;
     int seasonPassId;
+    bool descriptionInCache; /* Kuvaus on jätetty välimuistitiedostoon ja luetaan tarvittaessa */
 };
 
+Q_DECLARE_TYPEINFO(Programme, Q_MOVABLE_TYPE);
+
 #endif // PROGRAMME_H
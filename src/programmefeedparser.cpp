@@ -66,7 +66,7 @@ void ProgrammeFeedParser::parseItemElement()
 
     while (m_reader.readNextStartElement()) {
         if (m_reader.name() == "title") {
-            programme.title = m_reader.readElementText();
+            programme.title = Programme::internTitle(m_reader.readElementText());
         }
         else if (m_reader.name() == "description") {
             programme.description = m_reader.readElementText();
@@ -79,7 +79,7 @@ void ProgrammeFeedParser::parseItemElement()
             m_reader.skipCurrentElement();
         }
         else if (m_reader.name() == "pubDate") {
-            programme.startDateTime = parseDateTime(m_reader.readElementText());
+            programme.setStartDateTime(parseDateTime(m_reader.readElementText()));
         }
         else if (m_reader.qualifiedName() == "media:group") {
             parseMediaGroupElement(programme);
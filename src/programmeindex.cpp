@@ -0,0 +1,165 @@
+#include <algorithm>
+#include "programmeindex.h"
+
+/* Jos ohjelman kestoa ei tiedetä eikä kanavalla ole seuraavaa ohjelmaa,
+   oletetaan ohjelman kestävän tunnin. */
+static const qint64 DEFAULT_LENGTH = 60 * 60 * 1000;
+
+static bool intervalLessThan(const ProgrammeInterval &a, const ProgrammeInterval &b)
+{
+    return a.start < b.start;
+}
+
+static bool startLessThanInterval(qint64 start, const ProgrammeInterval &a)
+{
+    return start < a.start;
+}
+
+ProgrammeIndex::ProgrammeIndex()
+{
+}
+
+void ProgrammeIndex::clear()
+{
+    m_days.clear();
+}
+
+bool ProgrammeIndex::containsDay(const QDate &date) const
+{
+    QHash<QDate, DayIndex>::const_iterator iter = m_days.constFind(date);
+    return iter != m_days.constEnd() && iter->loaded;
+}
+
+bool ProgrammeIndex::containsChannel(int channelId, const QDate &date) const
+{
+    QHash<QDate, DayIndex>::const_iterator iter = m_days.constFind(date);
+    return iter != m_days.constEnd() && iter->channels.contains(channelId);
+}
+
+void ProgrammeIndex::setDayLoaded(const QDate &date)
+{
+    m_days[date].loaded = true;
+}
+
+void ProgrammeIndex::setProgrammes(int channelId, const QDate &date, const ProgrammeSnapshot &programmes)
+{
+    DayIndex &day = m_days[date];
+    QVector<ProgrammeInterval> channel;
+    int count = programmes.size();
+    channel.reserve(count);
+
+    for (int i = 0; i < count; i++) {
+        const Programme &programme = programmes.at(i);
+
+        if (programme.startTime < 0) {
+            continue;
+        }
+
+        ProgrammeInterval interval;
+        interval.start = programme.startTime;
+        interval.end = programme.duration > 0 ? programme.startTime + programme.duration * 1000LL : -1;
+        interval.channelId = channelId;
+        interval.index = i;
+        channel.append(interval);
+    }
+
+    std::stable_sort(channel.begin(), channel.end(), intervalLessThan);
+    count = channel.size();
+
+    for (int i = 0; i < count; i++) {
+        ProgrammeInterval &interval = channel[i];
+
+        if (interval.end < 0) {
+            interval.end = i + 1 < count ? channel.at(i + 1).start : interval.start + DEFAULT_LENGTH;
+        }
+    }
+
+    /* Päivitys korvaa vain tämän kanavan taulukon. */
+    day.channels.insert(channelId, channel);
+    day.snapshots.insert(channelId, programmes);
+}
+
+void ProgrammeIndex::removeDaysOutside(const QDate &first, const QDate &last)
+{
+    QHash<QDate, DayIndex>::iterator iter = m_days.begin();
+
+    while (iter != m_days.end()) {
+        if (iter.key() < first || iter.key() > last) {
+            iter = m_days.erase(iter);
+        }
+        else {
+            ++iter;
+        }
+    }
+}
+
+void ProgrammeIndex::programmesBetween(const QDate &date, qint64 from, qint64 to,
+                                       QList<Programme> &programmes) const
+{
+    QHash<QDate, DayIndex>::const_iterator iter = m_days.constFind(date);
+
+    if (iter == m_days.constEnd()) {
+        return;
+    }
+
+    const DayIndex &day = *iter;
+    QHash<int, QVector<ProgrammeInterval> >::const_iterator channelIter = day.channels.constBegin();
+
+    while (channelIter != day.channels.constEnd()) {
+        const QVector<ProgrammeInterval> &channel = channelIter.value();
+        const ProgrammeInterval *begin = channel.constData();
+        const ProgrammeInterval *end = begin + channel.size();
+        const ProgrammeInterval *i = std::upper_bound(begin, end, from, startLessThanInterval);
+        ProgrammeSnapshot snapshot = day.snapshots.value(channelIter.key());
+
+        /* Kanavan ohjelmat eivät mene päällekkäin, joten hetkellä from käynnissä oleva
+           ohjelma on viimeinen ennen sitä alkanut. */
+        if (i != begin && (i - 1)->end > from) {
+            --i;
+        }
+
+        for (; i != end && i->start < to; ++i) {
+            if (i->end > from) {
+                programmes.append(snapshot.at(i->index));
+            }
+        }
+
+        ++channelIter;
+    }
+}
+
+void ProgrammeIndex::nowAndNext(const QDate &date, qint64 time, QHash<int, Programme> &now,
+                                QHash<int, Programme> &next) const
+{
+    QHash<QDate, DayIndex>::const_iterator iter = m_days.constFind(date);
+
+    if (iter == m_days.constEnd()) {
+        return;
+    }
+
+    const DayIndex &day = *iter;
+    QHash<int, QVector<ProgrammeInterval> >::const_iterator channelIter = day.channels.constBegin();
+
+    while (channelIter != day.channels.constEnd()) {
+        int channelId = channelIter.key();
+        const QVector<ProgrammeInterval> &channel = channelIter.value();
+        const ProgrammeInterval *begin = channel.constData();
+        const ProgrammeInterval *end = begin + channel.size();
+        const ProgrammeInterval *i = std::upper_bound(begin, end, time, startLessThanInterval);
+        ProgrammeSnapshot snapshot = day.snapshots.value(channelId);
+
+        if (i != begin && (i - 1)->end > time && !now.contains(channelId)) {
+            now.insert(channelId, snapshot.at((i - 1)->index));
+        }
+
+        if (i != end) {
+            QHash<int, Programme>::iterator nextIter = next.find(channelId);
+
+            if (nextIter == next.end() || nextIter->startTime > i->start) {
+                next.insert(channelId, snapshot.at(i->index));
+            }
+        }
+
+        ++channelIter;
+    }
+}
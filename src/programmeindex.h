@@ -0,0 +1,50 @@
+#ifndef PROGRAMMEINDEX_H
+#define PROGRAMMEINDEX_H
+
+#include <QDate>
+#include <QHash>
+#include <QList>
+#include <QVector>
+#include "programmesnapshot.h"
+
+struct ProgrammeInterval
+{
+    qint64 start;
+    qint64 end;
+    int channelId;
+    int index;
+};
+
+Q_DECLARE_TYPEINFO(ProgrammeInterval, Q_PRIMITIVE_TYPE);
+
+/* Päiväkohtainen aikaväli-indeksi välimuistissa olevista ohjelmista. Jokaisen kanavan
+   ohjelmat ovat alkamisajan mukaan järjestetyssä taulukossa, joten aikavälin
+   ensimmäinen sekä meneillään oleva ja seuraava ohjelma löytyvät kanavakohtaisella
+   binäärihaulla. */
+class ProgrammeIndex
+{
+public:
+    ProgrammeIndex();
+    void clear();
+    bool containsDay(const QDate &date) const;
+    bool containsChannel(int channelId, const QDate &date) const;
+    void setDayLoaded(const QDate &date);
+    void setProgrammes(int channelId, const QDate &date, const ProgrammeSnapshot &programmes);
+    void removeDaysOutside(const QDate &first, const QDate &last);
+    void programmesBetween(const QDate &date, qint64 from, qint64 to, QList<Programme> &programmes) const;
+    void nowAndNext(const QDate &date, qint64 time, QHash<int, Programme> &now,
+                    QHash<int, Programme> &next) const;
+
+private:
+    struct DayIndex
+    {
+        DayIndex() : loaded(false) {}
+        QHash<int, ProgrammeSnapshot> snapshots;
+        QHash<int, QVector<ProgrammeInterval> > channels;
+        bool loaded;
+    };
+
+    QHash<QDate, DayIndex> m_days;
+};
+
+#endif // PROGRAMMEINDEX_H
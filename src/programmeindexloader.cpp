@@ -0,0 +1,108 @@
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QRunnable>
+#include "cache.h"
+#include "programmeindexloader.h"
+
+class ProgrammeIndexTask : public QRunnable
+{
+public:
+    ProgrammeIndexTask(ProgrammeIndexLoader *loader, const QDir &dir, const QDate &date) :
+        m_loader(loader), m_dir(dir), m_date(date)
+    {
+    }
+
+    void run()
+    {
+        QElapsedTimer timer;
+        timer.start();
+
+        /* Oma välimuistiolio, jotta pääikkunan välimuistin hakemiston vaihtaminen ei
+           vaikuta kesken olevaan lukuun. Vanhentuneetkin tiedot kelpaavat, koska ne
+           korvataan seuraavan tallennuksen yhteydessä. */
+        Cache cache;
+        cache.setDirectory(m_dir);
+        QList<int> channelIds = cache.readChannelIds(m_date);
+        int count = channelIds.size();
+
+        for (int i = 0; i < count; i++) {
+            bool ok;
+            int age;
+            ProgrammeSnapshot programmes = cache.readProgrammes(channelIds.at(i), m_date, ok, age, true);
+
+            if (ok) {
+                QMetaObject::invokeMethod(m_loader, "channelLoaded", Qt::QueuedConnection,
+                                          Q_ARG(QString, m_dir.path()), Q_ARG(QDate, m_date),
+                                          Q_ARG(int, channelIds.at(i)),
+                                          Q_ARG(ProgrammeSnapshot, programmes));
+            }
+        }
+
+        qDebug() << "INDEX" << m_date << count << "channels" << timer.elapsed() << "ms";
+        QMetaObject::invokeMethod(m_loader, "dayLoaded", Qt::QueuedConnection,
+                                  Q_ARG(QString, m_dir.path()), Q_ARG(QDate, m_date));
+    }
+
+private:
+    ProgrammeIndexLoader *m_loader;
+    QDir m_dir;
+    QDate m_date;
+};
+
+ProgrammeIndexLoader::ProgrammeIndexLoader(Cache *cache, QObject *parent) :
+    QObject(parent), m_cache(cache)
+{
+    qRegisterMetaType<ProgrammeSnapshot>("ProgrammeSnapshot");
+    m_threadPool.setMaxThreadCount(1);
+}
+
+ProgrammeIndexLoader::~ProgrammeIndexLoader()
+{
+    m_threadPool.clear();
+    m_threadPool.waitForDone();
+}
+
+/* Palauttaa true, jos kaikki päivät ovat jo indeksissä. Muuten puuttuvat päivät
+   luetaan taustalla ja jokaisesta ilmoitetaan dayIndexed-signaalilla. */
+bool ProgrammeIndexLoader::load(const QDate &first, const QDate &last)
+{
+    bool ready = true;
+
+    for (QDate date = first; date <= last; date = date.addDays(1)) {
+        if (!m_cache->needsIndexing(date)) {
+            continue;
+        }
+
+        ready = false;
+
+        if (!m_pendingDays.contains(date)) {
+            m_pendingDays.insert(date);
+            m_threadPool.start(new ProgrammeIndexTask(this, m_cache->directory(), date));
+        }
+    }
+
+    return ready;
+}
+
+void ProgrammeIndexLoader::channelLoaded(const QString &dirPath, const QDate &date, int channelId,
+                                         const ProgrammeSnapshot &programmes)
+{
+    /* Hakemisto on vaihtunut luvun aikana. */
+    if (QDir(dirPath) != m_cache->directory()) {
+        return;
+    }
+
+    m_cache->setIndexedProgrammes(channelId, date, programmes);
+}
+
+void ProgrammeIndexLoader::dayLoaded(const QString &dirPath, const QDate &date)
+{
+    m_pendingDays.remove(date);
+
+    if (QDir(dirPath) != m_cache->directory()) {
+        return;
+    }
+
+    m_cache->setDayIndexed(date);
+    emit dayIndexed(date);
+}
@@ -0,0 +1,36 @@
+#ifndef PROGRAMMEINDEXLOADER_H
+#define PROGRAMMEINDEXLOADER_H
+
+#include <QDate>
+#include <QObject>
+#include <QSet>
+#include <QThreadPool>
+#include "programmesnapshot.h"
+
+class Cache;
+
+/* Lukee välimuistin aikaväli-indeksistä puuttuvien päivien kaikkien kanavien tiedostot
+   taustasäikeessä ja lisää ne pääikkunan välimuistin indeksiin. */
+class ProgrammeIndexLoader : public QObject
+{
+    Q_OBJECT
+public:
+    ProgrammeIndexLoader(Cache *cache, QObject *parent = 0);
+    ~ProgrammeIndexLoader();
+    bool load(const QDate &first, const QDate &last);
+
+signals:
+    void dayIndexed(const QDate &date);
+
+private slots:
+    void channelLoaded(const QString &dirPath, const QDate &date, int channelId,
+                       const ProgrammeSnapshot &programmes);
+    void dayLoaded(const QString &dirPath, const QDate &date);
+
+private:
+    Cache *m_cache;
+    QThreadPool m_threadPool;
+    QSet<QDate> m_pendingDays;
+};
+
+#endif // PROGRAMMEINDEXLOADER_H
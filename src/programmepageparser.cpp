@@ -0,0 +1,53 @@
+#include "programmepageparser.h"
+#include "programmesnapshot.h"
+#include "programmetableparser.h"
+
+ProgrammePageParser::ProgrammePageParser(QObject *parent) :
+    QObject(parent), m_parser(new ProgrammeTableParser), m_parseTime(0), m_requestId(-1)
+{
+}
+
+ProgrammePageParser::~ProgrammePageParser()
+{
+    delete m_parser;
+}
+
+void ProgrammePageParser::start(int requestId, int channelId, const QDate &date)
+{
+    m_parser->clear();
+    m_parser->setRequestedDate(date);
+    m_parser->setRequestedChannelId(channelId);
+    m_requestId = requestId;
+    m_parseTime = 0;
+}
+
+void ProgrammePageParser::feed(int requestId, const QByteArray &data)
+{
+    /* Keskeytetyn pyynnön myöhässä saapuneet tavut ohitetaan. */
+    if (requestId != m_requestId) {
+        return;
+    }
+
+    m_timer.start();
+    m_parser->parse(data);
+    m_parseTime += m_timer.nsecsElapsed();
+}
+
+void ProgrammePageParser::finish(int requestId)
+{
+    if (requestId != m_requestId) {
+        return;
+    }
+
+    QVariantList days;
+    bool valid = m_parser->isValidResults();
+
+    for (int i = 0; i < 7; i++) {
+        days.append(QVariant::fromValue(ProgrammeSnapshot(m_parser->programmes(i))));
+    }
+
+    emit pageParsed(requestId, m_parser->requestedChannelId(), m_parser->requestedDate(),
+                    valid, days, m_parseTime);
+    m_parser->clear();
+    m_requestId = -1;
+}
@@ -0,0 +1,40 @@
+#ifndef PROGRAMMEPAGEPARSER_H
+#define PROGRAMMEPAGEPARSER_H
+
+#include <QDate>
+#include <QElapsedTimer>
+#include <QObject>
+#include <QVariantList>
+
+class ProgrammeTableParser;
+
+/* Jäsentää kanavan viikkosivun omassa säikeessään. Verkosta luetut tavut tuodaan
+   jonotettuina kutsuina, ja valmiit päiväkohtaiset listat palautetaan signaalilla. */
+class ProgrammePageParser : public QObject
+{
+    Q_OBJECT
+public:
+    explicit ProgrammePageParser(QObject *parent = 0);
+    ~ProgrammePageParser();
+
+public slots:
+    void start(int requestId, int channelId, const QDate &date);
+    void feed(int requestId, const QByteArray &data);
+    void finish(int requestId);
+
+signals:
+    /**
+     * days sisältää seitsemän ProgrammeSnapshot-listaa alkaen päivästä date - 3.
+     * Jos valid on false, sivu ei ollut kelvollinen eikä listoja tule tallentaa.
+     */
+    void pageParsed(int requestId, int channelId, const QDate &date, bool valid,
+                    const QVariantList &days, qint64 parseTime);
+
+private:
+    ProgrammeTableParser *m_parser;
+    QElapsedTimer m_timer;
+    qint64 m_parseTime;
+    int m_requestId;
+};
+
+#endif // PROGRAMMEPAGEPARSER_H
@@ -0,0 +1,144 @@
+#include <QHash>
+#include <QMutex>
+#include <QSharedData>
+#include <QStringList>
+#include <algorithm>
+#include "programmesnapshot.h"
+
+class ProgrammeSnapshotData : public QSharedData
+{
+public:
+    ProgrammeSnapshotData(const QList<Programme> &list) : programmes(list) {}
+    const QList<Programme> programmes;
+    QMutex mutex;
+    QVector<int> sorted[3];
+};
+
+/* Järjestäminen tehdään kevyillä avaimilla: nimi korvataan sen järjestysnumerolla
+   erilaisten nimien joukossa, joten vertailu on pelkkiä kokonaislukuvertailuja. */
+struct ProgrammeSortKey
+{
+    qint64 primary;
+    qint64 secondary;
+    int index;
+};
+
+Q_DECLARE_TYPEINFO(ProgrammeSortKey, Q_PRIMITIVE_TYPE);
+
+static bool sortKeyLessThan(const ProgrammeSortKey &a, const ProgrammeSortKey &b)
+{
+    return a.primary < b.primary || (a.primary == b.primary && a.secondary < b.secondary);
+}
+
+static QVector<int> titleRanks(const QList<Programme> &programmes)
+{
+    QHash<QString, int> ranks;
+    int count = programmes.size();
+
+    for (int i = 0; i < count; i++) {
+        ranks.insert(programmes.at(i).title, 0);
+    }
+
+    QStringList titles = ranks.keys();
+    std::sort(titles.begin(), titles.end());
+    int titleCount = titles.size();
+
+    for (int i = 0; i < titleCount; i++) {
+        ranks.insert(titles.at(i), i);
+    }
+
+    QVector<int> result(count);
+
+    for (int i = 0; i < count; i++) {
+        result[i] = ranks.value(programmes.at(i).title);
+    }
+
+    return result;
+}
+
+ProgrammeSnapshot::ProgrammeSnapshot() : d(0)
+{
+}
+
+ProgrammeSnapshot::ProgrammeSnapshot(const QList<Programme> &programmes) :
+    d(programmes.isEmpty() ? 0 : new ProgrammeSnapshotData(programmes))
+{
+}
+
+ProgrammeSnapshot::ProgrammeSnapshot(const ProgrammeSnapshot &other) : d(other.d)
+{
+}
+
+ProgrammeSnapshot::~ProgrammeSnapshot()
+{
+}
+
+ProgrammeSnapshot& ProgrammeSnapshot::operator=(const ProgrammeSnapshot &other)
+{
+    d = other.d;
+    return *this;
+}
+
+bool ProgrammeSnapshot::isEmpty() const
+{
+    return !d;
+}
+
+int ProgrammeSnapshot::size() const
+{
+    return d ? d->programmes.size() : 0;
+}
+
+const Programme& ProgrammeSnapshot::at(int index) const
+{
+    return d->programmes.at(index);
+}
+
+QList<Programme> ProgrammeSnapshot::toList() const
+{
+    return d ? d->programmes : QList<Programme>();
+}
+
+QVector<int> ProgrammeSnapshot::sortedIndexes(int sortKey) const
+{
+    /* 0 = alkuperäinen järjestys, 1 = aika ja nimi, 2 = nimi ja aika */
+    if (!d) {
+        return QVector<int>();
+    }
+
+    if (sortKey < 0 || sortKey > 2) {
+        sortKey = 0;
+    }
+
+    QMutexLocker locker(&d->mutex);
+    QVector<int> &indexes = d->sorted[sortKey];
+
+    if (indexes.isEmpty()) {
+        int count = d->programmes.size();
+        indexes.resize(count);
+
+        for (int i = 0; i < count; i++) {
+            indexes[i] = i;
+        }
+
+        if (sortKey > 0) {
+            QVector<int> ranks = titleRanks(d->programmes);
+            QVector<ProgrammeSortKey> keys(count);
+
+            for (int i = 0; i < count; i++) {
+                qint64 startTime = d->programmes.at(i).startTime;
+                keys[i].primary = sortKey == 2 ? ranks.at(i) : startTime;
+                keys[i].secondary = sortKey == 2 ? startTime : ranks.at(i);
+                keys[i].index = i;
+            }
+
+            std::stable_sort(keys.begin(), keys.end(), sortKeyLessThan);
+
+            for (int i = 0; i < count; i++) {
+                indexes[i] = keys.at(i).index;
+            }
+        }
+    }
+
+    return indexes;
+}
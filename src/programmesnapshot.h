@@ -0,0 +1,35 @@
+#ifndef PROGRAMMESNAPSHOT_H
+#define PROGRAMMESNAPSHOT_H
+
+#include <QExplicitlySharedDataPointer>
+#include <QList>
+#include <QMetaType>
+#include <QVector>
+#include "programme.h"
+
+class ProgrammeSnapshotData;
+
+/* Muuttumaton, implisiittisesti jaettu ohjelmalista. Sama lista kulkee jäsentimeltä
+   välimuistiin ja malleille kopioimatta, ja järjestetyt näkymät lasketaan vasta
+   tarvittaessa. */
+class ProgrammeSnapshot
+{
+public:
+    ProgrammeSnapshot();
+    ProgrammeSnapshot(const QList<Programme> &programmes);
+    ProgrammeSnapshot(const ProgrammeSnapshot &other);
+    ~ProgrammeSnapshot();
+    ProgrammeSnapshot& operator=(const ProgrammeSnapshot &other);
+    bool isEmpty() const;
+    int size() const;
+    const Programme& at(int index) const;
+    QList<Programme> toList() const;
+    QVector<int> sortedIndexes(int sortKey) const;
+
+private:
+    QExplicitlySharedDataPointer<ProgrammeSnapshotData> d;
+};
+
+Q_DECLARE_METATYPE(ProgrammeSnapshot)
+
+#endif // PROGRAMMESNAPSHOT_H
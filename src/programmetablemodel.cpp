@@ -3,9 +3,13 @@
 #include "historymanager.h"
 #include "programmetablemodel.h"
 
+/* Rivit tuodään näkymään tämän kokoisina erinä sitä mukaa kuin niitä vieritetään
+   esiin. Lajittelujärjestys lasketaan silti heti koko listalle. */
+static const int FETCH_PAGE_SIZE = 200;
+
 ProgrammeTableModel::ProgrammeTableModel(HistoryManager *historyManager,
                                          bool detailsVisible, QObject *parent) :
-    QAbstractTableModel(parent), m_historyManager(historyManager),
+    QAbstractTableModel(parent), m_historyManager(historyManager), m_loadedRows(0),
     m_detailsVisible(detailsVisible),
     m_format(3), m_flagMask(0x08), m_sortKey(0), m_descending(false)
 {
@@ -14,7 +18,7 @@ ProgrammeTableModel::ProgrammeTableModel(HistoryManager *historyManager,
 int ProgrammeTableModel::rowCount(const QModelIndex &parent) const
 {
     Q_UNUSED(parent);
-    return m_infoText.isEmpty() ? m_programmes.size() : 1;
+    return m_infoText.isEmpty() ? m_loadedRows : 1;
 }
 
 int ProgrammeTableModel::columnCount(const QModelIndex &parent) const
@@ -33,20 +37,20 @@ QVariant ProgrammeTableModel::data(const QModelIndex &index, int role) const
         }
     }
 
-    if (row < 0 || row >= m_programmes.size()) {
+    if (row < 0 || row >= m_loadedRows) {
         return QVariant();
     }
 
-    if (role == Qt::DisplayRole) {
-        Programme programme = m_programmes.value(row);
+    const Programme &programme = m_programmes.at(m_rows.at(row));
 
+    if (role == Qt::DisplayRole) {
         if (m_detailsVisible) {
             switch (index.column()) {
             case 0:
-                return programme.startDateTime.toString(tr("ddd dd.MM.yyyy "));
+                return programme.startDateTime().toString(tr("ddd dd.MM.yyyy "));
 
             case 1:
-                return programme.startDateTime.toString(tr("h.mm "));
+                return programme.startDateTime().toString(tr("h.mm "));
 
             case 2:
                 return programme.title;
@@ -58,7 +62,7 @@ QVariant ProgrammeTableModel::data(const QModelIndex &index, int role) const
         else {
             switch (index.column()) {
             case 0:
-                return programme.startDateTime.toString(tr("h.mm"));
+                return programme.startDateTime().toString(tr("h.mm"));
 
             case 1:
                 return programme.title;
@@ -77,8 +81,6 @@ QVariant ProgrammeTableModel::data(const QModelIndex &index, int role) const
         }
     }
     else if (role == Qt::ForegroundRole) {
-        Programme programme = m_programmes.value(row);
-
         if ((programme.flags & m_flagMask) > 0 || m_removedRows.contains(row)) {
             return QColor(Qt::darkGray);
         }
@@ -105,6 +107,36 @@ Qt::ItemFlags ProgrammeTableModel::flags(const QModelIndex &index) const
     return Qt::ItemIsSelectable | Qt::ItemIsEnabled;
 }
 
+bool ProgrammeTableModel::canFetchMore(const QModelIndex &parent) const
+{
+    return !parent.isValid() && m_infoText.isEmpty() && m_loadedRows < m_rows.size();
+}
+
+void ProgrammeTableModel::fetchMore(const QModelIndex &parent)
+{
+    if (!canFetchMore(parent)) {
+        return;
+    }
+
+    int count = qMin(FETCH_PAGE_SIZE, m_rows.size() - m_loadedRows);
+    beginInsertRows(QModelIndex(), m_loadedRows, m_loadedRows + count - 1);
+    m_loadedRows += count;
+    endInsertRows();
+}
+
+void ProgrammeTableModel::fetchUntil(int row)
+{
+    /* Ladataan sivut, joista viimeinen sisältää annetun rivin. */
+    if (!canFetchMore(QModelIndex()) || row < m_loadedRows) {
+        return;
+    }
+
+    int loadedRows = qMin(m_rows.size(), (row / FETCH_PAGE_SIZE + 1) * FETCH_PAGE_SIZE);
+    beginInsertRows(QModelIndex(), m_loadedRows, loadedRows - 1);
+    m_loadedRows = loadedRows;
+    endInsertRows();
+}
+
 void ProgrammeTableModel::setFormat(int format)
 {
     m_format = format;
@@ -135,9 +167,28 @@ void ProgrammeTableModel::setSortKey(int key, bool descending)
     m_sortKey = key;
     m_descending = descending;
 
-    if (!m_programmes.isEmpty()) {
-        QList<Programme> copy = m_programmes;
-        setProgrammes(copy);
+    if (m_loadedRows > 0) {
+        /* Poistetuiksi merkityt rivit seuraavat ohjelmiaan uuteen järjestykseen. */
+        QSet<int> removedProgrammes;
+        QSet<int>::const_iterator iter = m_removedRows.constBegin();
+
+        while (iter != m_removedRows.constEnd()) {
+            removedProgrammes.insert(m_rows.at(*iter));
+            ++iter;
+        }
+
+        updateRows();
+        m_removedRows.clear();
+        int count = m_rows.size();
+
+        for (int i = 0; i < count && !removedProgrammes.isEmpty(); i++) {
+            if (removedProgrammes.contains(m_rows.at(i))) {
+                m_removedRows.insert(i);
+            }
+        }
+
+        emit dataChanged(index(0, 0, QModelIndex()),
+             index(m_loadedRows - 1, columnCount(QModelIndex()) - 1, QModelIndex()));
     }
 }
 
@@ -151,75 +202,46 @@ bool ProgrammeTableModel::isDescending() const
     return m_descending;
 }
 
-void ProgrammeTableModel::setProgrammes(const QList<Programme> &programmes)
+void ProgrammeTableModel::setProgrammes(const ProgrammeSnapshot &programmes)
 {
     setInfoText(QString());
-    bool numRowsChanged = (m_programmes.size() != programmes.size());
-
-    if (!m_programmes.isEmpty()) {
-        if (numRowsChanged) {
-            beginRemoveRows(QModelIndex(), 0, m_programmes.size() - 1);
-        }
-
-        m_programmes.clear();
-
-        if (numRowsChanged) {
-            endRemoveRows();
-        }
+    int loadedRows = qMin(programmes.size(), FETCH_PAGE_SIZE);
+    bool numRowsChanged = (m_loadedRows != loadedRows);
+
+    if (m_loadedRows > 0 && numRowsChanged) {
+        beginRemoveRows(QModelIndex(), 0, m_loadedRows - 1);
+        m_programmes = ProgrammeSnapshot();
+        m_rows.clear();
+        m_loadedRows = 0;
+        endRemoveRows();
     }
 
-    if (!programmes.isEmpty()) {
-        if (numRowsChanged) {
-            beginInsertRows(QModelIndex(), 0, programmes.size() - 1);
-        }
-
-        QList<Programme> tmp;
-        int count = programmes.size();
-
-        if (m_sortKey == 1) {
-            QMap<QPair<QDateTime, QString>, Programme> sortMap;
-
-            for (int i = 0; i < count; i++) {
-                Programme programme = programmes.at(i);
-                sortMap.insertMulti(QPair<QDateTime, QString>(programme.startDateTime, programme.title), programme);
-            }
-
-            tmp = sortMap.values();
-        }
-        else if (m_sortKey == 2) {
-            QMap<QPair<QString, QDateTime>, Programme> sortMap;
-
-            for (int i = 0; i < count; i++) {
-                Programme programme = programmes.at(i);
-                sortMap.insertMulti(QPair<QString, QDateTime>(programme.title, programme.startDateTime), programme);
-            }
+    if (programmes.isEmpty()) {
+        m_programmes = ProgrammeSnapshot();
+        m_rows.clear();
+        m_loadedRows = 0;
+        return;
+    }
 
-            tmp = sortMap.values();
-        }
-        else {
-            tmp = programmes;
-        }
+    if (numRowsChanged) {
+        beginInsertRows(QModelIndex(), 0, loadedRows - 1);
+    }
 
-        if (m_descending) {
-            for (int i = count - 1; i >= 0; i--) {
-                m_programmes.append(tmp.at(i));
-            }
-        }
-        else {
-            m_programmes = tmp;
-        }
+    /* Lista jaetaan lähettäjän kanssa, järjestys pidetään erillisenä indeksitaulukkona. */
+    m_programmes = programmes;
+    updateRows();
+    m_loadedRows = loadedRows;
 
-        if (numRowsChanged) {
-            endInsertRows();
-        }
-        else {
-            emit dataChanged(index(0, 0, QModelIndex()),
-                 index(m_programmes.size() - 1, columnCount(QModelIndex()) - 1, QModelIndex()));
-        }
+    if (numRowsChanged) {
+        endInsertRows();
+    }
+    else {
+        emit dataChanged(index(0, 0, QModelIndex()),
+             index(m_loadedRows - 1, columnCount(QModelIndex()) - 1, QModelIndex()));
     }
 }
 
-QList<Programme> ProgrammeTableModel::programmes() const
+ProgrammeSnapshot ProgrammeTableModel::programmes() const
 {
     return m_programmes;
 }
@@ -227,56 +249,65 @@ QList<Programme> ProgrammeTableModel::programmes() const
 void ProgrammeTableModel::setSeasonPasses(const QMap<QString, int> &seasonPasses)
 {
     QList<QString> keys = seasonPasses.keys();
-    int programmeCount = m_programmes.size();
+    QList<Programme> programmes = m_programmes.toList();
+    int programmeCount = programmes.size();
     int seasonPassCount = seasonPasses.size();
 
     for (int i = 0; i < programmeCount; i++) {
-        Programme programme = m_programmes.at(i);
+        Programme &programme = programmes[i];
 
         for (int j = 0; j < seasonPassCount; j++) {
             QString seasonPassTitle = keys.at(j);
 
             if (programme.title.startsWith(seasonPassTitle)) {
                 programme.seasonPassId = seasonPasses.value(keys.at(j));
-                m_programmes.replace(i, programme);
             }
         }
     }
+
+    /* Järjestys ei muutu, joten rivit osoittavat edelleen samoihin ohjelmiin. */
+    m_programmes = ProgrammeSnapshot(programmes);
 }
 
 void ProgrammeTableModel::setRemovedByProgrammeId(int programmeId)
 {
-    int count = m_programmes.size();
+    int count = m_rows.size();
     int lastColumn = columnCount(QModelIndex()) - 1;
 
     for (int i = 0; i < count; i++) {
-        Programme programme = m_programmes.at(i);
+        const Programme &programme = m_programmes.at(m_rows.at(i));
 
         if (programme.id == programmeId) {
             m_removedRows.insert(i);
-            emit dataChanged(index(i, 0, QModelIndex()), index(i, lastColumn, QModelIndex()));
+
+            if (i < m_loadedRows) {
+                emit dataChanged(index(i, 0, QModelIndex()), index(i, lastColumn, QModelIndex()));
+            }
         }
     }
 }
 
 void ProgrammeTableModel::setRemovedBySeasonPassId(int seasonPassId)
 {
-    int count = m_programmes.size();
+    int count = m_rows.size();
     int lastColumn = columnCount(QModelIndex()) - 1;
 
     for (int i = 0; i < count; i++) {
-        Programme programme = m_programmes.at(i);
+        const Programme &programme = m_programmes.at(m_rows.at(i));
 
         if (programme.seasonPassId == seasonPassId) {
             m_removedRows.insert(i);
-            emit dataChanged(index(i, 0, QModelIndex()), index(i, lastColumn, QModelIndex()));
+
+            if (i < m_loadedRows) {
+                emit dataChanged(index(i, 0, QModelIndex()), index(i, lastColumn, QModelIndex()));
+            }
         }
     }
 }
 
 int ProgrammeTableModel::programmeCount() const
 {
-    return m_programmes.size();
+    return m_rows.size();
 }
 
 void ProgrammeTableModel::setInfoText(const QString &text)
@@ -289,7 +320,7 @@ void ProgrammeTableModel::setInfoText(const QString &text)
         endRemoveRows();
     }
     else if (!text.isEmpty() && m_infoText.isEmpty()) { /* Jos teksti lisätty */
-        setProgrammes(QList<Programme>());
+        setProgrammes(ProgrammeSnapshot());
         beginInsertRows(QModelIndex(), 0, 0);
         m_infoText = text;
         endInsertRows();
@@ -307,22 +338,28 @@ QString ProgrammeTableModel::infoText() const
 
 Programme ProgrammeTableModel::programme(int index) const
 {
-    return m_programmes.value(index);
+    if (index < 0 || index >= m_rows.size()) {
+        return Programme();
+    }
+
+    return m_programmes.at(m_rows.at(index));
 }
 
 int ProgrammeTableModel::defaultProgrammeIndex() const
 {
-    int count = m_programmes.size();
+    int count = m_rows.size();
     int index = -1;
 
     for (int i = 0; i < count; i++) {
-        if ((m_programmes.at(i).flags & 0x08) > 0) {
+        const Programme &programme = m_programmes.at(m_rows.at(i));
+
+        if ((programme.flags & 0x08) > 0) {
             continue;
         }
 
         index = i;
 
-        if (m_programmes.at(i).startDateTime.time().hour() >= 18) {
+        if (programme.startDateTime().time().hour() >= 18) {
             return i;
         }
     }
@@ -332,8 +369,23 @@ int ProgrammeTableModel::defaultProgrammeIndex() const
 
 void ProgrammeTableModel::updateHistory()
 {
-    if (!m_programmes.isEmpty()) {
+    if (m_loadedRows > 0) {
         emit dataChanged(index(0, 0, QModelIndex()),
-                         index(m_programmes.size() - 1, 0, QModelIndex()));
+                         index(m_loadedRows - 1, 0, QModelIndex()));
     }
 }
+
+void ProgrammeTableModel::updateRows()
+{
+    QVector<int> rows = m_programmes.sortedIndexes(m_sortKey);
+
+    if (m_descending) {
+        int count = rows.size();
+
+        for (int i = 0; i < count / 2; i++) {
+            qSwap(rows[i], rows[count - 1 - i]);
+        }
+    }
+
+    m_rows = rows;
+}
@@ -3,7 +3,7 @@
 
 #include <QAbstractTableModel>
 #include <QSet>
-#include "programme.h"
+#include "programmesnapshot.h"
 
 class QSettings;
 class HistoryManager;
@@ -18,13 +18,16 @@ public:
     QVariant data(const QModelIndex &index, int role) const;
     QVariant headerData(int section, Qt::Orientation orientation, int role) const;
     Qt::ItemFlags flags(const QModelIndex &index) const;
+    bool canFetchMore(const QModelIndex &parent) const;
+    void fetchMore(const QModelIndex &parent);
+    void fetchUntil(int row);
     void setFormat(int format);
     int format() const;
     void setSortKey(int key, bool descending);
     int sortKey() const;
     bool isDescending() const;
-    void setProgrammes(const QList<Programme> &programmes);
-    QList<Programme> programmes() const;
+    void setProgrammes(const ProgrammeSnapshot &programmes);
+    ProgrammeSnapshot programmes() const;
     void setSeasonPasses(const QMap<QString, int> &seasonPasses);
     void setRemovedByProgrammeId(int programmeId);
     void setRemovedBySeasonPassId(int seasonPassId);
@@ -36,8 +39,11 @@ public:
     void updateHistory();
 
 private:
+    void updateRows();
     HistoryManager *m_historyManager;
-    QList<Programme> m_programmes;
+    ProgrammeSnapshot m_programmes;
+    QVector<int> m_rows;
+    int m_loadedRows;
     QSet<int> m_removedRows;
     QString m_infoText;
     bool m_detailsVisible;
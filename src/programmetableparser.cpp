@@ -2,6 +2,69 @@
 #include <QRegExp>
 #include "programmetableparser.h"
 
+/* Sivulla tarvittavien elementtien tunnisteet. Tiivisteet lasketaan käännösaikana, ja
+   päällekkäiset tiivisteet aiheuttaisivat käännösvirheen switch-lauseessa. */
+enum HtmlTag
+{
+    TagOther = 0,
+    TagDiv,
+    TagTr,
+    TagTd,
+    TagSpan,
+    TagTable
+};
+
+static int tagId(const QByteArray &name)
+{
+    switch (htmlNameHash(name.constData(), name.size())) {
+    case htmlNameHash("div"):
+        return name == "div" ? TagDiv : TagOther;
+
+    case htmlNameHash("tr"):
+        return name == "tr" ? TagTr : TagOther;
+
+    case htmlNameHash("td"):
+        return name == "td" ? TagTd : TagOther;
+
+    case htmlNameHash("span"):
+        return name == "span" ? TagSpan : TagOther;
+
+    case htmlNameHash("table"):
+        return name == "table" ? TagTable : TagOther;
+
+    default:
+        return TagOther;
+    }
+}
+
+static inline constexpr int stateTag(int state, int tag)
+{
+    return (state << 3) | tag;
+}
+
+static int classTokenFlags(const char *s, int len)
+{
+    switch (htmlNameHash(s, len)) {
+    case htmlNameHash("upcoming"):
+        return len == 8 && qstrncmp(s, "upcoming", 8) == 0 ? 0xF : 0;
+
+    case htmlNameHash("nof0"):
+        return len == 4 && qstrncmp(s, "nof0", 4) == 0 ? 0x01 : 0;
+
+    case htmlNameHash("nof1"):
+        return len == 4 && qstrncmp(s, "nof1", 4) == 0 ? 0x02 : 0;
+
+    case htmlNameHash("nof2"):
+        return len == 4 && qstrncmp(s, "nof2", 4) == 0 ? 0x04 : 0;
+
+    case htmlNameHash("nof3"):
+        return len == 4 && qstrncmp(s, "nof3", 4) == 0 ? 0x08 : 0;
+
+    default:
+        return 0;
+    }
+}
+
 ProgrammeTableParser::ProgrammeTableParser() : m_requestedChannelId(-1),
     m_x(0), m_tableDepth(0), m_dayOfWeek(-1), m_validResults(true)
 {
@@ -70,38 +133,64 @@ QList<Programme> ProgrammeTableParser::requestedProgrammes() const
     return m_programmes[3];
 }
 
-void ProgrammeTableParser::startElementParsed(const QString &name)
+void ProgrammeTableParser::startElementParsed(const QByteArray &name)
 {
-    if (m_x == 0 && name == "div" && attribute("id") == "channelboard") {
-        m_x = 1;
-    }
-    else if (m_x == 1 && name == "tr" && attribute("class") == "infobox") {
-        m_x = 2;
-        m_currentProgramme = Programme();
-    }
-    else if (m_x == 2 && name == "td" && attribute("class").startsWith("programtime")) {
-        m_x = 3;
-        m_parseContent = true;
+    int tag = tagId(name);
+
+    switch (stateTag(m_x, tag)) {
+    case stateTag(0, TagDiv): {
+        QByteArray id = attribute("id");
+
+        if (id == "channelboard") {
+            m_x = 1;
+        }
+        else if (id == "toolbarcalendar") {
+            m_x = 6;
+            m_parseContent = true;
+        }
+
+        break;
     }
-    else if (m_x == 2 && name == "span" && attribute("id").startsWith("pid")) {
-        m_x = 4;
-        parseProgrammeId(attribute("id"));
-        parseFlags();
-        m_parseContent = true;
+
+    case stateTag(1, TagTr):
+        if (attribute("class") == "infobox") {
+            m_x = 2;
+            m_currentProgramme = Programme();
+        }
+
+        break;
+
+    case stateTag(2, TagTd):
+        if (attribute("class").startsWith("programtime")) {
+            m_x = 3;
+            m_parseContent = true;
+        }
+
+        break;
+
+    case stateTag(2, TagSpan): {
+        QByteArray id = attribute("id");
+
+        if (id.startsWith("pid")) {
+            m_x = 4;
+            parseProgrammeId(id);
+            parseFlags();
+            m_parseContent = true;
+        }
+        else if (attribute("class").contains("information")) {
+            m_x = 5;
+            m_parseContent = true;
+        }
+
+        break;
     }
-    else if (m_x == 4 && name == "span") {
+
+    case stateTag(4, TagSpan):
         parseFlags();
-    }
-    else if (m_x == 2 && name == "span" && attribute("class").contains("information")) {
-        m_x = 5;
-        m_parseContent = true;
-    }
-    else if (m_x == 0 && name == "div" && attribute("id") == "toolbarcalendar") {
-        m_x = 6;
-        m_parseContent = true;
+        break;
     }
 
-    if (m_x > 0 && name == "table") {
+    if (m_x > 0 && tag == TagTable) {
         m_tableDepth++;
 //        qDebug() << "<table>" << m_tableDepth;
 
@@ -111,39 +200,40 @@ void ProgrammeTableParser::startElementParsed(const QString &name)
     }
 }
 
-void ProgrammeTableParser::endElementParsed(const QString &name)
+void ProgrammeTableParser::endElementParsed(const QByteArray &name)
 {
-    if (m_x == 2 && name == "tr") {
+    int tag = tagId(name);
+
+    switch (stateTag(m_x, tag)) {
+    case stateTag(2, TagTr):
         m_x = 1;
 
-        if (m_dayOfWeek >= 0 && m_currentProgramme.startDateTime.isValid() && !m_currentProgramme.title.isEmpty() && m_validResults) {
+        if (m_dayOfWeek >= 0 && m_currentProgramme.startDateTime().isValid() && !m_currentProgramme.title.isEmpty() && m_validResults) {
             m_currentProgramme.channelId = m_requestedChannelId;
 
             if (m_currentProgramme.description.startsWith("Suosittele:")) {
                 m_currentProgramme.description = QString();
             }
 
-//            qDebug() << m_dayOfWeek << m_currentProgramme.id << m_currentProgramme.startDateTime << m_currentProgramme.title;
+//            qDebug() << m_dayOfWeek << m_currentProgramme.id << m_currentProgramme.startDateTime() << m_currentProgramme.title;
             m_programmes[m_dayOfWeek].append(m_currentProgramme);
         }
-    }
-    else if (m_x == 3 && name == "td") {
-        m_x = 2;
-        m_parseContent = false;
-    }
-    else if (m_x == 4 && name == "span") {
-        m_x = 2;
-        m_parseContent = false;
-    }
-    else if (m_x == 5 && name == "span") {
+
+        break;
+
+    case stateTag(3, TagTd):
+    case stateTag(4, TagSpan):
+    case stateTag(5, TagSpan):
         m_x = 2;
         m_parseContent = false;
-    }
-    else if (m_x == 6 && name == "div") {
+        break;
+
+    case stateTag(6, TagDiv):
         m_x = 0;
+        break;
     }
 
-    if (m_x > 0 && name == "table") {
+    if (m_x > 0 && tag == TagTable) {
         m_tableDepth--;
 //        qDebug() << "</table>" << m_tableDepth;
     }
@@ -160,7 +250,7 @@ void ProgrammeTableParser::contentParsed(const QString &content)
     }
     else if (m_x == 4) {
         if (m_currentProgramme.title.isEmpty()) {
-            m_currentProgramme.title = content.trimmed();
+            m_currentProgramme.title = Programme::internTitle(content.trimmed());
         }
     }
     else if (m_x == 5) {
@@ -187,7 +277,7 @@ void ProgrammeTableParser::contentParsed(const QString &content)
     }
 }
 
-bool ProgrammeTableParser::parseProgrammeId(const QString &s)
+bool ProgrammeTableParser::parseProgrammeId(const QByteArray &s)
 {
     /* "pid8217946" -> 8217946 */
 
@@ -232,23 +322,34 @@ bool ProgrammeTableParser::parseTime(const QString &s)
 
     if (!m_programmes[m_dayOfWeek].isEmpty()) {
         Programme prevProgramme = m_programmes[m_dayOfWeek].last();
-        date = prevProgramme.startDateTime.date();
+        date = prevProgramme.startDateTime().date();
 
-        if (time < prevProgramme.startDateTime.time()) {
+        if (time < prevProgramme.startDateTime().time()) {
             date = date.addDays(1);
         }
     }
 
-    m_currentProgramme.startDateTime = QDateTime(date, time);
+    m_currentProgramme.setStartDateTime(QDateTime(date, time));
     return true;
 }
 
 void ProgrammeTableParser::parseFlags()
 {
-    QString clazz = attribute("class");
-    if (clazz.contains("upcoming")) m_currentProgramme.flags |= 0xF;
-    if (clazz.contains("nof0")) m_currentProgramme.flags |= 0x01;
-    if (clazz.contains("nof1")) m_currentProgramme.flags |= 0x02;
-    if (clazz.contains("nof2")) m_currentProgramme.flags |= 0x04;
-    if (clazz.contains("nof3")) m_currentProgramme.flags |= 0x08;
+    QByteArray clazz = attribute("class");
+    const char *s = clazz.constData();
+    int len = clazz.size();
+    int start = 0;
+
+    /* Luokkalistan sanat verrataan tunnettuihin lippuihin tavuina. */
+    for (int i = 0; i <= len; i++) {
+        if (i < len && s[i] != ' ') {
+            continue;
+        }
+
+        if (i > start) {
+            m_currentProgramme.flags |= classTokenFlags(s + start, i - start);
+        }
+
+        start = i + 1;
+    }
 }
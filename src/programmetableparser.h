@@ -24,12 +24,12 @@ public:
     QList<Programme> requestedProgrammes() const;
 
 protected:
-    void startElementParsed(const QString &name);
-    void endElementParsed(const QString &name);
+    void startElementParsed(const QByteArray &name);
+    void endElementParsed(const QByteArray &name);
     void contentParsed(const QString &content);
 
 private:
-    bool parseProgrammeId(const QString &s);
+    bool parseProgrammeId(const QByteArray &s);
     bool parseTime(const QString &s);
     void parseFlags();
     QList<Programme> *m_programmes;
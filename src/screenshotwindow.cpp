@@ -2,14 +2,14 @@
 #include <QLabel>
 #include <QMovie>
 #include <QComboBox>
-#include <QSettings>
 #include <QTimer>
+#include "appsettings.h"
 #include "programmefeedparser.h"
 #include "screenshotwindow.h"
 #include "tvkaistaclient.h"
 #include "ui_screenshotwindow.h"
 
-ScreenshotWindow::ScreenshotWindow(QSettings *settings, QWidget *parent) :
+ScreenshotWindow::ScreenshotWindow(AppSettings *settings, QWidget *parent) :
     QMainWindow(parent), ui(new Ui::ScreenshotWindow),
     m_settings(settings), m_reply(0), m_redirections(0)
 {
@@ -41,11 +41,10 @@ ScreenshotWindow::ScreenshotWindow(QSettings *settings, QWidget *parent) :
     connect(ui->actionClose, SIGNAL(triggered()), SLOT(close()));
     connect(ui->actionStop, SIGNAL(triggered()), SLOT(stopDownloading()));
     connect(m_numScreenshotsComboBox, SIGNAL(currentIndexChanged(int)), SLOT(numScreenshotsChanged()));
+    connect(ui->listWidget, SIGNAL(itemActivated(QListWidgetItem*)), SLOT(itemActivated(QListWidgetItem*)));
 
-    settings->beginGroup("screenshotWindow");
-    restoreGeometry(settings->value("geometry").toByteArray());
-    int numScreenshots = settings->value("numScreenshots", 0).toInt();
-    settings->endGroup();
+    restoreGeometry(settings->screenshotWindowGeometry());
+    int numScreenshots = settings->numScreenshots();
 
     int count = viewOptions.size();
 
@@ -83,17 +82,14 @@ void ScreenshotWindow::changeEvent(QEvent *e)
 
 void ScreenshotWindow::closeEvent(QCloseEvent*)
 {
-    m_settings->beginGroup("screenshotWindow");
-    m_settings->setValue("geometry", saveGeometry());
+    m_settings->setScreenshotWindowGeometry(saveGeometry());
 
     if (m_numScreenshotsComboBox->currentIndex() == m_numScreenshotsComboBox->count() - 1) {
-        m_settings->setValue("numScreenshots", -1);
+        m_settings->setNumScreenshots(-1);
     }
     else {
-        m_settings->setValue("numScreenshots", m_numScreenshotsComboBox->currentText());
+        m_settings->setNumScreenshots(m_numScreenshotsComboBox->currentText().toInt());
     }
-
-    m_settings->endGroup();
     stopDownloading();
 }
 
@@ -117,7 +113,7 @@ void ScreenshotWindow::fetchScreenshots(const Programme &programme)
     ui->statusLabel->setText(trUtf8("Haetaan kuvakaappauksia..."));
     ui->stackedWidget->setCurrentIndex(1);
     setWindowTitle(trUtf8("Kuvakaappaukset - %1 %2").arg(programme.title).arg(
-            programme.startDateTime.toString(trUtf8("ddd d.M.yyyy 'klo' h.mm"))));
+            programme.startDateTime().toString(trUtf8("ddd d.M.yyyy 'klo' h.mm"))));
     startLoadingAnimation();
     m_reply = m_client->sendDetailedFeedRequest(programme);
     connect(m_reply, SIGNAL(error(QNetworkReply::NetworkError)), SLOT(networkError(QNetworkReply::NetworkError)));
@@ -240,12 +236,18 @@ void ScreenshotWindow::thumbnailRequestFinished()
             ui->stackedWidget->setCurrentIndex(0);
         }
 
-        new QListWidgetItem(icon, thumbnail.time.toString("h:mm"), ui->listWidget);
+        QListWidgetItem *item = new QListWidgetItem(icon, thumbnail.time.toString("h:mm"), ui->listWidget);
+        item->setData(Qt::UserRole, QTime(0, 0).msecsTo(thumbnail.time));
     }
 
     fetchNextScreenshot();
 }
 
+void ScreenshotWindow::itemActivated(QListWidgetItem *item)
+{
+    emit screenshotActivated(m_programme, item->data(Qt::UserRole).toInt());
+}
+
 void ScreenshotWindow::networkError(QNetworkReply::NetworkError error)
 {
     if (error == QNetworkReply::OperationCanceledError || m_reply == 0) {
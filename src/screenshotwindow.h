@@ -12,18 +12,22 @@ namespace Ui {
 
 class QLabel;
 class QComboBox;
-class QSettings;
+class QListWidgetItem;
+class AppSettings;
 class TvkaistaClient;
 
 class ScreenshotWindow : public QMainWindow {
     Q_OBJECT
 public:
-    ScreenshotWindow(QSettings *settings, QWidget *parent = 0);
+    ScreenshotWindow(AppSettings *settings, QWidget *parent = 0);
     ~ScreenshotWindow();
     void setClient(TvkaistaClient *client);
     TvkaistaClient* client() const;
     void fetchScreenshots(const Programme &programme);
 
+signals:
+    void screenshotActivated(const Programme &programme, int msecs);
+
 protected:
     void changeEvent(QEvent *e);
     void closeEvent(QCloseEvent *e);
@@ -35,6 +39,7 @@ private slots:
     void thumbnailRequestFinished();
     void networkError(QNetworkReply::NetworkError error);
     void thumbnailsToQueue();
+    void itemActivated(QListWidgetItem *item);
 
 private:
     void fetchNextScreenshot();
@@ -43,7 +48,7 @@ private:
     void screenshotsNotFound();
     void changeHostToUrls(const QString &host);
     Ui::ScreenshotWindow *ui;
-    QSettings *m_settings;
+    AppSettings *m_settings;
     QLabel *m_loadLabel;
     QComboBox *m_numScreenshotsComboBox;
     QMovie *m_loadMovie;
@@ -0,0 +1,401 @@
+#include <QDateTime>
+#include <QDebug>
+#include <QNetworkAccessManager>
+#include <QNetworkCookie>
+#include <QNetworkCookieJar>
+#include <QNetworkReply>
+#include <QNetworkRequest>
+#include <QSettings>
+#include <QTimer>
+#include "serverprober.h"
+#include "tvkaistaclient.h"
+
+/* Mittaukset toistetaan puolen tunnin välein, ja ensimmäinen tehdään kaksi minuuttia
+   automaattisen valinnan käynnistämisen jälkeen. */
+static const int PROBE_INTERVAL = 30 * 60 * 1000;
+static const int FIRST_PROBE_DELAY = 2 * 60 * 1000;
+
+/* Palvelimelta ladataan videon alusta 512 kt. Vastaamaton palvelin kirjataan
+   mittaukseksi, jonka viive on aikaraja ja siirtonopeus nolla. */
+static const int PROBE_BYTES = 512 * 1024;
+static const int PROBE_TIMEOUT = 15000;
+static const int PROBE_FORMAT = 0;
+
+/* Valinta perustuu kunkin palvelimen viimeisten mittausten mediaaniin. Palvelinta
+   vaihdetaan vasta, kun uusi on vähintään 25 % parempi, jottei valinta heilu. */
+static const int HISTORY_SIZE = 8;
+static const int HYSTERESIS_PERCENT = 25;
+
+ServerProber::ServerProber(QSettings *settings, TvkaistaClient *client, QObject *parent) :
+    QObject(parent), m_settings(settings), m_client(client),
+    m_networkAccessManager(new QNetworkAccessManager(this)), m_reply(0),
+    m_timer(new QTimer(this)), m_timeoutTimer(new QTimer(this)), m_programmeId(-1),
+    m_serverIndex(-1), m_latency(-1), m_bytes(0), m_enabled(false)
+{
+    m_selected[0] = -1;
+    m_selected[1] = -1;
+    m_timer->setSingleShot(true);
+    connect(m_timer, SIGNAL(timeout()), SLOT(probe()));
+    m_timeoutTimer->setSingleShot(true);
+    m_timeoutTimer->setInterval(PROBE_TIMEOUT);
+    connect(m_timeoutTimer, SIGNAL(timeout()), SLOT(probeTimeout()));
+}
+
+ServerProber::~ServerProber()
+{
+    cancelProbe();
+}
+
+void ServerProber::addServer(const QString &serverId)
+{
+    m_servers.append(serverId);
+}
+
+void ServerProber::setEnabled(bool enabled)
+{
+    if (m_enabled == enabled) {
+        return;
+    }
+
+    m_enabled = enabled;
+
+    if (enabled) {
+        m_timer->start(FIRST_PROBE_DELAY);
+    }
+    else {
+        m_timer->stop();
+        cancelProbe();
+    }
+}
+
+bool ServerProber::isEnabled() const
+{
+    return m_enabled;
+}
+
+void ServerProber::setProbeProgramme(int programmeId)
+{
+    m_programmeId = programmeId;
+}
+
+QString ServerProber::server(int requestClass) const
+{
+    int index = m_selected[requestClass];
+
+    if (index < 0) {
+        return m_client->server();
+    }
+
+    return m_servers.at(index);
+}
+
+void ServerProber::load()
+{
+    m_samples.clear();
+    m_settings->beginGroup("serverProbe");
+    m_programmeId = m_settings->value("programmeId", -1).toInt();
+    m_selected[0] = m_settings->contains("playbackServer") ?
+                    m_servers.indexOf(m_settings->value("playbackServer").toString()) : -1;
+    m_selected[1] = m_settings->contains("downloadServer") ?
+                    m_servers.indexOf(m_settings->value("downloadServer").toString()) : -1;
+    int count = m_settings->beginReadArray("samples");
+
+    for (int i = 0; i < count; i++) {
+        m_settings->setArrayIndex(i);
+        ServerProbeSample sample;
+        sample.server = m_settings->value("server").toString();
+        sample.time = m_settings->value("time").toLongLong();
+        sample.latency = m_settings->value("latency").toInt();
+        sample.throughput = m_settings->value("throughput").toLongLong();
+
+        if (m_servers.contains(sample.server)) {
+            m_samples.append(sample);
+        }
+    }
+
+    m_settings->endArray();
+    m_settings->endGroup();
+}
+
+void ServerProber::save()
+{
+    m_settings->beginGroup("serverProbe");
+    m_settings->setValue("programmeId", m_programmeId);
+
+    if (m_selected[0] >= 0) {
+        m_settings->setValue("playbackServer", m_servers.at(m_selected[0]));
+    }
+
+    if (m_selected[1] >= 0) {
+        m_settings->setValue("downloadServer", m_servers.at(m_selected[1]));
+    }
+
+    int count = m_samples.size();
+    m_settings->beginWriteArray("samples", count);
+
+    for (int i = 0; i < count; i++) {
+        const ServerProbeSample &sample = m_samples.at(i);
+        m_settings->setArrayIndex(i);
+        m_settings->setValue("server", sample.server);
+        m_settings->setValue("time", sample.time);
+        m_settings->setValue("latency", sample.latency);
+        m_settings->setValue("throughput", sample.throughput);
+    }
+
+    m_settings->endArray();
+    m_settings->endGroup();
+}
+
+void ServerProber::probe()
+{
+    m_timer->start(PROBE_INTERVAL);
+
+    if (!m_enabled || m_serverIndex >= 0 || m_programmeId < 0 || m_servers.isEmpty() ||
+            !m_client->isValidUsernameAndPassword()) {
+        return;
+    }
+
+    /* Mittaukset tehdään omalla istunnolla, jottei asiakkaan palvelinvalinta muutu. */
+    m_networkAccessManager->setCookieJar(new QNetworkCookieJar());
+    QList<QNetworkCookie> cookies = QNetworkCookie::parseCookies(m_client->cookies());
+    m_networkAccessManager->cookieJar()->setCookiesFromUrl(cookies, QUrl("http://www.tvkaista.com/"));
+    m_networkAccessManager->setProxy(m_client->proxy());
+    m_serverIndex = 0;
+    probeNext();
+}
+
+void ServerProber::redirectFinished()
+{
+    QNetworkReply *reply = m_reply;
+    QUrl url = reply->attribute(QNetworkRequest::RedirectionTargetAttribute).toUrl();
+    int status = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+    QNetworkReply::NetworkError error = reply->error();
+    m_reply = 0;
+    reply->deleteLater();
+
+    if (error == QNetworkReply::ContentNotFoundError) {
+        /* Ohjelma on poistunut palvelusta. Odotetaan, että käyttäjä katsoo uuden. */
+        qDebug() << "Probe: programme" << m_programmeId << "not found";
+        m_programmeId = -1;
+        cancelProbe();
+        return;
+    }
+
+    if (status != 302 || !url.isValid()) {
+        finishServer(PROBE_TIMEOUT, 0);
+        return;
+    }
+
+    /* Istunto on vanhentunut. Asiakas kirjautuu uudelleen seuraavalla pyynnöllä. */
+    if (url.path().startsWith("/login")) {
+        cancelProbe();
+        return;
+    }
+
+    QNetworkRequest request(url);
+    request.setRawHeader("Range", QString("bytes=0-%1").arg(PROBE_BYTES - 1).toLatin1());
+    m_latency = -1;
+    m_bytes = 0;
+    m_elapsed.start();
+    m_reply = m_networkAccessManager->get(request);
+    connect(m_reply, SIGNAL(readyRead()), SLOT(dataReadyRead()));
+    connect(m_reply, SIGNAL(finished()), SLOT(dataFinished()));
+}
+
+void ServerProber::dataReadyRead()
+{
+    if (m_latency < 0) {
+        m_latency = int(m_elapsed.elapsed());
+    }
+
+    m_bytes += m_reply->readAll().size();
+
+    if (m_bytes >= PROBE_BYTES) {
+        dataFinished();
+    }
+}
+
+void ServerProber::dataFinished()
+{
+    QNetworkReply *reply = m_reply;
+
+    if (reply == 0) {
+        return;
+    }
+
+    m_reply = 0;
+    reply->disconnect(this);
+    reply->abort();
+    reply->deleteLater();
+
+    if (m_bytes <= 0) {
+        finishServer(PROBE_TIMEOUT, 0);
+        return;
+    }
+
+    qint64 transferTime = qMax(Q_INT64_C(1), m_elapsed.elapsed() - m_latency);
+    finishServer(m_latency, m_bytes * 1000 / transferTime);
+}
+
+void ServerProber::probeTimeout()
+{
+    if (m_reply == 0) {
+        return;
+    }
+
+    /* Hidas palvelin saa hyvityksen jo siirretystä datasta. */
+    if (m_latency >= 0 && m_bytes > 0) {
+        dataFinished();
+        return;
+    }
+
+    QNetworkReply *reply = m_reply;
+    m_reply = 0;
+    reply->disconnect(this);
+    reply->abort();
+    reply->deleteLater();
+    finishServer(PROBE_TIMEOUT, 0);
+}
+
+void ServerProber::probeNext()
+{
+    if (m_serverIndex >= m_servers.size()) {
+        m_timeoutTimer->stop();
+        m_serverIndex = -1;
+        selectServers();
+        save();
+        return;
+    }
+
+    QNetworkCookie serverCookie("preferred_servers", m_servers.at(m_serverIndex).toLatin1());
+    serverCookie.setDomain("www.tvkaista.com");
+    m_networkAccessManager->cookieJar()->setCookiesFromUrl(QList<QNetworkCookie>() << serverCookie, QUrl("http://www.tvkaista.com/"));
+    QUrl url(TvkaistaClient::streamRequestUrl(m_programmeId, PROBE_FORMAT));
+
+    /* Edellisen palvelimen mittaus ei saa siirtyä tälle, jos tämä ei ehdi vastata. */
+    m_latency = -1;
+    m_bytes = 0;
+    m_elapsed.start();
+    m_reply = m_networkAccessManager->get(QNetworkRequest(url));
+    connect(m_reply, SIGNAL(finished()), SLOT(redirectFinished()));
+    m_timeoutTimer->start();
+}
+
+void ServerProber::finishServer(int latency, qint64 throughput)
+{
+    ServerProbeSample sample;
+    sample.server = m_servers.at(m_serverIndex);
+    sample.time = QDateTime::currentMSecsSinceEpoch();
+    sample.latency = latency;
+    sample.throughput = throughput;
+    qDebug() << "Probe: server" << sample.server << latency << "ms" << throughput / 1024 << "kB/s";
+    m_samples.append(sample);
+    int count = 0;
+
+    /* Säilytetään kunkin palvelimen uusimmat mittaukset. */
+    for (int i = m_samples.size() - 1; i >= 0; i--) {
+        if (m_samples.at(i).server == sample.server && ++count > HISTORY_SIZE) {
+            m_samples.removeAt(i);
+        }
+    }
+
+    m_serverIndex++;
+    probeNext();
+}
+
+void ServerProber::cancelProbe()
+{
+    m_timeoutTimer->stop();
+
+    if (m_reply != 0) {
+        QNetworkReply *reply = m_reply;
+        m_reply = 0;
+        reply->disconnect(this);
+        reply->abort();
+        reply->deleteLater();
+    }
+
+    m_serverIndex = -1;
+}
+
+void ServerProber::selectServers()
+{
+    int count = m_servers.size();
+    int bestLatency = -1;
+    int bestThroughput = -1;
+
+    for (int i = 0; i < count; i++) {
+        int latency = medianLatency(m_servers.at(i));
+        qint64 throughput = medianThroughput(m_servers.at(i));
+
+        if (latency >= 0 && latency < PROBE_TIMEOUT &&
+                (bestLatency < 0 || latency < medianLatency(m_servers.at(bestLatency)))) {
+            bestLatency = i;
+        }
+
+        if (throughput > 0 &&
+                (bestThroughput < 0 || throughput > medianThroughput(m_servers.at(bestThroughput)))) {
+            bestThroughput = i;
+        }
+    }
+
+    if (bestLatency >= 0 && bestLatency != m_selected[0]) {
+        int current = m_selected[0] >= 0 ? medianLatency(m_servers.at(m_selected[0])) : -1;
+        int latency = medianLatency(m_servers.at(bestLatency));
+
+        if (current < 0 || latency * 100 < current * (100 - HYSTERESIS_PERCENT)) {
+            m_selected[0] = bestLatency;
+            qDebug() << "Probe: playback server" << m_servers.at(bestLatency);
+            emit serverSelected(0, m_servers.at(bestLatency));
+        }
+    }
+
+    if (bestThroughput >= 0 && bestThroughput != m_selected[1]) {
+        qint64 current = m_selected[1] >= 0 ? medianThroughput(m_servers.at(m_selected[1])) : 0;
+        qint64 throughput = medianThroughput(m_servers.at(bestThroughput));
+
+        if (current <= 0 || throughput * 100 > current * (100 + HYSTERESIS_PERCENT)) {
+            m_selected[1] = bestThroughput;
+            qDebug() << "Probe: download server" << m_servers.at(bestThroughput);
+            emit serverSelected(1, m_servers.at(bestThroughput));
+        }
+    }
+}
+
+int ServerProber::medianLatency(const QString &server) const
+{
+    QList<int> values;
+    int count = m_samples.size();
+
+    for (int i = 0; i < count; i++) {
+        if (m_samples.at(i).server == server) {
+            values.append(m_samples.at(i).latency);
+        }
+    }
+
+    if (values.isEmpty()) {
+        return -1;
+    }
+
+    qSort(values);
+    return values.at(values.size() / 2);
+}
+
+qint64 ServerProber::medianThroughput(const QString &server) const
+{
+    QList<qint64> values;
+    int count = m_samples.size();
+
+    for (int i = 0; i < count; i++) {
+        if (m_samples.at(i).server == server) {
+            values.append(m_samples.at(i).throughput);
+        }
+    }
+
+    if (values.isEmpty()) {
+        return -1;
+    }
+
+    qSort(values);
+    return values.at(values.size() / 2);
+}
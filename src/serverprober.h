@@ -0,0 +1,79 @@
+#ifndef SERVERPROBER_H
+#define SERVERPROBER_H
+
+#include <QElapsedTimer>
+#include <QList>
+#include <QObject>
+#include <QStringList>
+
+class QNetworkAccessManager;
+class QNetworkReply;
+class QSettings;
+class QTimer;
+class TvkaistaClient;
+
+struct ServerProbeSample
+{
+    QString server;
+    qint64 time;
+    int latency;
+    qint64 throughput;
+};
+
+/* Mittaa säännöllisesti palvelinten viiveen ja siirtonopeuden ja valitsee parhaan
+   palvelimen kullekin pyyntöluokalle. */
+class ServerProber : public QObject
+{
+    Q_OBJECT
+public:
+    ServerProber(QSettings *settings, TvkaistaClient *client, QObject *parent = 0);
+    ~ServerProber();
+    void addServer(const QString &serverId);
+    void setEnabled(bool enabled);
+    bool isEnabled() const;
+    void setProbeProgramme(int programmeId);
+
+    /**
+     * 0 = katselu (pienin viive), 1 = lataus (suurin siirtonopeus)
+     */
+    QString server(int requestClass) const;
+    void load();
+    void save();
+
+signals:
+    void serverSelected(int requestClass, const QString &serverId);
+
+public slots:
+    void probe();
+
+private slots:
+    void redirectFinished();
+    void dataReadyRead();
+    void dataFinished();
+    void probeTimeout();
+
+private:
+    void probeNext();
+    void finishServer(int latency, qint64 throughput);
+    void cancelProbe();
+    void selectServers();
+    int medianLatency(const QString &server) const;
+    qint64 medianThroughput(const QString &server) const;
+    QSettings *m_settings;
+    TvkaistaClient *m_client;
+    QNetworkAccessManager *m_networkAccessManager;
+    QNetworkReply *m_reply;
+    QTimer *m_timer;
+    QTimer *m_timeoutTimer;
+    QElapsedTimer m_elapsed;
+    QStringList m_servers;
+    QList<ServerProbeSample> m_samples;
+    int m_selected[2];
+    int m_programmeId;
+    int m_serverIndex;
+    int m_latency;
+    qint64 m_bytes;
+    bool m_enabled;
+};
+
+#endif // SERVERPROBER_H
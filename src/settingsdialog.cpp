@@ -177,6 +177,7 @@ void SettingsDialog::loadSettings()
     QString streamCommand = m_settings->value("stream").toString();
     QString fileCommand = m_settings->value("file").toString();
     QString flashCommand = m_settings->value("flash").toString();
+    ui->prebufferCheckBox->setChecked(m_settings->value("prebuffer", false).toBool());
     m_settings->endGroup();
 
     if (dir.isEmpty()) {
@@ -249,5 +250,6 @@ void SettingsDialog::saveSettings()
     m_settings->setValue("stream", ui->streamPlayerLineEdit->text());
     m_settings->setValue("file", ui->filePlayerLineEdit->text());
     m_settings->setValue("flash", ui->flashPlayerLineEdit->text());
+    m_settings->setValue("prebuffer", ui->prebufferCheckBox->isChecked());
     m_settings->endGroup();
 }
@@ -0,0 +1,103 @@
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QRunnable>
+#include "cache.h"
+#include "historymanager.h"
+#include "startuploader.h"
+
+class StartupTask : public QRunnable
+{
+public:
+    StartupTask(StartupLoader *loader, int task) : m_loader(loader), m_task(task) {}
+
+    /**
+      * 1 = historia
+      * 2 = lataukset
+      * 3 = kanavat
+     */
+    void run()
+    {
+        QElapsedTimer timer;
+        timer.start();
+
+        if (m_task == 1) {
+            HistoryManager::read(m_loader->m_historyFilename, m_loader->m_historyEntries);
+        }
+        else if (m_task == 2) {
+            DownloadTableModel::read(m_loader->m_downloadsFilename, m_loader->m_downloads);
+        }
+        else if (m_task == 3) {
+            m_loader->m_channels = m_loader->m_cache->loadChannels(m_loader->m_channelsOk);
+        }
+
+        QMetaObject::invokeMethod(m_loader, "taskFinished", Qt::QueuedConnection,
+                                  Q_ARG(int, m_task), Q_ARG(qint64, timer.elapsed()));
+    }
+
+private:
+    StartupLoader *m_loader;
+    int m_task;
+};
+
+StartupLoader::StartupLoader(QObject *parent) :
+    QObject(parent), m_cache(new Cache), m_channelsOk(false)
+{
+    m_threadPool.setMaxThreadCount(3);
+}
+
+StartupLoader::~StartupLoader()
+{
+    m_threadPool.waitForDone();
+    delete m_cache;
+}
+
+void StartupLoader::start(const QString &historyFilename, const QString &downloadsFilename, const QDir &cacheDir)
+{
+    m_historyFilename = historyFilename;
+    m_downloadsFilename = downloadsFilename;
+
+    /* Taustasäie käyttää omaa välimuistioliota, jotta pääikkunan välimuistin
+       virheteksti ja kuvapaketit eivät ole kahden säikeen käytössä. */
+    m_cache->setDirectory(cacheDir);
+
+    /* Kanavalista tarvitaan ensimmäisenä ohjelmalistan täyttämiseen. */
+    m_threadPool.start(new StartupTask(this, 3));
+    m_threadPool.start(new StartupTask(this, 1));
+    m_threadPool.start(new StartupTask(this, 2));
+}
+
+QList<HistoryEntry> StartupLoader::historyEntries() const
+{
+    return m_historyEntries;
+}
+
+QList<FileDownload> StartupLoader::downloads() const
+{
+    return m_downloads;
+}
+
+QList<Channel> StartupLoader::channels() const
+{
+    return m_channels;
+}
+
+bool StartupLoader::hasChannels() const
+{
+    return m_channelsOk;
+}
+
+void StartupLoader::taskFinished(int task, qint64 elapsed)
+{
+    if (task == 1) {
+        qDebug() << "Startup: history" << m_historyEntries.size() << "entries" << elapsed << "ms";
+        emit historyLoaded();
+    }
+    else if (task == 2) {
+        qDebug() << "Startup: downloads" << m_downloads.size() << "entries" << elapsed << "ms";
+        emit downloadsLoaded();
+    }
+    else if (task == 3) {
+        qDebug() << "Startup: channels" << m_channels.size() << "entries" << elapsed << "ms";
+        emit channelsLoaded();
+    }
+}
@@ -0,0 +1,48 @@
+#ifndef STARTUPLOADER_H
+#define STARTUPLOADER_H
+
+#include <QDir>
+#include <QList>
+#include <QObject>
+#include <QThreadPool>
+#include "channel.h"
+#include "downloadtablemodel.h"
+#include "historyentry.h"
+
+class Cache;
+
+/* Lukee historian, lataukset ja kanavat taustasäikeissä ikkunan näyttämisen jälkeen.
+   Jokainen vaihe ilmoittaa valmistumisestaan omalla signaalillaan. */
+class StartupLoader : public QObject
+{
+    Q_OBJECT
+public:
+    StartupLoader(QObject *parent = 0);
+    ~StartupLoader();
+    void start(const QString &historyFilename, const QString &downloadsFilename, const QDir &cacheDir);
+    QList<HistoryEntry> historyEntries() const;
+    QList<FileDownload> downloads() const;
+    QList<Channel> channels() const;
+    bool hasChannels() const;
+
+signals:
+    void historyLoaded();
+    void downloadsLoaded();
+    void channelsLoaded();
+
+private slots:
+    void taskFinished(int task, qint64 elapsed);
+
+private:
+    friend class StartupTask;
+    QThreadPool m_threadPool;
+    QString m_historyFilename;
+    QString m_downloadsFilename;
+    Cache *m_cache;
+    QList<HistoryEntry> m_historyEntries;
+    QList<FileDownload> m_downloads;
+    QList<Channel> m_channels;
+    bool m_channelsOk;
+};
+
+#endif // STARTUPLOADER_H
@@ -0,0 +1,493 @@
+#include <QDebug>
+#include <QFileInfo>
+#include <QHostAddress>
+#include <QStringList>
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <QTimer>
+#include "downloader.h"
+#include "streamserver.h"
+
+/* Soittimelle kerralla lähetettävän palan koko ja lähetyspuskurin yläraja. */
+static const qint64 CHUNK_SIZE = 64 * 1024;
+static const qint64 WRITE_BUFFER_SIZE = 256 * 1024;
+static const int MAX_REQUEST_SIZE = 8192;
+static const int POLL_INTERVAL = 500;
+
+/* Soitin avaa yhteyden uudelleen hypätessään, joten käytöstä poistettu lähde
+   tuhotaan vasta, kun siihen ei ole ollut yhteyksiä hetkeen. */
+static const int IDLE_SOURCE_TIMEOUT = 30 * 1000;
+
+StreamSource::StreamSource(QObject *parent) : QObject(parent)
+{
+}
+
+void StreamSource::requestAt(qint64 offset)
+{
+    Q_UNUSED(offset);
+}
+
+QByteArray StreamSource::contentType() const
+{
+    return "application/octet-stream";
+}
+
+void StreamSource::release()
+{
+}
+
+FileStreamSource::FileStreamSource(Downloader *downloader, QObject *parent) :
+    StreamSource(parent), m_downloader(downloader), m_filename(downloader->filename()), m_startOffset(0)
+{
+    connect(downloader, SIGNAL(dataWritten()), SIGNAL(dataAvailable()));
+    connect(downloader, SIGNAL(finished()), SIGNAL(dataAvailable()));
+    connect(downloader, SIGNAL(networkError()), SIGNAL(dataAvailable()));
+}
+
+FileStreamSource::FileStreamSource(const QString &filename, qint64 startOffset, QObject *parent) :
+    StreamSource(parent), m_filename(filename), m_startOffset(startOffset)
+{
+}
+
+qint64 FileStreamSource::availableAt(qint64 offset) const
+{
+    return qMax(Q_INT64_C(0), bytesWritten() - offset);
+}
+
+qint64 FileStreamSource::totalSize() const
+{
+    if (m_downloader.isNull() || m_downloader->isFinished()) {
+        return bytesWritten();
+    }
+
+    return m_downloader->bytesTotal();
+}
+
+bool FileStreamSource::isComplete() const
+{
+    return m_downloader.isNull() || m_downloader->isFinished() || m_downloader->hasError();
+}
+
+QByteArray FileStreamSource::read(qint64 offset, qint64 maxSize)
+{
+    /* Tiedoston nimi voi vaihtua ensimmäisen vastauksen perusteella. */
+    if (!m_downloader.isNull() && m_downloader->filename() != m_filename) {
+        m_file.close();
+        m_filename = m_downloader->filename();
+    }
+
+    if (!m_file.isOpen()) {
+        m_file.setFileName(m_filename);
+
+        if (!m_file.open(QIODevice::ReadOnly)) {
+            return QByteArray();
+        }
+
+        qDebug() << "READ" << m_filename;
+    }
+
+    if (!m_file.seek(m_startOffset + offset)) {
+        return QByteArray();
+    }
+
+    return m_file.read(qMin(maxSize, availableAt(offset)));
+}
+
+QByteArray FileStreamSource::contentType() const
+{
+    QString suffix = QFileInfo(m_filename).suffix().toLower();
+
+    if (suffix == "ts") {
+        return "video/mp2t";
+    }
+    else if (suffix == "mp4") {
+        return "video/mp4";
+    }
+
+    return StreamSource::contentType();
+}
+
+void FileStreamSource::release()
+{
+    m_file.close();
+}
+
+/* Tavumäärä jaon alusta eli kohdasta startOffset lukien. */
+qint64 FileStreamSource::bytesWritten() const
+{
+    if (m_downloader.isNull()) {
+        return qMax(Q_INT64_C(0), QFileInfo(m_filename).size() - m_startOffset);
+    }
+
+    return m_downloader->bytesWritten();
+}
+
+StreamConnection::StreamConnection(QTcpSocket *socket, StreamServer *server) :
+    QObject(server), m_server(server), m_socket(socket), m_pollTimer(new QTimer(this)),
+    m_offset(0), m_end(-1), m_responding(false), m_closed(false)
+{
+    m_socket->setParent(this);
+    m_pollTimer->setSingleShot(true);
+    connect(m_socket, SIGNAL(readyRead()), SLOT(readRequest()));
+    connect(m_socket, SIGNAL(bytesWritten(qint64)), SLOT(writeData()));
+    connect(m_socket, SIGNAL(disconnected()), SLOT(socketDisconnected()));
+    connect(m_pollTimer, SIGNAL(timeout()), SLOT(writeData()));
+}
+
+StreamSource* StreamConnection::source() const
+{
+    return m_source;
+}
+
+void StreamConnection::readRequest()
+{
+    if (m_responding) {
+        m_socket->readAll();
+        return;
+    }
+
+    m_request.append(m_socket->readAll());
+    int headerEnd = m_request.indexOf("\r\n\r\n");
+
+    if (headerEnd < 0) {
+        if (m_request.size() > MAX_REQUEST_SIZE) {
+            sendError("400 Bad Request");
+        }
+
+        return;
+    }
+
+    /* "GET /1/ohjelma.ts HTTP/1.1" */
+    QList<QByteArray> lines = m_request.left(headerEnd).split('\n');
+    QList<QByteArray> requestLine = lines.takeFirst().trimmed().split(' ');
+    m_responding = true;
+
+    if (requestLine.size() < 2 || (requestLine.at(0) != "GET" && requestLine.at(0) != "HEAD")) {
+        sendError("405 Method Not Allowed");
+        return;
+    }
+
+    bool headOnly = requestLine.at(0) == "HEAD";
+    QList<QByteArray> pathParts = requestLine.at(1).split('/');
+    bool ok = false;
+    int id = pathParts.size() >= 2 ? pathParts.at(1).toInt(&ok) : -1;
+    m_source = ok ? m_server->source(id) : 0;
+
+    if (m_source.isNull()) {
+        sendError("404 Not Found");
+        return;
+    }
+
+    m_server->attachConnection(m_source);
+    connect(m_source, SIGNAL(dataAvailable()), SLOT(writeData()));
+
+    qint64 first = 0;
+    qint64 last = -1;
+    bool ranged = false;
+    int count = lines.size();
+
+    for (int i = 0; i < count; i++) {
+        QByteArray line = lines.at(i).trimmed();
+
+        if (line.toLower().startsWith("range:")) {
+            ranged = parseRange(line.mid(6).trimmed(), first, last);
+        }
+    }
+
+    qint64 total = m_source->totalSize();
+    QList<QByteArray> headers;
+    headers << "Content-Type: " + m_source->contentType();
+    headers << "Accept-Ranges: bytes";
+
+    /* Kokoa ei vielä tiedetä, joten lähetetään koko tiedosto alusta ilman pituutta. */
+    if (total < 0) {
+        m_offset = 0;
+        m_end = -1;
+        sendResponse("200 OK", headers);
+    }
+    else if (ranged && first >= total) {
+        sendError("416 Requested Range Not Satisfiable",
+                  QList<QByteArray>() << "Content-Range: bytes */" + QByteArray::number(total));
+        return;
+    }
+    else {
+        m_offset = ranged ? first : 0;
+        m_end = (ranged && last >= 0 && last < total) ? last + 1 : total;
+        headers << "Content-Length: " + QByteArray::number(m_end - m_offset);
+
+        if (ranged) {
+            headers << "Content-Range: bytes " + QByteArray::number(m_offset) + "-" +
+                       QByteArray::number(m_end - 1) + "/" + QByteArray::number(total);
+            sendResponse("206 Partial Content", headers);
+        }
+        else {
+            sendResponse("200 OK", headers);
+        }
+    }
+
+    if (headOnly) {
+        m_socket->disconnectFromHost();
+        return;
+    }
+
+    m_source->requestAt(m_offset);
+    writeData();
+}
+
+void StreamConnection::writeData()
+{
+    if (m_closed || !m_responding || m_socket->state() != QAbstractSocket::ConnectedState) {
+        return;
+    }
+
+    if (m_source.isNull()) {
+        m_socket->disconnectFromHost();
+        return;
+    }
+
+    while (m_socket->bytesToWrite() < WRITE_BUFFER_SIZE) {
+        qint64 available = m_source->availableAt(m_offset);
+
+        if (m_end >= 0) {
+            available = qMin(available, m_end - m_offset);
+        }
+
+        if (available <= 0) {
+            if ((m_end >= 0 && m_offset >= m_end) || m_source->isComplete()) {
+                m_socket->disconnectFromHost();
+            }
+            else if (!m_pollTimer->isActive()) {
+                /* Odotetaan, että lataus ehtii pidemmälle. */
+                m_source->requestAt(m_offset);
+                m_pollTimer->start(POLL_INTERVAL);
+            }
+
+            return;
+        }
+
+        QByteArray data = m_source->read(m_offset, qMin(available, CHUNK_SIZE));
+
+        if (data.isEmpty()) {
+            if (!m_pollTimer->isActive()) {
+                m_pollTimer->start(POLL_INTERVAL);
+            }
+
+            return;
+        }
+
+        m_socket->write(data);
+        m_offset += data.size();
+    }
+}
+
+void StreamConnection::socketDisconnected()
+{
+    if (m_closed) {
+        return;
+    }
+
+    m_closed = true;
+    m_pollTimer->stop();
+
+    if (!m_source.isNull()) {
+        m_server->detachConnection(m_source);
+    }
+
+    deleteLater();
+}
+
+bool StreamConnection::parseRange(const QByteArray &value, qint64 &first, qint64 &last) const
+{
+    /* Tuetaan vain yksinkertaista muotoa "bytes=alku-[loppu]". */
+    if (!value.startsWith("bytes=") || value.contains(',')) {
+        return false;
+    }
+
+    QByteArray range = value.mid(6);
+    int dash = range.indexOf('-');
+
+    if (dash <= 0) {
+        return false;
+    }
+
+    bool ok;
+    first = range.left(dash).toLongLong(&ok);
+
+    if (!ok || first < 0) {
+        return false;
+    }
+
+    QByteArray lastString = range.mid(dash + 1);
+    last = -1;
+
+    if (!lastString.isEmpty()) {
+        last = lastString.toLongLong(&ok);
+
+        if (!ok || last < first) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void StreamConnection::sendResponse(const QByteArray &status, const QList<QByteArray> &headers)
+{
+    QByteArray response = "HTTP/1.1 " + status + "\r\n";
+    int count = headers.size();
+
+    for (int i = 0; i < count; i++) {
+        response.append(headers.at(i));
+        response.append("\r\n");
+    }
+
+    response.append("Connection: close\r\n\r\n");
+    m_socket->write(response);
+}
+
+void StreamConnection::sendError(const QByteArray &status, const QList<QByteArray> &headers)
+{
+    qWarning() << "StreamServer:" << status;
+    m_responding = true;
+    sendResponse(status, QList<QByteArray>(headers) << "Content-Length: 0");
+    m_socket->disconnectFromHost();
+}
+
+StreamServer::StreamServer(QObject *parent) :
+    QObject(parent), m_server(new QTcpServer(this)), m_nextId(1)
+{
+    connect(m_server, SIGNAL(newConnection()), SLOT(newConnection()));
+}
+
+bool StreamServer::listen()
+{
+    if (m_server->isListening()) {
+        return true;
+    }
+
+    if (!m_server->listen(QHostAddress::LocalHost, 0)) {
+        m_lastError = m_server->errorString();
+        return false;
+    }
+
+    qDebug() << "StreamServer: port" << m_server->serverPort();
+    return true;
+}
+
+bool StreamServer::isListening() const
+{
+    return m_server->isListening();
+}
+
+QString StreamServer::lastError() const
+{
+    return m_lastError;
+}
+
+QUrl StreamServer::addSource(StreamSource *source, const QString &name)
+{
+    int id = m_nextId++;
+    source->setParent(this);
+    m_sources.insert(id, source);
+    m_sourceNames.insert(source, name);
+    connect(source, SIGNAL(destroyed(QObject*)), SLOT(sourceDestroyed(QObject*)));
+    return sourceUrl(source);
+}
+
+QUrl StreamServer::sourceUrl(StreamSource *source) const
+{
+    int id = m_sources.key(source, -1);
+
+    if (id < 0) {
+        return QUrl();
+    }
+
+    QUrl url;
+    url.setScheme("http");
+    url.setHost("127.0.0.1");
+    url.setPort(m_server->serverPort());
+    url.setPath(QString("/%1/%2").arg(id).arg(m_sourceNames.value(source)));
+    return url;
+}
+
+void StreamServer::removeSource(StreamSource *source)
+{
+    int id = m_sources.key(source, -1);
+
+    if (id >= 0) {
+        m_sources.remove(id);
+        m_connectionCounts.remove(source);
+        m_sourceNames.remove(source);
+        m_retiredSources.removeAll(source);
+        source->deleteLater();
+    }
+}
+
+void StreamServer::removeSourceWhenIdle(StreamSource *source)
+{
+    if (m_connectionCounts.value(source) == 0) {
+        removeSource(source);
+        return;
+    }
+
+    if (!m_retiredSources.contains(source)) {
+        m_retiredSources.append(source);
+    }
+}
+
+void StreamServer::removeIdleSources()
+{
+    QList<StreamSource*> sources = m_retiredSources;
+    int count = sources.size();
+
+    for (int i = 0; i < count; i++) {
+        if (m_connectionCounts.value(sources.at(i)) == 0) {
+            removeSource(sources.at(i));
+        }
+    }
+}
+
+StreamSource* StreamServer::source(int id) const
+{
+    return m_sources.value(id);
+}
+
+void StreamServer::newConnection()
+{
+    while (m_server->hasPendingConnections()) {
+        new StreamConnection(m_server->nextPendingConnection(), this);
+    }
+}
+
+void StreamServer::sourceDestroyed(QObject *object)
+{
+    /* Lähde on jo tuhottu, joten osoitinta käytetään vain avaimena. */
+    StreamSource *source = static_cast<StreamSource*>(object);
+    m_sources.remove(m_sources.key(source, -1));
+    m_connectionCounts.remove(source);
+    m_sourceNames.remove(source);
+    m_retiredSources.removeAll(source);
+}
+
+void StreamServer::attachConnection(StreamSource *source)
+{
+    m_connectionCounts[source]++;
+}
+
+void StreamServer::detachConnection(StreamSource *source)
+{
+    int count = m_connectionCounts.value(source) - 1;
+
+    if (count > 0) {
+        m_connectionCounts.insert(source, count);
+        return;
+    }
+
+    /* Tiedosto suljetaan, kun soitin ei enää lue sitä. */
+    m_connectionCounts.remove(source);
+    source->release();
+
+    if (m_retiredSources.contains(source)) {
+        QTimer::singleShot(IDLE_SOURCE_TIMEOUT, this, SLOT(removeIdleSources()));
+    }
+}
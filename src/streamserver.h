@@ -0,0 +1,121 @@
+#ifndef STREAMSERVER_H
+#define STREAMSERVER_H
+
+#include <QFile>
+#include <QHash>
+#include <QObject>
+#include <QPointer>
+#include <QUrl>
+
+class QTcpServer;
+class QTcpSocket;
+class QTimer;
+class Downloader;
+
+/* Paikallisen palvelimen tietolähde. availableAt kertoo, montako tavua kohdasta
+   offset alkaen voidaan lukea heti, ja lähde ilmoittaa uusista tavuista
+   dataAvailable-signaalilla. requestAt kertoo lähteelle, mistä soitin lukee seuraavaksi. */
+class StreamSource : public QObject
+{
+    Q_OBJECT
+public:
+    StreamSource(QObject *parent = 0);
+    virtual qint64 availableAt(qint64 offset) const = 0;
+    virtual void requestAt(qint64 offset);
+    virtual qint64 totalSize() const = 0;
+    virtual bool isComplete() const = 0;
+    virtual QByteArray read(qint64 offset, qint64 maxSize) = 0;
+    virtual QByteArray contentType() const;
+    virtual void release();
+
+signals:
+    void dataAvailable();
+};
+
+/* Kesken olevan latauksen tiedosto, joka kasvaa sitä mukaa kuin Downloader kirjoittaa,
+   tai valmis tiedosto jaettuna kohdasta startOffset alkaen. */
+class FileStreamSource : public StreamSource
+{
+    Q_OBJECT
+public:
+    FileStreamSource(Downloader *downloader, QObject *parent = 0);
+    FileStreamSource(const QString &filename, qint64 startOffset, QObject *parent = 0);
+    qint64 availableAt(qint64 offset) const;
+    qint64 totalSize() const;
+    bool isComplete() const;
+    QByteArray read(qint64 offset, qint64 maxSize);
+    QByteArray contentType() const;
+    void release();
+
+private:
+    qint64 bytesWritten() const;
+    QPointer<Downloader> m_downloader;
+    QString m_filename;
+    QFile m_file;
+    qint64 m_startOffset;
+};
+
+class StreamServer;
+
+class StreamConnection : public QObject
+{
+    Q_OBJECT
+public:
+    StreamConnection(QTcpSocket *socket, StreamServer *server);
+    StreamSource* source() const;
+
+private slots:
+    void readRequest();
+    void writeData();
+    void socketDisconnected();
+
+private:
+    bool parseRange(const QByteArray &value, qint64 &first, qint64 &last) const;
+    void sendResponse(const QByteArray &status, const QList<QByteArray> &headers);
+    void sendError(const QByteArray &status, const QList<QByteArray> &headers = QList<QByteArray>());
+    StreamServer *m_server;
+    QTcpSocket *m_socket;
+    QPointer<StreamSource> m_source;
+    QTimer *m_pollTimer;
+    QByteArray m_request;
+    qint64 m_offset;
+    qint64 m_end;
+    bool m_responding;
+    bool m_closed;
+};
+
+/* HTTP-palvelin, joka jakaa lähteitä soittimelle osoitteessa 127.0.0.1. Soitin voi
+   hypätä Range-otsakkeella, ja lukeminen odottaa, kunnes pyydetyt tavut on ladattu. */
+class StreamServer : public QObject
+{
+    Q_OBJECT
+public:
+    StreamServer(QObject *parent = 0);
+    bool listen();
+    bool isListening() const;
+    QString lastError() const;
+    QUrl addSource(StreamSource *source, const QString &name);
+    QUrl sourceUrl(StreamSource *source) const;
+    void removeSource(StreamSource *source);
+    void removeSourceWhenIdle(StreamSource *source);
+    StreamSource* source(int id) const;
+
+private slots:
+    void newConnection();
+    void sourceDestroyed(QObject *object);
+    void removeIdleSources();
+
+private:
+    friend class StreamConnection;
+    void attachConnection(StreamSource *source);
+    void detachConnection(StreamSource *source);
+    QTcpServer *m_server;
+    QHash<int, StreamSource*> m_sources;
+    QHash<StreamSource*, int> m_connectionCounts;
+    QHash<StreamSource*, QString> m_sourceNames;
+    QList<StreamSource*> m_retiredSources;
+    int m_nextId;
+    QString m_lastError;
+};
+
+#endif // STREAMSERVER_H
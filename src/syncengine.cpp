@@ -0,0 +1,205 @@
+#include <QCryptographicHash>
+#include <QDataStream>
+#include <QDateTime>
+#include <QDebug>
+#include <QTimer>
+#include "syncengine.h"
+#include "tvkaistaclient.h"
+
+/* Syötteiden päivitysvälit millisekunteina. Ajankohtia hajautetaan ±10 %, jotta
+   päivitykset eivät osu aina samaan hetkeen. */
+static const qint64 FEED_INTERVALS[3] = { 10 * 60 * 1000, 15 * 60 * 1000, 24 * 60 * 60 * 1000 };
+static const qint64 FIRST_DELAYS[3] = { 60 * 1000, 90 * 1000, 24 * 60 * 60 * 1000 };
+
+/* Epäonnistunut haku yritetään uudelleen 30 sekunnin päästä, ja viive kaksinkertaistuu
+   jokaisella peräkkäisellä virheellä päivitysväliin asti. Etualan pyynnön keskeyttämä
+   haku yritetään uudelleen samalla viiveellä kasvattamatta sitä. */
+static const qint64 RETRY_DELAY = 30 * 1000;
+static const int CHECK_INTERVAL = 5000;
+
+static QByteArray programmesDigest(const ProgrammeSnapshot &programmes)
+{
+    QByteArray data;
+    QDataStream stream(&data, QIODevice::WriteOnly);
+    int count = programmes.size();
+
+    for (int i = 0; i < count; i++) {
+        const Programme &programme = programmes.at(i);
+        stream << programme.id << programme.startTime << programme.title << programme.description
+               << programme.channelId << programme.flags << programme.duration << programme.seasonPassId;
+    }
+
+    return QCryptographicHash::hash(data, QCryptographicHash::Md5);
+}
+
+SyncEngine::SyncEngine(TvkaistaClient *client, QObject *parent) :
+    QObject(parent), m_client(client), m_timer(new QTimer(this)), m_pendingFeed(-1)
+{
+    for (int i = 0; i < 3; i++) {
+        m_due[i] = 0;
+        m_failures[i] = 0;
+    }
+
+    qsrand(uint(QDateTime::currentMSecsSinceEpoch()));
+    m_timer->setInterval(CHECK_INTERVAL);
+    connect(m_timer, SIGNAL(timeout()), SLOT(checkFeeds()));
+    connect(m_client, SIGNAL(playlistFetched(ProgrammeSnapshot)), SLOT(playlistFetched()));
+    connect(m_client, SIGNAL(seasonPassListFetched(ProgrammeSnapshot)), SLOT(seasonPassListFetched()));
+    connect(m_client, SIGNAL(channelsFetched(QList<Channel>)), SLOT(channelsFetched()));
+    connect(m_client, SIGNAL(backgroundRequestFailed()), SLOT(backgroundRequestFailed()));
+}
+
+void SyncEngine::start()
+{
+    for (int i = 0; i < 3; i++) {
+        scheduleFeed(i, FIRST_DELAYS[i]);
+    }
+
+    m_timer->start();
+}
+
+void SyncEngine::stop()
+{
+    m_timer->stop();
+    m_pendingFeed = -1;
+}
+
+void SyncEngine::requestRefresh(int feed)
+{
+    Q_ASSERT(feed >= 0 && feed < 3);
+
+    /* Pyydetty päivitys julkaistaan aina, koska näkymää on voitu muuttaa paikallisesti. */
+    m_digests[feed].clear();
+    m_due[feed] = 0;
+    QTimer::singleShot(0, this, SLOT(checkFeeds()));
+}
+
+bool SyncEngine::contentChanged(int feed, const ProgrammeSnapshot &programmes)
+{
+    Q_ASSERT(feed >= 0 && feed < 2);
+    QByteArray digest = programmesDigest(programmes);
+
+    if (digest == m_digests[feed]) {
+        return false;
+    }
+
+    m_digests[feed] = digest;
+    return true;
+}
+
+bool SyncEngine::contentChanged(const QList<Channel> &channels)
+{
+    QByteArray data;
+    QDataStream stream(&data, QIODevice::WriteOnly);
+    int count = channels.size();
+
+    for (int i = 0; i < count; i++) {
+        stream << channels.at(i).id << channels.at(i).name;
+    }
+
+    QByteArray digest = QCryptographicHash::hash(data, QCryptographicHash::Md5);
+
+    if (digest == m_digests[2]) {
+        return false;
+    }
+
+    m_digests[2] = digest;
+    return true;
+}
+
+void SyncEngine::checkFeeds()
+{
+    if (m_pendingFeed >= 0) {
+        if (m_client->isRequestUnfinished() && m_client->isBackgroundRequest()) {
+            return;
+        }
+
+        /* Haku katosi ilman tulosta, eli etualan pyyntö keskeytti sen. */
+        scheduleFeed(m_pendingFeed, RETRY_DELAY);
+        m_pendingFeed = -1;
+    }
+
+    if (!m_timer->isActive() || !m_client->isValidUsernameAndPassword() || m_client->isRequestUnfinished()) {
+        return;
+    }
+
+    qint64 now = QDateTime::currentMSecsSinceEpoch();
+
+    for (int i = 0; i < 3; i++) {
+        if (m_due[i] <= now) {
+            sendRequest(i);
+            return;
+        }
+    }
+}
+
+void SyncEngine::playlistFetched()
+{
+    feedFetched(0);
+}
+
+void SyncEngine::seasonPassListFetched()
+{
+    feedFetched(1);
+}
+
+void SyncEngine::channelsFetched()
+{
+    feedFetched(2);
+}
+
+void SyncEngine::backgroundRequestFailed()
+{
+    if (m_pendingFeed < 0) {
+        return;
+    }
+
+    int feed = m_pendingFeed;
+    m_pendingFeed = -1;
+    m_failures[feed]++;
+    qint64 delay = qMin(FEED_INTERVALS[feed], RETRY_DELAY << qMin(m_failures[feed] - 1, 16));
+    qDebug() << "Sync: feed" << feed << "failed" << m_failures[feed] << "times, retry in" << delay / 1000 << "s";
+    scheduleFeed(feed, delay);
+}
+
+void SyncEngine::sendRequest(int feed)
+{
+    qDebug() << "Sync: refreshing feed" << feed;
+    m_pendingFeed = feed;
+
+    if (feed == 0) {
+        m_client->sendPlaylistRequest();
+    }
+    else if (feed == 1) {
+        m_client->sendSeasonPassListRequest();
+    }
+    else {
+        m_client->sendChannelRequest();
+    }
+
+    m_client->markBackgroundRequest();
+}
+
+void SyncEngine::feedFetched(int feed)
+{
+    /* Myös etualalla haettu syöte on tuore, joten seuraava päivitys siirtyy. */
+    if (m_pendingFeed == feed) {
+        m_pendingFeed = -1;
+    }
+
+    m_failures[feed] = 0;
+    scheduleFeed(feed, FEED_INTERVALS[feed]);
+
+    /* Samaan vapaaseen hetkeen mahtuvat muutkin erääntyneet syötteet. */
+    QTimer::singleShot(0, this, SLOT(checkFeeds()));
+}
+
+void SyncEngine::scheduleFeed(int feed, qint64 delay)
+{
+    m_due[feed] = QDateTime::currentMSecsSinceEpoch() + jittered(delay);
+}
+
+qint64 SyncEngine::jittered(qint64 delay)
+{
+    return qint64(delay * (0.9 + 0.2 * qrand() / RAND_MAX));
+}
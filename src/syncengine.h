@@ -0,0 +1,46 @@
+#ifndef SYNCENGINE_H
+#define SYNCENGINE_H
+
+#include <QByteArray>
+#include <QList>
+#include <QObject>
+#include "channel.h"
+#include "programmesnapshot.h"
+
+class QTimer;
+class TvkaistaClient;
+
+/* Päivittää katselulistan, suosikkisarjat ja kanavat taustalla silloin, kun asiakas
+   on vapaana. Syötteet numeroidaan: 0 = katselulista, 1 = suosikkisarjat, 2 = kanavat. */
+class SyncEngine : public QObject
+{
+    Q_OBJECT
+public:
+    explicit SyncEngine(TvkaistaClient *client, QObject *parent = 0);
+    void start();
+    void stop();
+    void requestRefresh(int feed);
+    bool contentChanged(int feed, const ProgrammeSnapshot &programmes);
+    bool contentChanged(const QList<Channel> &channels);
+
+private slots:
+    void checkFeeds();
+    void playlistFetched();
+    void seasonPassListFetched();
+    void channelsFetched();
+    void backgroundRequestFailed();
+
+private:
+    void sendRequest(int feed);
+    void feedFetched(int feed);
+    void scheduleFeed(int feed, qint64 delay);
+    static qint64 jittered(qint64 delay);
+    TvkaistaClient *m_client;
+    QTimer *m_timer;
+    qint64 m_due[3];
+    int m_failures[3];
+    QByteArray m_digests[3];
+    int m_pendingFeed;
+};
+
+#endif // SYNCENGINE_H
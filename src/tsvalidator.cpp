@@ -0,0 +1,300 @@
+#include <QDataStream>
+#include <QDebug>
+#include <algorithm>
+#include "tsvalidator.h"
+
+static const int PACKET_SIZE = 188;
+static const int INDEX_ENTRY_SIZE = 17;
+static const int NULL_PID = 0x1FFF;
+
+/* PCR-kellon taajuus on 90 kHz. Avainkuvat tallennetaan korkeintaan puolen sekunnin
+   välein ja pelkkä PCR kahden sekunnin välein, jos avainkuvia ei tunnisteta. */
+static const qint64 KEYFRAME_INTERVAL = 45000;
+static const qint64 PCR_INTERVAL = 180000;
+
+/* PCR:n 33-bittinen perusosa pyörähtää ympäri noin 26,5 tunnin välein. */
+static const qint64 PCR_WRAP = Q_INT64_C(1) << 33;
+
+/* Jatkuvuuslaskurin rinnalla pidettävä merkintä edellisestä kaksoispaketista. */
+static const int DUPLICATE_FLAG = 0x10;
+
+static bool pcrLessThanEntry(qint64 pcr, const TsIndexEntry &entry)
+{
+    return pcr < entry.pcr;
+}
+
+TsValidator::TsValidator(qint64 byteOffset) :
+    m_continuity(NULL_PID + 1, -1), m_offset(byteOffset), m_lastPcr(-1), m_lastRawPcr(-1),
+    m_pcrWraps(0), m_lastIndexPcr(-1),
+    m_synced(false), m_syncErrors(0), m_continuityErrors(0), m_transportErrors(0)
+{
+}
+
+TsValidator::~TsValidator()
+{
+    close();
+}
+
+bool TsValidator::open(const QString &indexFilename, bool resume)
+{
+    QVector<TsIndexEntry> entries;
+    int count = 0;
+
+    /* Jatkokohdan jälkeiset tietueet osoittavat tavuihin, jotka ladataan uudelleen. */
+    if (resume && readIndex(indexFilename, entries)) {
+        while (count < entries.size() && entries.at(count).offset + PACKET_SIZE <= m_offset) {
+            count++;
+        }
+    }
+
+    m_indexFile.setFileName(indexFilename);
+    QIODevice::OpenMode mode = resume ? QIODevice::ReadWrite : (QIODevice::WriteOnly | QIODevice::Truncate);
+    qDebug() << "WRITE" << indexFilename << count << "entries kept";
+
+    if (!m_indexFile.open(mode) || !m_indexFile.resize(qint64(count) * INDEX_ENTRY_SIZE) ||
+            !m_indexFile.seek(qint64(count) * INDEX_ENTRY_SIZE)) {
+        m_lastError = m_indexFile.errorString();
+        m_indexFile.close();
+        return false;
+    }
+
+    /* PCR:n ympäripyörähdykset jatkuvat viimeisestä säilytetystä tietueesta. */
+    if (count > 0) {
+        qint64 pcr = entries.at(count - 1).pcr;
+        m_lastPcr = pcr;
+        m_lastIndexPcr = pcr;
+        m_pcrWraps = pcr / PCR_WRAP;
+        m_lastRawPcr = pcr % PCR_WRAP;
+    }
+
+    return true;
+}
+
+void TsValidator::close()
+{
+    /* Virta päättyi kesken paketin, eli tallenne on katkennut. */
+    if (!m_buffer.isEmpty()) {
+        m_syncErrors++;
+        m_buffer.clear();
+    }
+
+    if (m_indexFile.isOpen()) {
+        m_indexFile.close();
+    }
+}
+
+void TsValidator::feed(const char *data, qint64 length)
+{
+    m_buffer.append(data, length);
+    const uchar *p = reinterpret_cast<const uchar*>(m_buffer.constData());
+    int size = m_buffer.size();
+    int pos = 0;
+
+    while (size - pos >= PACKET_SIZE) {
+        if (p[pos] != 0x47) {
+            if (m_synced) {
+                m_syncErrors++;
+                m_synced = false;
+                m_continuity.fill(-1);
+            }
+
+            pos++;
+            continue;
+        }
+
+        /* Tahdistus hyväksytään, kun myös seuraava paketti alkaa tahdistustavulla. */
+        if (!m_synced) {
+            if (size - pos >= 2 * PACKET_SIZE && p[pos + PACKET_SIZE] != 0x47) {
+                pos++;
+                continue;
+            }
+
+            m_synced = true;
+        }
+
+        checkPacket(p + pos, m_offset + pos);
+        pos += PACKET_SIZE;
+    }
+
+    m_offset += pos;
+    m_buffer.remove(0, pos);
+}
+
+int TsValidator::syncErrors() const
+{
+    return m_syncErrors;
+}
+
+int TsValidator::continuityErrors() const
+{
+    return m_continuityErrors;
+}
+
+int TsValidator::transportErrors() const
+{
+    return m_transportErrors;
+}
+
+int TsValidator::errorCount() const
+{
+    return m_syncErrors + m_continuityErrors + m_transportErrors;
+}
+
+QString TsValidator::lastError() const
+{
+    return m_lastError;
+}
+
+QString TsValidator::indexFilename(const QString &filename)
+{
+    return filename + ".idx";
+}
+
+bool TsValidator::readIndex(const QString &indexFilename, QVector<TsIndexEntry> &entries)
+{
+    QFile file(indexFilename);
+
+    if (!file.open(QIODevice::ReadOnly)) {
+        return false;
+    }
+
+    QDataStream stream(&file);
+    stream.setByteOrder(QDataStream::LittleEndian);
+    entries.clear();
+    entries.reserve(file.size() / INDEX_ENTRY_SIZE);
+
+    while (!stream.atEnd()) {
+        qint64 offset;
+        qint64 pcr;
+        quint8 flags;
+        stream >> offset >> pcr >> flags;
+
+        /* Katkennut viimeinen tietue jätetään pois. */
+        if (stream.status() != QDataStream::Ok) {
+            break;
+        }
+
+        TsIndexEntry entry;
+        entry.offset = offset;
+        entry.pcr = pcr;
+        entry.flags = flags;
+        entries.append(entry);
+    }
+
+    return !entries.isEmpty();
+}
+
+/* Palauttaa viimeisen avainkuvan sijainnin ennen kohtaa, joka on msecs millisekuntia
+   tallenteen ensimmäisestä tietueesta. */
+qint64 TsValidator::offsetForTime(const QVector<TsIndexEntry> &entries, qint64 msecs)
+{
+    if (entries.isEmpty()) {
+        return 0;
+    }
+
+    qint64 pcr = entries.first().pcr + msecs * 90;
+    const TsIndexEntry *begin = entries.constData();
+    const TsIndexEntry *i = std::upper_bound(begin, begin + entries.size(), pcr, pcrLessThanEntry);
+
+    if (i == begin) {
+        return 0;
+    }
+
+    const TsIndexEntry *entry = i - 1;
+
+    while (entry != begin && entry->flags != 1) {
+        --entry;
+    }
+
+    /* Avainkuvia ei tunnistettu, joten käytetään lähintä PCR-tietuetta. */
+    if (entry->flags != 1) {
+        entry = i - 1;
+    }
+
+    return entry->offset;
+}
+
+void TsValidator::checkPacket(const uchar *packet, qint64 offset)
+{
+    if (packet[1] & 0x80) {
+        m_transportErrors++;
+    }
+
+    int pid = ((packet[1] & 0x1F) << 8) | packet[2];
+
+    if (pid == NULL_PID) {
+        return;
+    }
+
+    int adaptationFieldControl = (packet[3] >> 4) & 0x03;
+    int counter = packet[3] & 0x0F;
+    bool discontinuity = false;
+    bool randomAccess = false;
+    bool pcrFound = false;
+
+    if ((adaptationFieldControl & 0x02) && packet[4] > 0) {
+        uchar flags = packet[5];
+        discontinuity = (flags & 0x80) != 0;
+        randomAccess = (flags & 0x40) != 0;
+
+        if ((flags & 0x10) && packet[4] >= 7) {
+            qint64 pcr = ((qint64)packet[6] << 25) | (packet[7] << 17) | (packet[8] << 9) |
+                         (packet[9] << 1) | (packet[10] >> 7);
+
+            /* Ympäripyörähdys tunnistetaan yli puolen kierroksen hypystä taaksepäin,
+               jotta hakemiston aikaleimat kasvavat koko tallenteen ajan. */
+            if (m_lastRawPcr >= 0 && m_lastRawPcr - pcr > PCR_WRAP / 2) {
+                m_pcrWraps++;
+            }
+
+            m_lastRawPcr = pcr;
+            m_lastPcr = pcr + m_pcrWraps * PCR_WRAP;
+            pcrFound = true;
+        }
+    }
+
+    /* Laskuri kasvaa vain hyötykuormallisissa paketeissa, ja peräkkäin on sallittu
+       korkeintaan yksi kaksoispaketti. */
+    if (adaptationFieldControl & 0x01) {
+        int previous = m_continuity.at(pid);
+        bool duplicate = false;
+
+        if (previous >= 0 && !discontinuity) {
+            int previousCounter = previous & 0x0F;
+
+            if (counter == previousCounter) {
+                duplicate = true;
+
+                if (previous & DUPLICATE_FLAG) {
+                    m_continuityErrors++;
+                }
+            }
+            else if (counter != ((previousCounter + 1) & 0x0F)) {
+                m_continuityErrors++;
+            }
+        }
+
+        m_continuity[pid] = duplicate ? (counter | DUPLICATE_FLAG) : counter;
+    }
+
+    if (m_lastPcr < 0 || !m_indexFile.isOpen()) {
+        return;
+    }
+
+    qint64 elapsed = m_lastIndexPcr < 0 ? -1 : m_lastPcr - m_lastIndexPcr;
+
+    if (randomAccess && (elapsed < 0 || elapsed >= KEYFRAME_INTERVAL)) {
+        addIndexEntry(offset, 1);
+    }
+    else if (pcrFound && (elapsed < 0 || elapsed >= PCR_INTERVAL)) {
+        addIndexEntry(offset, 0);
+    }
+}
+
+void TsValidator::addIndexEntry(qint64 offset, int flags)
+{
+    QDataStream stream(&m_indexFile);
+    stream.setByteOrder(QDataStream::LittleEndian);
+    stream << offset << m_lastPcr << (quint8)flags;
+    m_lastIndexPcr = m_lastPcr;
+}
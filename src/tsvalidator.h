@@ -0,0 +1,58 @@
+#ifndef TSVALIDATOR_H
+#define TSVALIDATOR_H
+
+#include <QByteArray>
+#include <QFile>
+#include <QVector>
+
+struct TsIndexEntry
+{
+    qint64 offset;
+    qint64 pcr;
+    int flags;
+};
+
+Q_DECLARE_TYPEINFO(TsIndexEntry, Q_PRIMITIVE_TYPE);
+
+/* Tarkistaa ladattavan MPEG-TS-virran paketti kerrallaan: tahdistustavu 0x47 188 tavun
+   välein ja jatkuvuuslaskurit PID:eittäin. Samalla kirjoitetaan hakemisto avainkuvien
+   ja PCR-aikaleimojen sijainneista tiedostoon, jonka nimi on tallenteen nimi + ".idx".
+   Tietue: sijainti (qint64), PCR (qint64, ei pyörähdä ympäri) ja tyyppi (quint8,
+   0 = PCR, 1 = avainkuva). Jatkettaessa hakemistosta poistetaan jatkokohdan jälkeiset
+   tietueet. */
+class TsValidator
+{
+public:
+    TsValidator(qint64 byteOffset = 0);
+    ~TsValidator();
+    bool open(const QString &indexFilename, bool resume);
+    void close();
+    void feed(const char *data, qint64 length);
+    int syncErrors() const;
+    int continuityErrors() const;
+    int transportErrors() const;
+    int errorCount() const;
+    QString lastError() const;
+    static QString indexFilename(const QString &filename);
+    static bool readIndex(const QString &indexFilename, QVector<TsIndexEntry> &entries);
+    static qint64 offsetForTime(const QVector<TsIndexEntry> &entries, qint64 msecs);
+
+private:
+    void checkPacket(const uchar *packet, qint64 offset);
+    void addIndexEntry(qint64 offset, int flags);
+    QFile m_indexFile;
+    QByteArray m_buffer;
+    QVector<qint8> m_continuity;
+    qint64 m_offset;
+    qint64 m_lastPcr;
+    qint64 m_lastRawPcr;
+    qint64 m_pcrWraps;
+    qint64 m_lastIndexPcr;
+    bool m_synced;
+    int m_syncErrors;
+    int m_continuityErrors;
+    int m_transportErrors;
+    QString m_lastError;
+};
+
+#endif // TSVALIDATOR_H
@@ -1,6 +1,7 @@
 # -------------------------------------------------
 # Project created by QtCreator 2010-12-14T11:39:12
 # -------------------------------------------------
+CONFIG += c++11
 QT += core \
     widgets \
     gui \
@@ -28,7 +29,23 @@ SOURCES += main.cpp \
     thumbnail.cpp \
     texteditordialog.cpp \
     historyentry.cpp \
-    historymanager.cpp
+    historymanager.cpp \
+    programmesnapshot.cpp \
+    cachemaintainer.cpp \
+    posterpack.cpp \
+    posterloader.cpp \
+    startuploader.cpp \
+    filemonitor.cpp \
+    streamserver.cpp \
+    tsvalidator.cpp \
+    prebuffersource.cpp \
+    programmepageparser.cpp \
+    programmeindex.cpp \
+    programmeindexloader.cpp \
+    epggridwidget.cpp \
+    syncengine.cpp \
+    serverprober.cpp \
+    appsettings.cpp
 HEADERS += mainwindow.h \
     tvkaistaclient.h \
     channelfeedparser.h \
@@ -48,7 +65,23 @@ HEADERS += mainwindow.h \
     thumbnail.h \
     texteditordialog.h \
     historyentry.h \
-    historymanager.h
+    historymanager.h \
+    programmesnapshot.h \
+    cachemaintainer.h \
+    posterpack.h \
+    posterloader.h \
+    startuploader.h \
+    filemonitor.h \
+    streamserver.h \
+    tsvalidator.h \
+    prebuffersource.h \
+    programmepageparser.h \
+    programmeindex.h \
+    programmeindexloader.h \
+    epggridwidget.h \
+    syncengine.h \
+    serverprober.h \
+    appsettings.h
 FORMS += mainwindow.ui \
     settingsdialog.ui \
     aboutdialog.ui \
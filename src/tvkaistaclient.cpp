@@ -6,27 +6,51 @@
 #include <QNetworkReply>
 #include <QNetworkRequest>
 #include <QNetworkCookie>
+#include <QThread>
 #include <QTimer>
 #include <QUrl>
 #include <QAuthenticator>
 #include "cache.h"
 #include "channelfeedparser.h"
 #include "programmefeedparser.h"
-#include "programmetableparser.h"
+#include "programmepageparser.h"
 #include "tvkaistaclient.h"
 
+/* Ohjauksen kohdeosoite on voimassa rajoitetun ajan, ja ennakkoon selvitettäviä
+   osoitteita haetaan korkeintaan kaksi kerrallaan. */
+static const int STREAM_URL_TTL = 10 * 60;
+static const int MAX_RESOLVE_REQUESTS = 2;
+
+/* Hakutulokset säilytetään viisi minuuttia, korkeintaan 20 hakulausekkeelle. */
+static const int SEARCH_RESULT_TTL = 5 * 60;
+static const int MAX_SEARCH_RESULTS = 20;
+
 TvkaistaClient::TvkaistaClient(QObject *parent) :
     QObject(parent), m_networkAccessManager(new QNetworkAccessManager(this)), m_reply(0),
-    m_cache(0), m_programmeTableParser(new ProgrammeTableParser), m_requestType(-1)
+    m_cache(0), m_parserThread(new QThread(this)), m_pageParser(new ProgrammePageParser),
+    m_programmeRequestId(0), m_parsePending(false), m_requestedChannelId(-1), m_busyTime(0),
+    m_cachedStreamFormat(-1), m_cachedSearchPending(false), m_pendingSearchRefresh(false),
+    m_requestType(-1), m_backgroundResult(false)
 {
     m_requestedProgramme.id = -1;
     m_requestedStream.id = -1;
+    m_cachedStream.id = -1;
     connect(m_networkAccessManager, SIGNAL(authenticationRequired(QNetworkReply*, QAuthenticator*)), SLOT(requestAuthenticationRequired(QNetworkReply*, QAuthenticator*)));
+    connect(m_networkAccessManager, SIGNAL(finished(QNetworkReply*)), SLOT(networkRequestFinished()));
+
+    /* Ohjelmasivut jäsennetään omassa säikeessään, jotta käyttöliittymä ei jumitu
+       QTextCodec-muunnoksiin ja säännöllisiin lausekkeisiin. */
+    m_pageParser->moveToThread(m_parserThread);
+    connect(m_pageParser, SIGNAL(pageParsed(int, int, QDate, bool, QVariantList, qint64)),
+            SLOT(programmePageParsed(int, int, QDate, bool, QVariantList, qint64)));
+    m_parserThread->start();
 }
 
 TvkaistaClient::~TvkaistaClient()
 {
-    delete m_programmeTableParser;
+    m_parserThread->quit();
+    m_parserThread->wait();
+    delete m_pageParser;
 }
 
 void TvkaistaClient::setCache(Cache *cache)
@@ -131,7 +155,30 @@ bool TvkaistaClient::isValidUsernameAndPassword() const
 
 bool TvkaistaClient::isRequestUnfinished() const
 {
-    return m_reply != 0;
+    /* Jäsennettävänä oleva ohjelmasivu lasketaan keskeneräiseksi pyynnöksi, jotta
+       taustahaut eivät ohita sitä. */
+    return m_reply != 0 || m_parsePending;
+}
+
+void TvkaistaClient::markBackgroundRequest()
+{
+    /* Merkintä kulkee vastauksen mukana, joten uudelleenkirjautumisen jälkeen lähetetty
+       pyyntö ei peri sitä. */
+    if (m_reply != 0) {
+        m_reply->setProperty("background", true);
+    }
+}
+
+bool TvkaistaClient::isBackgroundRequest() const
+{
+    return m_reply != 0 && m_reply->property("background").toBool();
+}
+
+/* Kertoo, tuliko juuri välitettävä syöte taustahaun vastauksesta. Vastaus on jo
+   vapautettu signaalia lähetettäessä, joten merkintä luetaan talteen ennen sitä. */
+bool TvkaistaClient::isBackgroundResult() const
+{
+    return m_backgroundResult;
 }
 
 void TvkaistaClient::sendLoginRequest()
@@ -169,8 +216,14 @@ void TvkaistaClient::sendProgrammeRequest(int channelId, const QDate &date)
     connect(m_reply, SIGNAL(error(QNetworkReply::NetworkError)), SLOT(requestNetworkError(QNetworkReply::NetworkError)));
     connect(m_reply, SIGNAL(readyRead()), SLOT(programmeRequestReadyRead()));
     connect(m_reply, SIGNAL(finished()), SLOT(programmeRequestFinished()));
-    m_programmeTableParser->setRequestedDate(date);
-    m_programmeTableParser->setRequestedChannelId(channelId);
+    m_requestedChannelId = channelId;
+    m_requestedDate = date;
+    m_programmeRequestId++;
+    m_parsePending = false;
+    m_busyTime = 0;
+    QMetaObject::invokeMethod(m_pageParser, "start", Qt::QueuedConnection,
+                              Q_ARG(int, m_programmeRequestId), Q_ARG(int, channelId),
+                              Q_ARG(QDate, date));
 }
 
 void TvkaistaClient::sendPosterRequest(const Programme &programme)
@@ -211,26 +264,21 @@ QNetworkReply* TvkaistaClient::sendRequestWithAuthHeader(const QUrl &url)
 
 void TvkaistaClient::sendStreamRequest(const Programme &programme)
 {
-    abortRequest();
-    QString urlString = QString("http://www.tvkaista.com/recordings/download/%1/").arg(programme.id);
-
-    switch (m_format) {
-    case 0:
-        urlString.append("3/300000/");
-        break;
-
-    case 1:
-        urlString.append("4/1000000/");
-        break;
-
-    case 2:
-        urlString.append("3/2000000/");
-        break;
-
-    default:
-        urlString.append("0/8000000/");
+    QUrl cachedUrl = cachedStreamUrl(programme.id, m_format);
+
+    /* Osoite on jo selvitetty, joten muita pyyntöjä ei keskeytetä. Signaali lähetetään
+       vasta tapahtumasilmukasta, kuten palvelimelta haettaessa. */
+    if (cachedUrl.isValid()) {
+        qDebug() << "CACHED" << cachedUrl.toString();
+        m_cachedStream = programme;
+        m_cachedStreamFormat = m_format;
+        m_cachedStreamUrl = cachedUrl;
+        QTimer::singleShot(0, this, SLOT(cachedStreamUrlReady()));
+        return;
     }
 
+    abortRequest();
+    QString urlString = streamRequestUrl(programme.id, m_format);
     setServerCookie();
     qDebug() << "Server" << m_server;
     qDebug() << "GET" << urlString;
@@ -242,9 +290,39 @@ void TvkaistaClient::sendStreamRequest(const Programme &programme)
     m_requestedFormat = m_format;
 }
 
-void TvkaistaClient::sendSearchRequest(const QString &phrase)
+void TvkaistaClient::sendSearchRequest(const QString &phrase, bool refresh)
 {
+    QString key = phrase.toLower();
+    ProgrammeSnapshot programmes;
+
+    /* Välimuistista vastattaessa keskeytetään vain vanhentunut hakupyyntö. */
+    if (!refresh && cachedSearchResults(key, programmes)) {
+        qDebug() << "CACHED search" << phrase;
+
+        if (m_reply != 0 && m_requestType == 7) {
+            abortRequest();
+        }
+
+        m_pendingSearchPhrase.clear();
+        m_cachedSearchResults = programmes;
+        m_cachedSearchPending = true;
+        QTimer::singleShot(0, this, SLOT(cachedSearchResultsReady()));
+        return;
+    }
+
+    /* Vain vanhempi haku keskeytetään. Muut pyynnöt saavat valmistua, ja haku lähetetään
+       niiden jälkeen. */
+    if (isRequestUnfinished() && !(m_reply != 0 && m_requestType == 7)) {
+        qDebug() << "Search deferred" << phrase;
+        m_pendingSearchPhrase = phrase;
+        m_pendingSearchRefresh = refresh;
+        return;
+    }
+
     abortRequest();
+    m_pendingSearchPhrase.clear();
+    m_cachedSearchPending = false;
+    m_requestedPhrase = key;
     QString urlString = QString("http://www.tvkaista.com/feed/search/title/%1/flv.mediarss").arg(phrase);
     qDebug() << "GET" << urlString;
     QNetworkRequest request = QNetworkRequest(QUrl(urlString));
@@ -254,6 +332,25 @@ void TvkaistaClient::sendSearchRequest(const QString &phrase)
     connect(m_reply, SIGNAL(finished()), SLOT(searchRequestFinished()));
 }
 
+void TvkaistaClient::networkRequestFinished()
+{
+    /* Vastauksen oma käsittelijä ajetaan ensin. */
+    if (!m_pendingSearchPhrase.isEmpty()) {
+        QTimer::singleShot(0, this, SLOT(sendPendingSearch()));
+    }
+}
+
+void TvkaistaClient::sendPendingSearch()
+{
+    if (m_pendingSearchPhrase.isEmpty() || isRequestUnfinished()) {
+        return;
+    }
+
+    QString phrase = m_pendingSearchPhrase;
+    m_pendingSearchPhrase.clear();
+    sendSearchRequest(phrase, m_pendingSearchRefresh);
+}
+
 void TvkaistaClient::sendPlaylistRequest()
 {
     abortRequest();
@@ -266,32 +363,57 @@ void TvkaistaClient::sendPlaylistRequest()
     connect(m_reply, SIGNAL(finished()), SLOT(playlistRequestFinished()));
 }
 
-void TvkaistaClient::sendPlaylistAddRequest(int programmeId)
+void TvkaistaClient::sendEditRequests(int type, const QList<int> &ids)
 {
-    abortRequest();
-    QByteArray data("id=");
-    data.append(QString::number(programmeId));
-    QString urlString = "http://www.tvkaista.com/feed/playlist/";
-    qDebug() << "POST" << urlString << data;
-    QUrl url(urlString);
-    QNetworkRequest request(url);
-    request.setHeader(QNetworkRequest::ContentTypeHeader, "application/x-www-form-urlencoded");
-    m_reply = m_networkAccessManager->post(request, data);
-    m_requestType = 9;
-    connect(m_reply, SIGNAL(error(QNetworkReply::NetworkError)), SLOT(requestNetworkError(QNetworkReply::NetworkError)));
-    connect(m_reply, SIGNAL(finished()), SLOT(playlistAddRequestFinished()));
+    int count = ids.size();
+
+    /* Muokkaukset lähetetään kerralla omina vastauksinaan, jotka eivät keskeytä
+       muita pyyntöjä. Verkkoyhteyksien hallinta ajaa ne rinnakkain. */
+    for (int i = 0; i < count; i++) {
+        int id = ids.at(i);
+        QString urlString = type <= 2 ? "http://www.tvkaista.com/feed/playlist/" :
+                                         "http://www.tvkaista.com/feed/seasonpasses/";
+        QNetworkReply *reply;
+
+        if (type == 1 || type == 3) {
+            QByteArray data("id=");
+            data.append(QString::number(id));
+            qDebug() << "POST" << urlString << data;
+            QNetworkRequest request = QNetworkRequest(QUrl(urlString));
+            request.setHeader(QNetworkRequest::ContentTypeHeader, "application/x-www-form-urlencoded");
+            reply = m_networkAccessManager->post(request, data);
+        }
+        else {
+            urlString.append(QString("%1/").arg(id));
+            qDebug() << "DELETE" << urlString;
+            reply = m_networkAccessManager->deleteResource(QNetworkRequest(QUrl(urlString)));
+        }
+
+        m_editReplies.insert(reply, qMakePair(type, id));
+        connect(reply, SIGNAL(finished()), SLOT(editRequestFinished()));
+    }
+
+    if (count == 0) {
+        emit editRequestsFinished(type, QList<int>());
+    }
 }
 
-void TvkaistaClient::sendPlaylistRemoveRequest(int programmeId)
+bool TvkaistaClient::hasPendingEdits(int type) const
 {
-    abortRequest();
-    QString urlString = QString("http://www.tvkaista.com/feed/playlist/%1/").arg(programmeId);
-    qDebug() << "DELETE" << urlString;
-    QNetworkRequest request = QNetworkRequest(QUrl(urlString));
-    m_reply = m_networkAccessManager->deleteResource(request);
-    m_requestType = 10;
-    connect(m_reply, SIGNAL(error(QNetworkReply::NetworkError)), SLOT(requestNetworkError(QNetworkReply::NetworkError)));
-    connect(m_reply, SIGNAL(finished()), SLOT(playlistRemoveRequestFinished()));
+    QHash<QNetworkReply*, QPair<int, int> >::const_iterator iter = m_editReplies.constBegin();
+
+    while (iter != m_editReplies.constEnd()) {
+        int pendingType = iter.value().first;
+
+        /* Katselulistan muokkaukset ovat tyyppejä 1 ja 2, sarjojen 3 ja 4. */
+        if ((pendingType + 1) / 2 == (type + 1) / 2) {
+            return true;
+        }
+
+        ++iter;
+    }
+
+    return false;
 }
 
 void TvkaistaClient::sendSeasonPassListRequest()
@@ -318,34 +440,6 @@ void TvkaistaClient::sendSeasonPassIndexRequest()
     connect(m_reply, SIGNAL(finished()), SLOT(seasonPassIndexRequestFinished()));
 }
 
-void TvkaistaClient::sendSeasonPassAddRequest(int programmeId)
-{
-    abortRequest();
-    QByteArray data("id=");
-    data.append(QString::number(programmeId));
-    QString urlString = "http://www.tvkaista.com/feed/seasonpasses/";
-    qDebug() << "POST" << urlString << data;
-    QUrl url(urlString);
-    QNetworkRequest request(url);
-    request.setHeader(QNetworkRequest::ContentTypeHeader, "application/x-www-form-urlencoded");
-    m_reply = m_networkAccessManager->post(request, data);
-    m_requestType = 13;
-    connect(m_reply, SIGNAL(error(QNetworkReply::NetworkError)), SLOT(requestNetworkError(QNetworkReply::NetworkError)));
-    connect(m_reply, SIGNAL(finished()), SLOT(seasonPassAddRequestFinished()));
-}
-
-void TvkaistaClient::sendSeasonPassRemoveRequest(int seasonPassId)
-{
-    abortRequest();
-    QString urlString = QString("http://www.tvkaista.com/feed/seasonpasses/%1/").arg(seasonPassId);
-    qDebug() << "DELETE" << urlString;
-    QNetworkRequest request = QNetworkRequest(QUrl(urlString));
-    m_reply = m_networkAccessManager->deleteResource(request);
-    m_requestType = 14;
-    connect(m_reply, SIGNAL(error(QNetworkReply::NetworkError)), SLOT(requestNetworkError(QNetworkReply::NetworkError)));
-    connect(m_reply, SIGNAL(finished()), SLOT(seasonPassRemoveRequestFinished()));
-}
-
 void TvkaistaClient::frontPageRequestFinished()
 {
     QByteArray data;
@@ -376,9 +470,8 @@ void TvkaistaClient::loginRequestFinished()
     if (invalidPassword) {
         emit loginError();
     }
-    else if (m_programmeTableParser->requestedChannelId() >= 0) {
-        sendProgrammeRequest(m_programmeTableParser->requestedChannelId(),
-                             m_programmeTableParser->requestedDate());
+    else if (m_requestedChannelId >= 0) {
+        sendProgrammeRequest(m_requestedChannelId, m_requestedDate);
     }
     else if (m_requestedStream.id >= 0) {
         sendStreamRequest(m_requestedStream);
@@ -400,6 +493,7 @@ void TvkaistaClient::channelRequestFinished()
     else {
         QList<Channel> channels = parser.channels();
         m_cache->saveChannels(channels);
+        m_backgroundResult = m_reply->property("background").toBool();
         m_reply->deleteLater();
         m_reply = 0;
         emit channelsFetched(channels);
@@ -408,47 +502,77 @@ void TvkaistaClient::channelRequestFinished()
 
 void TvkaistaClient::programmeRequestReadyRead()
 {
-    m_programmeTableParser->parse(m_reply);
+    m_busyTimer.start();
+    QMetaObject::invokeMethod(m_pageParser, "feed", Qt::QueuedConnection,
+                              Q_ARG(int, m_programmeRequestId), Q_ARG(QByteArray, m_reply->readAll()));
+    m_busyTime += m_busyTimer.nsecsElapsed();
 }
 
 void TvkaistaClient::programmeRequestFinished()
 {
+    m_busyTimer.start();
+
     if (!checkResponse()) {
         return;
     }
 
-    if (m_programmeTableParser->isValidResults()) {
+    QMetaObject::invokeMethod(m_pageParser, "feed", Qt::QueuedConnection,
+                              Q_ARG(int, m_programmeRequestId), Q_ARG(QByteArray, m_reply->readAll()));
+    QMetaObject::invokeMethod(m_pageParser, "finish", Qt::QueuedConnection,
+                              Q_ARG(int, m_programmeRequestId));
+    m_reply->deleteLater();
+    m_reply = 0;
+    m_requestedChannelId = -1;
+    m_parsePending = true;
+    m_busyTime += m_busyTimer.nsecsElapsed();
+}
+
+void TvkaistaClient::programmePageParsed(int requestId, int channelId, const QDate &date, bool valid,
+                                         const QVariantList &days, qint64 parseTime)
+{
+    m_busyTimer.start();
+    ProgrammeSnapshot shown = days.value(3).value<ProgrammeSnapshot>();
+
+    if (valid) {
         QDateTime now = QDateTime::currentDateTime();
         QDate today = now.date();
 
-        for (int i = 0; i < 7; i++) {
-            QList<Programme> programmes = m_programmeTableParser->programmes(i);
+        for (int i = 0; i < days.size(); i++) {
+            ProgrammeSnapshot programmes = days.at(i).value<ProgrammeSnapshot>();
 
             if (programmes.isEmpty()) {
                 continue;
             }
 
+            QDate day = date.addDays(i - 3);
             QDateTime expireDateTime;
 
-            if (m_programmeTableParser->date(i) == today) {
+            if (day == today) {
                 expireDateTime = now.addSecs(300);
             }
-            else if (m_programmeTableParser->date(i) > today) {
-                expireDateTime = QDateTime(m_programmeTableParser->date(i), QTime(0, 0));
+            else if (day > today) {
+                expireDateTime = QDateTime(day, QTime(0, 0));
             }
 
-            m_cache->saveProgrammes(m_programmeTableParser->requestedChannelId(),
-                                    m_programmeTableParser->date(i), now,
-                                    expireDateTime, programmes);
+            /* Välimuistiin tallennetun päivän kuvaukset luetaan näytettäessä levyltä. */
+            if (m_cache->saveProgrammes(channelId, day, now, expireDateTime, programmes) && i == 3) {
+                shown = Cache::withoutDescriptions(programmes);
+            }
         }
     }
 
-    m_reply->deleteLater();
-    m_reply = 0;
-    emit programmesFetched(m_programmeTableParser->requestedChannelId(),
-                           m_programmeTableParser->requestedDate(),
-                           m_programmeTableParser->requestedProgrammes());
-    m_programmeTableParser->clear();
+    /* Uudemman ohjelmapyynnön aikana valmistunut sivu tallennetaan välimuistiin,
+       mutta sitä ei enää näytetä. */
+    if (requestId != m_programmeRequestId) {
+        return;
+    }
+
+    m_parsePending = false;
+    networkRequestFinished();
+    emit programmesFetched(channelId, date, shown);
+    m_busyTime += m_busyTimer.nsecsElapsed();
+    qDebug() << "Programme page" << channelId << date.toString(Qt::ISODate)
+             << "GUI thread" << m_busyTime / 1000 << "us, parser thread" << parseTime / 1000 << "us";
 }
 
 void TvkaistaClient::posterRequestFinished()
@@ -458,11 +582,11 @@ void TvkaistaClient::posterRequestFinished()
     }
 
     QByteArray data = m_reply->readAll();
-    QImage poster = QImage::fromData(data, "JPEG");
 
-    if (!poster.isNull()) {
+    /* Kuva puretaan vasta taustasäikeessä, tässä tarkistetaan vain JPEG-tunniste. */
+    if (data.startsWith("\xFF\xD8")) {
         m_cache->savePoster(m_requestedProgramme, data);
-        emit posterFetched(m_requestedProgramme, poster);
+        emit posterFetched(m_requestedProgramme, data);
     }
 
     m_requestedProgramme.id = -1;
@@ -477,9 +601,90 @@ void TvkaistaClient::streamRequestFinished()
     }
 
     if (m_reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt() == 302) {
-        emit streamUrlFetched(m_requestedStream, m_requestedFormat,
-                              m_reply->attribute(QNetworkRequest::RedirectionTargetAttribute).toUrl());
+        Programme programme = m_requestedStream;
+        int format = m_requestedFormat;
+        QUrl url = m_reply->attribute(QNetworkRequest::RedirectionTargetAttribute).toUrl();
+        if (!url.path().startsWith("/login")) {
+            insertStreamUrl(streamUrlKey(programme.id, format), url);
+        }
+
+        m_requestedStream.id = -1;
+        m_reply->deleteLater();
+        m_reply = 0;
+        emit streamUrlFetched(programme, format, url);
+    }
+}
+
+void TvkaistaClient::resolveStreamUrl(const Programme &programme)
+{
+    resolveStreamUrl(programme.id, m_format);
+}
+
+void TvkaistaClient::resolveStreamUrl(int programmeId, int format)
+{
+    QPair<int, int> stream(programmeId, format);
+
+    if (programmeId < 0 || cachedStreamUrl(programmeId, format).isValid() ||
+            m_resolveReplies.values().contains(stream) || m_resolveReplies.size() >= MAX_RESOLVE_REQUESTS) {
+        return;
+    }
+
+    /* Oma vastaus, joka ei käytä m_replyä eikä siten keskeytä käyttäjän pyyntöjä. */
+    QString urlString = streamRequestUrl(programmeId, format);
+    setServerCookie();
+    qDebug() << "RESOLVE" << urlString;
+    QNetworkReply *reply = m_networkAccessManager->get(QNetworkRequest(QUrl(urlString)));
+    m_resolveReplies.insert(reply, stream);
+    connect(reply, SIGNAL(finished()), SLOT(resolveRequestFinished()));
+}
+
+QUrl TvkaistaClient::cachedStreamUrl(int programmeId, int format) const
+{
+    QHash<QString, StreamUrlCacheEntry>::const_iterator iter = m_streamUrls.constFind(streamUrlKey(programmeId, format));
+
+    if (iter == m_streamUrls.constEnd() || iter.value().expires < QDateTime::currentDateTime()) {
+        return QUrl();
+    }
+
+    return iter.value().url;
+}
+
+void TvkaistaClient::invalidateStreamUrl(int programmeId, int format)
+{
+    m_streamUrls.remove(streamUrlKey(programmeId, format));
+}
+
+void TvkaistaClient::resolveRequestFinished()
+{
+    QNetworkReply *reply = qobject_cast<QNetworkReply*>(sender());
+
+    if (reply == 0) {
+        return;
+    }
+
+    QPair<int, int> stream = m_resolveReplies.take(reply);
+    QUrl url = reply->attribute(QNetworkRequest::RedirectionTargetAttribute).toUrl();
+
+    /* Kirjautumissivulle ohjaus ei ole videon osoite, eikä ennakkohausta kirjauduta. */
+    if (reply->error() == QNetworkReply::NoError &&
+            reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt() == 302 &&
+            url.isValid() && !url.path().startsWith("/login")) {
+        insertStreamUrl(streamUrlKey(stream.first, stream.second), url);
+        emit streamUrlResolved(stream.first, stream.second, url);
+    }
+
+    reply->deleteLater();
+}
+
+void TvkaistaClient::cachedStreamUrlReady()
+{
+    if (m_cachedStream.id < 0) {
+        return;
     }
+
+    Programme programme = m_cachedStream;
+    m_cachedStream.id = -1;
+    emit streamUrlFetched(programme, m_cachedStreamFormat, m_cachedStreamUrl);
 }
 
 void TvkaistaClient::searchRequestFinished()
@@ -489,14 +694,32 @@ void TvkaistaClient::searchRequestFinished()
     }
 
     ProgrammeFeedParser parser;
+    bool ok = parser.parse(m_reply);
+    ProgrammeSnapshot programmes(parser.programmes());
 
-    if (!parser.parse(m_reply)) {
+    if (!ok) {
         qWarning() << parser.lastError();
     }
+    else {
+        insertSearchResults(m_requestedPhrase, programmes,
+                            QDateTime::currentDateTime().addSecs(SEARCH_RESULT_TTL));
+    }
 
     m_reply->deleteLater();
     m_reply = 0;
-    emit searchResultsFetched(parser.programmes());
+    emit searchResultsFetched(programmes);
+}
+
+void TvkaistaClient::cachedSearchResultsReady()
+{
+    if (!m_cachedSearchPending) {
+        return;
+    }
+
+    ProgrammeSnapshot programmes = m_cachedSearchResults;
+    m_cachedSearchPending = false;
+    m_cachedSearchResults = ProgrammeSnapshot();
+    emit searchResultsFetched(programmes);
 }
 
 void TvkaistaClient::playlistRequestFinished()
@@ -508,37 +731,42 @@ void TvkaistaClient::playlistRequestFinished()
         qWarning() << parser.lastError();
     }
 
+    m_backgroundResult = m_reply->property("background").toBool();
     m_reply->deleteLater();
     m_reply = 0;
 
     if (ok) {
-        m_cache->savePlaylist(QDateTime::currentDateTime(), parser.programmes());
-        emit playlistFetched(parser.programmes());
+        ProgrammeSnapshot programmes(parser.programmes());
+        m_cache->savePlaylist(QDateTime::currentDateTime(), programmes);
+        emit playlistFetched(programmes);
     }
 }
 
-void TvkaistaClient::playlistAddRequestFinished()
+void TvkaistaClient::editRequestFinished()
 {
-    if (m_reply == 0) {
+    QNetworkReply *reply = qobject_cast<QNetworkReply*>(sender());
+
+    if (reply == 0 || !m_editReplies.contains(reply)) {
         return;
     }
 
-    qDebug() << "REPLY" << m_reply->readAll();
-    m_reply->deleteLater();
-    m_reply = 0;
-    emit editRequestFinished(1, true);
-}
+    QPair<int, int> edit = m_editReplies.take(reply);
+    QNetworkReply::NetworkError error = reply->error();
+    int status = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+    qDebug() << "REPLY" << edit.first << edit.second << error << reply->readAll();
+    reply->deleteLater();
 
-void TvkaistaClient::playlistRemoveRequestFinished()
-{
-    if (m_reply == 0) {
-        return;
+    /* Jo aiemmin lisätty ohjelma on lisäyksen kannalta onnistunut, mutta
+       kirjautumissivulle ohjaus ei ole. */
+    bool alreadyAdded = (edit.first == 1 || edit.first == 3) && error == QNetworkReply::UnknownContentError;
+
+    if ((error != QNetworkReply::NoError && !alreadyAdded) || status == 302) {
+        m_failedEdits[edit.first].append(edit.second);
     }
 
-    qDebug() << "REPLY" << m_reply->readAll();
-    m_reply->deleteLater();
-    m_reply = 0;
-    emit editRequestFinished(2, true);
+    if (!hasPendingEdits(edit.first)) {
+        emit editRequestsFinished(edit.first, m_failedEdits.take(edit.first));
+    }
 }
 
 void TvkaistaClient::seasonPassListRequestFinished()
@@ -550,12 +778,14 @@ void TvkaistaClient::seasonPassListRequestFinished()
         qWarning() << parser.lastError();
     }
 
+    m_backgroundResult = m_reply->property("background").toBool();
     m_reply->deleteLater();
     m_reply = 0;
 
     if (ok) {
-        m_cache->saveSeasonPasses(QDateTime::currentDateTime(), parser.programmes());
-        emit seasonPassListFetched(parser.programmes());
+        ProgrammeSnapshot programmes(parser.programmes());
+        m_cache->saveSeasonPasses(QDateTime::currentDateTime(), programmes);
+        emit seasonPassListFetched(programmes);
     }
 }
 
@@ -589,30 +819,6 @@ void TvkaistaClient::seasonPassIndexRequestFinished()
     }
 }
 
-void TvkaistaClient::seasonPassAddRequestFinished()
-{
-    if (m_reply == 0) {
-        return;
-    }
-
-    qDebug() << "REPLY" << m_reply->readAll();
-    m_reply->deleteLater();
-    m_reply = 0;
-    emit editRequestFinished(3, true);
-}
-
-void TvkaistaClient::seasonPassRemoveRequestFinished()
-{
-    if (m_reply == 0) {
-        return;
-    }
-
-    qDebug() << "REPLY" << m_reply->readAll();
-    m_reply->deleteLater();
-    m_reply = 0;
-    emit editRequestFinished(4, true);
-}
-
 void TvkaistaClient::requestNetworkError(QNetworkReply::NetworkError error)
 {
     qDebug() << "ERROR" << error;
@@ -632,19 +838,16 @@ void TvkaistaClient::requestNetworkError(QNetworkReply::NetworkError error)
     else if (m_requestedStream.id >= 0 && error == QNetworkReply::ContentNotFoundError) {
         m_networkError = 2;
     }
-    else if (m_requestType == 9 && error == QNetworkReply::UnknownContentError) {
-        /* Ohjelma on jo lisätty listaan. */
-        m_networkError = 4;
-    }
-    else if (m_requestType == 13 && error == QNetworkReply::UnknownContentError) {
-        /* Ohjelma on jo lisätty sarjoihin. */
-        m_networkError = 4;
-    }
     else if (m_requestType >= 0) {
         m_networkError = 0;
         m_error = networkErrorString(error);
     }
 
+    /* Taustapäivitysten virheistä ei näytetä ilmoituksia. */
+    if (isBackgroundRequest()) {
+        m_networkError = 5;
+    }
+
     abortRequest();
 
     /* http://bugreports.qt.nokia.com/browse/QTBUG-16333 */
@@ -659,11 +862,8 @@ void TvkaistaClient::handleNetworkError()
     else if (m_networkError == 2) {
         emit streamNotFound();
     }
-    else if (m_networkError == 3) {
-        emit editRequestFinished(1, false);
-    }
-    else if (m_networkError == 4) {
-        emit editRequestFinished(3, false);
+    else if (m_networkError == 5) {
+        emit backgroundRequestFailed();
     }
     else {
         emit networkError();
@@ -714,6 +914,127 @@ bool TvkaistaClient::checkResponse()
     return true;
 }
 
+QString TvkaistaClient::streamRequestUrl(int programmeId, int format)
+{
+    QString urlString = QString("http://www.tvkaista.com/recordings/download/%1/").arg(programmeId);
+
+    switch (format) {
+    case 0:
+        urlString.append("3/300000/");
+        break;
+
+    case 1:
+        urlString.append("4/1000000/");
+        break;
+
+    case 2:
+        urlString.append("3/2000000/");
+        break;
+
+    default:
+        urlString.append("0/8000000/");
+    }
+
+    return urlString;
+}
+
+QString TvkaistaClient::streamUrlKey(int programmeId, int format) const
+{
+    return QString("%1/%2/%3").arg(programmeId).arg(format).arg(m_server);
+}
+
+void TvkaistaClient::insertStreamUrl(const QString &key, const QUrl &url)
+{
+    QDateTime now = QDateTime::currentDateTime();
+    QHash<QString, StreamUrlCacheEntry>::iterator iter = m_streamUrls.begin();
+
+    while (iter != m_streamUrls.end()) {
+        if (iter.value().expires < now) {
+            iter = m_streamUrls.erase(iter);
+        }
+        else {
+            ++iter;
+        }
+    }
+
+    StreamUrlCacheEntry entry;
+    entry.url = url;
+    entry.expires = now.addSecs(STREAM_URL_TTL);
+    m_streamUrls.insert(key, entry);
+}
+
+bool TvkaistaClient::cachedSearchResults(const QString &phrase, ProgrammeSnapshot &programmes)
+{
+    QDateTime now = QDateTime::currentDateTime();
+    QHash<QString, SearchCacheEntry>::iterator iter = m_searchResults.begin();
+
+    while (iter != m_searchResults.end()) {
+        if (iter.value().expires < now) {
+            m_searchResultOrder.removeAll(iter.key());
+            iter = m_searchResults.erase(iter);
+        }
+        else {
+            ++iter;
+        }
+    }
+
+    if (m_searchResults.contains(phrase)) {
+        programmes = m_searchResults.value(phrase).programmes;
+        m_searchResultOrder.removeAll(phrase);
+        m_searchResultOrder.append(phrase);
+        return true;
+    }
+
+    /* Tarkennettu haku suodatetaan pisimmän alkuosan tuloksista. Tyhjä tulos haetaan
+       kuitenkin palvelimelta, koska palvelin ei välttämättä vertaa osamerkkijonoja. */
+    QString prefix;
+
+    for (iter = m_searchResults.begin(); iter != m_searchResults.end(); ++iter) {
+        if (iter.key().length() > prefix.length() && phrase.startsWith(iter.key())) {
+            prefix = iter.key();
+        }
+    }
+
+    if (prefix.isEmpty()) {
+        return false;
+    }
+
+    SearchCacheEntry entry = m_searchResults.value(prefix);
+    QList<Programme> filtered;
+    int count = entry.programmes.size();
+
+    for (int i = 0; i < count; i++) {
+        const Programme &programme = entry.programmes.at(i);
+
+        if (programme.title.contains(phrase, Qt::CaseInsensitive)) {
+            filtered.append(programme);
+        }
+    }
+
+    if (filtered.isEmpty()) {
+        return false;
+    }
+
+    programmes = ProgrammeSnapshot(filtered);
+    insertSearchResults(phrase, programmes, entry.expires);
+    return true;
+}
+
+void TvkaistaClient::insertSearchResults(const QString &phrase, const ProgrammeSnapshot &programmes,
+                                         const QDateTime &expires)
+{
+    SearchCacheEntry entry;
+    entry.programmes = programmes;
+    entry.expires = expires;
+    m_searchResults.insert(phrase, entry);
+    m_searchResultOrder.removeAll(phrase);
+    m_searchResultOrder.append(phrase);
+
+    while (m_searchResultOrder.size() > MAX_SEARCH_RESULTS) {
+        m_searchResults.remove(m_searchResultOrder.takeFirst());
+    }
+}
+
 void TvkaistaClient::setServerCookie()
 {
     QNetworkCookie serverCookie("preferred_servers", m_server.toLatin1());
@@ -2,17 +2,33 @@
 #define TVKAISTACLIENT_H
 
 #include <QDate>
+#include <QElapsedTimer>
+#include <QHash>
 #include <QNetworkReply>
 #include <QObject>
+#include <QStringList>
 #include <QXmlStreamReader>
 #include "channel.h"
-#include "programme.h"
+#include "programmesnapshot.h"
 
 class QNetworkAccessManager;
 class QNetworkRequest;
+class QThread;
 class Cache;
 class ProgrammeFeedParser;
-class ProgrammeTableParser;
+class ProgrammePageParser;
+
+struct StreamUrlCacheEntry
+{
+    QUrl url;
+    QDateTime expires;
+};
+
+struct SearchCacheEntry
+{
+    ProgrammeSnapshot programmes;
+    QDateTime expires;
+};
 
 class TvkaistaClient : public QObject
 {
@@ -37,38 +53,51 @@ public:
     QString lastError() const;
     bool isValidUsernameAndPassword() const;
     bool isRequestUnfinished() const;
+    void markBackgroundRequest();
+    bool isBackgroundRequest() const;
+    bool isBackgroundResult() const;
     void sendLoginRequest();
     void sendChannelRequest();
     void sendProgrammeRequest(int channelId, const QDate &date);
     void sendPosterRequest(const Programme &programme);
     void sendStreamRequest(const Programme &programme);
-    void sendSearchRequest(const QString &phrase);
+    void resolveStreamUrl(const Programme &programme);
+    void resolveStreamUrl(int programmeId, int format);
+    QUrl cachedStreamUrl(int programmeId, int format) const;
+    void invalidateStreamUrl(int programmeId, int format);
+    void sendSearchRequest(const QString &phrase, bool refresh = false);
     void sendPlaylistRequest();
-    void sendPlaylistAddRequest(int programmeId);
-    void sendPlaylistRemoveRequest(int programmeId);
     void sendSeasonPassListRequest();
     void sendSeasonPassIndexRequest();
-    void sendSeasonPassAddRequest(int programmeId);
-    void sendSeasonPassRemoveRequest(int seasonPassId);
+
+    /**
+     * 1 = lisäys katselulistaan, 2 = poisto katselulistasta,
+     * 3 = lisäys sarjoihin, 4 = poisto sarjoista (tunnisteena season pass id)
+     */
+    void sendEditRequests(int type, const QList<int> &ids);
+    bool hasPendingEdits(int type) const;
     QNetworkReply* sendDetailedFeedRequest(const Programme &programme);
     QNetworkReply* sendRequest(const QNetworkRequest &request);
     QNetworkReply* sendRequestWithAuthHeader(const QUrl &url);
     static QString networkErrorString(QNetworkReply::NetworkError error);
+    static QString streamRequestUrl(int programmeId, int format);
 
 signals:
     void loggedIn();
     void channelsFetched(const QList<Channel> &channels);
-    void programmesFetched(int channelId, const QDate &date, const QList<Programme> &programmes);
-    void posterFetched(const Programme &programme, const QImage &poster);
+    void programmesFetched(int channelId, const QDate &date, const ProgrammeSnapshot &programmes);
+    void posterFetched(const Programme &programme, const QByteArray &data);
     void streamUrlFetched(const Programme &programme, int format, const QUrl &url);
-    void searchResultsFetched(const QList<Programme> &programmes);
-    void playlistFetched(const QList<Programme> &programmes);
-    void seasonPassListFetched(const QList<Programme> &programmes);
+    void streamUrlResolved(int programmeId, int format, const QUrl &url);
+    void searchResultsFetched(const ProgrammeSnapshot &programmes);
+    void playlistFetched(const ProgrammeSnapshot &programmes);
+    void seasonPassListFetched(const ProgrammeSnapshot &programmes);
     void seasonPassIndexFetched(const QMap<QString, int> &seasonPasses);
-    void editRequestFinished(int type, bool ok);
+    void editRequestsFinished(int type, const QList<int> &failedIds);
     void streamNotFound();
     void loginError();
     void networkError();
+    void backgroundRequestFailed();
 
 private slots:
     void frontPageRequestFinished();
@@ -76,16 +105,20 @@ private slots:
     void channelRequestFinished();
     void programmeRequestReadyRead();
     void programmeRequestFinished();
+    void programmePageParsed(int requestId, int channelId, const QDate &date, bool valid,
+                             const QVariantList &days, qint64 parseTime);
     void posterRequestFinished();
     void streamRequestFinished();
+    void resolveRequestFinished();
+    void cachedStreamUrlReady();
+    void cachedSearchResultsReady();
     void searchRequestFinished();
+    void networkRequestFinished();
+    void sendPendingSearch();
     void playlistRequestFinished();
-    void playlistAddRequestFinished();
-    void playlistRemoveRequestFinished();
     void seasonPassListRequestFinished();
     void seasonPassIndexRequestFinished();
-    void seasonPassAddRequestFinished();
-    void seasonPassRemoveRequestFinished();
+    void editRequestFinished();
     void requestAuthenticationRequired(QNetworkReply *reply, QAuthenticator* authenticator);
     void requestNetworkError(QNetworkReply::NetworkError error);
     void handleNetworkError();
@@ -94,13 +127,39 @@ private:
     void abortRequest();
     bool checkResponse();
     void setServerCookie();
+    QString streamUrlKey(int programmeId, int format) const;
+    void insertStreamUrl(const QString &key, const QUrl &url);
+    bool cachedSearchResults(const QString &phrase, ProgrammeSnapshot &programmes);
+    void insertSearchResults(const QString &phrase, const ProgrammeSnapshot &programmes,
+                             const QDateTime &expires);
     QNetworkAccessManager *m_networkAccessManager;
     QNetworkReply *m_reply;
     Cache *m_cache;
-    ProgrammeTableParser *m_programmeTableParser;
+    QThread *m_parserThread;
+    ProgrammePageParser *m_pageParser;
+    int m_programmeRequestId;
+    bool m_parsePending;
+    int m_requestedChannelId;
+    QDate m_requestedDate;
+    QElapsedTimer m_busyTimer;
+    qint64 m_busyTime;
     Programme m_requestedProgramme;
     Programme m_requestedStream;
     int m_requestedFormat;
+    QHash<QString, StreamUrlCacheEntry> m_streamUrls;
+    QHash<QNetworkReply*, QPair<int, int> > m_resolveReplies;
+    QHash<QNetworkReply*, QPair<int, int> > m_editReplies;
+    QHash<int, QList<int> > m_failedEdits;
+    Programme m_cachedStream;
+    int m_cachedStreamFormat;
+    QUrl m_cachedStreamUrl;
+    QHash<QString, SearchCacheEntry> m_searchResults;
+    QStringList m_searchResultOrder;
+    QString m_requestedPhrase;
+    ProgrammeSnapshot m_cachedSearchResults;
+    bool m_cachedSearchPending;
+    QString m_pendingSearchPhrase;
+    bool m_pendingSearchRefresh;
     QDateTime m_lastLogin;
     QString m_username;
     QString m_password;
@@ -109,6 +168,7 @@ private:
     int m_networkError;
     int m_format;
     int m_requestType;
+    bool m_backgroundResult;
 };
 
 #endif // TVKAISTACLIENT_H